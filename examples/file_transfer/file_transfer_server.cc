@@ -1,33 +1,72 @@
 #include <thread>
-#include <unordered_map>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include "config.h"
 #include "cppev/cppev.h"
 
+// Cache in shared memory, so server processes on the host load each file only once
 class filecache final
 {
 public:
-    const cppev::buffer *lazyload(const std::string &filename)
+    filecache()
+    : shm_("/cppev_file_transfer_cache", 256 * 1024 * 1024), cache_(cppev::shm_cache::attach(shm_, 1024))
     {
-        std::unique_lock<std::mutex> lock(lock_);
-        if (hash_.count(filename) != 0)
+    }
+
+    // Segment is removed by the server that created it, processes attached keep using it
+    ~filecache()
+    {
+        if (shm_.creator())
         {
-            return &(hash_[filename]->rbuffer());
+            try
+            {
+                shm_.unlink();
+            }
+            catch (const std::exception &e)
+            {
+                cppev::log::error << "cache unlink failed : " << e.what() << cppev::log::endl;
+            }
+        }
+    }
+
+    std::string lazyload(const std::string &filename)
+    {
+        // Modified or replaced file is loaded again by a different key, mtime in seconds
+        // misses writes within the same second
+        struct stat st;
+        if (stat(filename.c_str(), &st) < 0)
+        {
+            cppev::throw_system_error("stat error");
+        }
+#ifdef __APPLE__
+        const struct timespec &mtime = st.st_mtimespec;
+#else
+        const struct timespec &mtime = st.st_mtim;
+#endif
+        std::string key = filename + ":" + std::to_string(st.st_ino) + ":" + std::to_string(mtime.tv_sec)
+            + "." + std::to_string(mtime.tv_nsec) + ":" + std::to_string(st.st_size);
+
+        std::string content;
+        if (cache_->get(key, content))
+        {
+            return content;
         }
         cppev::log::info << "start loading file" << cppev::log::endl;
-        int fd = open(filename.c_str(), O_RDONLY);
-        std::shared_ptr<cppev::nstream> iops = std::make_shared<cppev::nstream>(fd);
-        iops->read_all(CHUNK_SIZE);
-        close(fd);
-        hash_[filename] = iops;
+        cppev::nstream iops(open(filename.c_str(), O_RDONLY));
+        iops.read_all(CHUNK_SIZE);
+        content = iops.rbuffer().get_string(-1, false);
+        if (!cache_->put(key, content))
+        {
+            cppev::log::error << "file is too large for cache" << cppev::log::endl;
+        }
         cppev::log::info << "finish loading file" << cppev::log::endl;
-        return &(iops->rbuffer());
+        return content;
     }
 
 private:
-    std::mutex lock_;
+    cppev::shared_memory shm_;
 
-    std::unordered_map<std::string, std::shared_ptr<cppev::nstream>> hash_;
+    cppev::shm_cache *cache_;
 };
 
 cppev::reactor::tcp_event_handler on_read_complete = [](const std::shared_ptr<cppev::nsocktcp> &iopt) -> void
@@ -42,9 +81,9 @@ cppev::reactor::tcp_event_handler on_read_complete = [](const std::shared_ptr<cp
     filename = filename.substr(0, filename.size()-1);
     cppev::log::info << "client request file : " << filename << cppev::log::endl;
 
-    const cppev::buffer *bf = reinterpret_cast<filecache *>(cppev::reactor::external_data(iopt))->lazyload(filename);
+    std::string content = reinterpret_cast<filecache *>(cppev::reactor::external_data(iopt))->lazyload(filename);
 
-    iopt->wbuffer().produce(bf->rawbuf(), bf->size());
+    iopt->wbuffer().produce(content.data(), content.size());
     cppev::reactor::async_write(iopt);
     cppev::log::info << "end callback : on_read_complete" << cppev::log::endl;
 };
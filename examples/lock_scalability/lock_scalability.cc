@@ -0,0 +1,68 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "cppev/cppev.h"
+
+// Lock operations per second of threads contending for a short critical section
+template <typename Mutex>
+double contention_throughput(int thr_num, std::chrono::milliseconds span)
+{
+    Mutex lock;
+    int64_t count = 0;
+    std::atomic<bool> stop(false);
+    std::vector<int64_t> ops(thr_num, 0);
+
+    std::vector<std::thread> thrs;
+    for (int i = 0; i < thr_num; ++i)
+    {
+        thrs.emplace_back([&, i]()
+        {
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                std::unique_lock<Mutex> _(lock);
+                ++count;
+                ++ops[i];
+            }
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(span);
+    stop = true;
+    for (auto &thr : thrs)
+    {
+        thr.join();
+    }
+    double elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(
+        std::chrono::steady_clock::now() - start).count();
+
+    int64_t total = 0;
+    for (int64_t n : ops)
+    {
+        total += n;
+    }
+    return total / elapsed;
+}
+
+// Compare throughput of spinlocks and std::mutex as contending threads grow
+int main(int argc, char **argv)
+{
+    int max_thr_num = argc > 1 ? std::stoi(argv[1]) : 64;
+    std::chrono::milliseconds span(argc > 2 ? std::stoi(argv[2]) : 20);
+
+    std::cout << "threads    std::mutex    spinlock    ttas    ticket    mcs  (Mops/s)" << std::endl;
+    for (int thr_num = 1; thr_num <= max_thr_num; thr_num *= 2)
+    {
+        std::cout << thr_num
+            << "    " << contention_throughput<std::mutex>(thr_num, span) / 1e6
+            << "    " << contention_throughput<cppev::spinlock>(thr_num, span) / 1e6
+            << "    " << contention_throughput<cppev::ttas_spinlock>(thr_num, span) / 1e6
+            << "    " << contention_throughput<cppev::ticket_spinlock>(thr_num, span) / 1e6
+            << "    " << contention_throughput<cppev::mcs_spinlock>(thr_num, span) / 1e6
+            << std::endl;
+    }
+    return 0;
+}
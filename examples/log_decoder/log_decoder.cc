@@ -0,0 +1,22 @@
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cppev/cppev.h"
+
+// Decode binary log written by async_logger in binary mode to stdout
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <binary log file>" << std::endl;
+        return 1;
+    }
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0)
+    {
+        cppev::throw_system_error("open error");
+    }
+    cppev::decode_binary_log(fd, STDOUT_FILENO);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "cppev/cppev.h"
+#include "cppev/scheduler.h"
+
+// Wakeup jitter in nanoseconds, sorted
+std::vector<int64_t> measure(bool precise, int freq, std::chrono::milliseconds span)
+{
+    std::vector<int64_t> jitters;
+    jitters.reserve(freq * span.count() / 1000 + 1);
+    {
+        cppev::timed_scheduler<std::chrono::steady_clock> executor({}, {}, {}, false);
+        executor.set_precise_mode(precise);
+        executor.add_task(freq, cppev::priority::p0, [&](const std::chrono::nanoseconds &stamp)
+        {
+            int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            jitters.push_back(now - stamp.count());
+        });
+        std::this_thread::sleep_for(span);
+    }
+    std::sort(jitters.begin(), jitters.end());
+    return jitters;
+}
+
+int64_t percentile(const std::vector<int64_t> &sorted, double p)
+{
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * p))];
+}
+
+// Compare wakeup jitter of timed_scheduler in normal and precise mode, jitter is the actual
+// wakeup minus the trigger timestamp
+int main(int argc, char **argv)
+{
+    int freq = argc > 1 ? std::stoi(argv[1]) : 2000;
+    std::chrono::milliseconds span(argc > 2 ? std::stoi(argv[2]) : 1000);
+
+    for (bool precise : { false, true })
+    {
+        std::vector<int64_t> jitters = measure(precise, freq, span);
+        if (jitters.empty())
+        {
+            continue;
+        }
+        std::cout << (precise ? "precise" : "normal ") << " mode jitter (ns) :"
+            << " p50 " << percentile(jitters, 0.5)
+            << " p99 " << percentile(jitters, 0.99)
+            << " p999 " << percentile(jitters, 0.999)
+            << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include "cppev/cppev.h"
+
+const int launches = 50;
+
+// Launch latency in microseconds, sorted
+std::vector<double> measure(cppev::subp_launch launch)
+{
+    std::vector<double> costs;
+    for (int i = 0; i < launches; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        cppev::subp_open subp("true", {}, launch);
+        auto end = std::chrono::steady_clock::now();
+        costs.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        subp.wait(std::chrono::milliseconds(1));
+    }
+    std::sort(costs.begin(), costs.end());
+    return costs;
+}
+
+// Compare launch latency of fork and posix_spawn with different RSS of parent process
+int main(int argc, char **argv)
+{
+    std::vector<size_t> rss_mbs = { 0, 512, 2048 };
+    if (argc > 1)
+    {
+        rss_mbs.clear();
+        for (int i = 1; i < argc; ++i)
+        {
+            rss_mbs.push_back(std::stoul(argv[i]));
+        }
+    }
+
+    std::cout << std::setw(10) << "rss(MB)" << std::setw(16) << "fork p50(us)" << std::setw(16)
+        << "fork p99(us)" << std::setw(16) << "spawn p50(us)" << std::setw(16) << "spawn p99(us)" << std::endl;
+    for (size_t mb : rss_mbs)
+    {
+        // Touch every page so that it's resident
+        std::vector<char> memory(mb << 20);
+        memset(memory.data(), 1, memory.size());
+
+        auto fork_costs = measure(cppev::subp_launch::fork);
+        auto spawn_costs = measure(cppev::subp_launch::spawn);
+        std::cout << std::fixed << std::setprecision(1) << std::setw(10) << mb
+            << std::setw(16) << fork_costs[launches / 2] << std::setw(16) << fork_costs[launches * 99 / 100]
+            << std::setw(16) << spawn_costs[launches / 2] << std::setw(16) << spawn_costs[launches * 99 / 100]
+            << std::endl;
+    }
+    return 0;
+}
@@ -7,18 +7,96 @@
 #include <condition_variable>
 #include <shared_mutex>
 #include <memory>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <cstdint>
 #include "cppev/buffer.h"
 #include "cppev/utils.h"
 #include "cppev/runnable.h"
+#include "cppev/log_sink.h"
+
+// Q1 : How does per-thread mode work ?
+// A1 : Each thread builds the line in its own buffer without locking, and pushes the
+//      complete record with its timestamp to its own SPSC ring when log::endl arrives.
+//      Background thread merges the heads of all rings in timestamp order, and formats
+//      the headers from the timestamps. log::info and log::error use the shared buffers,
+//      construct a logger with per_thread to use the rings.
+
+// Q2 : How to make disabled log free ?
+// A2 : Use CPPEV_INFO / CPPEV_ERROR instead of log::info / log::error, logs below the
+//      compile time level are compiled away, and runtime level is checked before any
+//      argument is evaluated.
+
+// Q3 : How does deferred log work ?
+// A3 : Caller only stores the id of a static call site and raw bytes of arguments, the
+//      background thread formats it, or writes it as binary log for decode_binary_log.
+//      Without per-thread mode, or if it's too large for the ring, the raw record is
+//      passed through the shared buffer, and still formatted by the background thread.
+
+// Q4 : Can logger be used in forked child ?
+// A4 : Yes for logger writing to fd once fork support is enabled, the background thread is
+//      restarted by the first log of the child, and records not written before fork are
+//      left to the parent. Logger with file sink shall not be used by the child. Otherwise
+//      records logged by the child are never written.
+
+// Q5 : What does fork support cost ?
+// A5 : It's process-wide pthread_atfork handlers that lock all loggers around every fork,
+//      including the ones of subp_open, so that the child doesn't inherit locks held by
+//      other threads. Without per-thread mode, the logger lock is held from the first <<
+//      until log::endl, so fork waits until every thread finishes its current line.
+//      It's disabled by default and enabled by prefork_server.
 
 namespace cppev
 {
 
+// Static call site of deferred log, "{}" in format is replaced by arguments in order
+class log_site final
+{
+public:
+    // @param format : shall have static storage duration, as well as file
+    log_site(const char *format, const char *file, int line);
+
+    log_site(const log_site &) = delete;
+    log_site &operator=(const log_site &) = delete;
+    log_site(log_site &&) = delete;
+    log_site &operator=(log_site &&) = delete;
+
+    ~log_site() = default;
+
+    uint32_t id() const noexcept
+    {
+        return id_;
+    }
+
+private:
+    uint32_t id_;
+};
+
+// Deferred log, format shall be string literal with "{}" as placeholder
+#define CPPEV_LOG_DEFERRED(logger, format, ...) \
+    do \
+    { \
+        static const cppev::log_site cppev_log_site_(format, __FILE__, __LINE__); \
+        (logger).log_deferred(cppev_log_site_, ##__VA_ARGS__); \
+    } while (0)
+
 class async_logger final
 : public runnable
 {
 public:
-    explicit async_logger(int level);
+    // @param level      : output fd, negative means a placeholder logger
+    // @param per_thread : whether records are passed by per-thread rings instead of
+    //                     buffers shared under lock
+    // @param binary     : whether deferred logs are written as binary instead of text,
+    //                     only available in per-thread mode
+    explicit async_logger(int level, bool per_thread = false, bool binary = false);
+
+    // Logger writes to file sink, binary log cannot be rotated
+    explicit async_logger(const log_file_options &options, bool per_thread = false,
+        bool binary = false);
 
     ~async_logger();
 
@@ -38,9 +116,129 @@ public:
 
     async_logger &operator<<(float x);
 
+    // Log without formatting in caller's thread, see CPPEV_LOG_DEFERRED
+    // @param args : integers, floating points, bools, pointers and strings
+    template <typename... Args>
+    void log_deferred(const log_site &site, const Args&... args)
+    {
+        std::string &rec = deferred_record(site);
+        (encode_arg(rec, args), ...);
+        commit_deferred(rec);
+    }
+
+    // Stats of file sink, throw std::logic_error if logger doesn't write to file
+    log_sink_stats sink_stats() const;
+
+    // Enable or disable restarting loggers in forked child, see Q4 and Q5
+    static void set_fork_support(bool enable);
+
 private:
+    template <typename T>
+    static void encode_arg(std::string &rec, const T &x)
+    {
+        if constexpr (std::is_same<T, bool>::value)
+        {
+            rec.push_back('b');
+            rec.push_back(x ? 1 : 0);
+        }
+        else if constexpr (std::is_same<T, char>::value)
+        {
+            rec.push_back('c');
+            rec.push_back(x);
+        }
+        else if constexpr (std::is_integral<T>::value || std::is_enum<T>::value)
+        {
+            if constexpr (std::is_signed<T>::value || std::is_enum<T>::value)
+            {
+                encode_raw(rec, 'i', static_cast<int64_t>(x));
+            }
+            else
+            {
+                encode_raw(rec, 'u', static_cast<uint64_t>(x));
+            }
+        }
+        else if constexpr (std::is_floating_point<T>::value)
+        {
+            encode_raw(rec, 'd', static_cast<double>(x));
+        }
+        else if constexpr (std::is_convertible<const T &, std::string_view>::value)
+        {
+            std::string_view str(x);
+            encode_raw(rec, 's', static_cast<uint32_t>(str.size()));
+            rec.append(str.data(), str.size());
+        }
+        else if constexpr (std::is_pointer<T>::value)
+        {
+            encode_raw(rec, 'p', reinterpret_cast<uint64_t>(x));
+        }
+        else
+        {
+            static_assert(!sizeof(T), "Not supported by deferred log");
+        }
+    }
+
+    template <typename T>
+    static void encode_raw(std::string &rec, char tag, T x)
+    {
+        rec.push_back(tag);
+        rec.append(reinterpret_cast<const char *>(&x), sizeof(x));
+    }
+
+    // Thread local record filled with site and thread id
+    std::string &deferred_record(const log_site &site);
+
+    void commit_deferred(std::string &rec);
+
+    // Per-thread ring and line under construction, defined in source file
+    struct thread_ring;
+
+    // All rings of one thread
+    struct thread_rings;
+
+    // Start background thread of non-placeholder logger
+    void start();
+
+    // Write to file sink or fd
+    void output(const char *data, size_t len);
+
     void write_header(buffer &buf);
 
+    // Ring of the calling thread, created at the first call
+    thread_ring &local_ring();
+
+    // Move a complete line from thread ring to rings
+    void commit_line(thread_ring &ring);
+
+    // Push record to ring, return false if it's oversized for ring
+    bool push_record(thread_ring &ring, int64_t stamp, uint32_t kind, const std::string &rec);
+
+    // Pass text through the shared buffer
+    void push_text(const std::string &text);
+
+    // Pass raw deferred record through the shared buffer
+    void push_deferred(int64_t stamp, const std::string &rec);
+
+    // Background loop of per-thread mode
+    void run_rings();
+
+    // Restart background thread if it's not running in this process
+    void check_fork()
+    {
+        if (generation_.load(std::memory_order_relaxed) != forks_.load(std::memory_order_relaxed))
+        {
+            restart_after_fork();
+        }
+    }
+
+    void restart_after_fork();
+
+    // Handlers of pthread_atfork
+    static void prepare_fork() noexcept;
+
+    static void parent_after_fork() noexcept;
+
+    static void child_after_fork() noexcept;
+
     int level_;
 
     bool stop_;
@@ -54,6 +252,91 @@ private:
     int recur_level_;
 
     std::vector<buffer> buffers_;
+
+    // Deferred record among text of the shared buffer
+    struct deferred_span
+    {
+        int offset;
+
+        int len;
+
+        int64_t stamp;
+    };
+
+    // Deferred records of each shared buffer in order
+    std::vector<deferred_span> spans_[2];
+
+    bool per_thread_;
+
+    // Index among all loggers, locates the thread local rings
+    int index_;
+
+    // Protects rings_ and the background thread sleeping
+    std::mutex rings_lock_;
+
+    std::condition_variable rings_cond_;
+
+    // Rings of all threads, the ones of exited threads are dropped after drained
+    std::vector<std::shared_ptr<thread_ring>> rings_;
+
+    // Incremented when ring is added
+    std::atomic<int> rings_version_;
+
+    // Whether background thread is sleeping for records
+    std::atomic<bool> sleeping_;
+
+    // Whether deferred logs are output as binary
+    bool binary_;
+
+    // Destroyed after background thread joined, so records are all written
+    std::unique_ptr<log_file_sink> sink_;
+
+    // Forks of the process that background thread runs in
+    std::atomic<int> generation_;
+
+    // Forks happened in the process and its ancestors
+    static std::atomic<int> forks_;
+};
+
+// Decode binary log written by async_logger to text, throw std::runtime_error if corrupted
+// @param in_fd  : fd of binary log
+// @param out_fd : fd that text is written to
+void decode_binary_log(int in_fd, int out_fd);
+
+// Rate limiter of one log call site
+class log_sampler final
+{
+public:
+    log_sampler() noexcept
+    : count_(0), window_(0), passed_(0)
+    {
+    }
+
+    log_sampler(const log_sampler &) = delete;
+    log_sampler &operator=(const log_sampler &) = delete;
+    log_sampler(log_sampler &&) = delete;
+    log_sampler &operator=(log_sampler &&) = delete;
+
+    ~log_sampler() = default;
+
+    // Pass one of every n calls, starting from the first one
+    bool every_n(int64_t n) noexcept
+    {
+        return count_.fetch_add(1, std::memory_order_relaxed) % n == 0;
+    }
+
+    // Pass at most n calls in each second, calls racing at the second boundary may
+    // slightly exceed the limit
+    bool per_second(int64_t n) noexcept;
+
+private:
+    std::atomic<int64_t> count_;
+
+    // Second of the current window
+    std::atomic<int64_t> window_;
+
+    // Calls passed in the current window
+    std::atomic<int64_t> passed_;
 };
 
 namespace log
@@ -63,8 +346,49 @@ extern async_logger info;
 extern async_logger error;
 extern async_logger endl;
 
+// Minimum level of log macros at runtime, 1 : info, 2 : error, 3 : none
+extern std::atomic<int> runtime_level;
+
+inline void set_level(int level) noexcept
+{
+    runtime_level.store(level, std::memory_order_relaxed);
+}
+
+inline bool enabled(int level) noexcept
+{
+    return level >= runtime_level.load(std::memory_order_relaxed);
+}
+
 }   // namespace log
 
+// Minimum level of log macros at compile time, 1 : info, 2 : error, 3 : none
+#ifndef CPPEV_LOG_LEVEL
+#define CPPEV_LOG_LEVEL 1
+#endif  // CPPEV_LOG_LEVEL
+
+// Sampler owned by the call site
+#define CPPEV_LOG_SITE_SAMPLER \
+    ([]() -> cppev::log_sampler & { static cppev::log_sampler sampler; return sampler; }())
+
+// Streams to logger if level is enabled and cond is true, operands are not evaluated
+// otherwise, e.g. CPPEV_INFO << "fd " << fd << cppev::log::endl;
+#define CPPEV_LOG_IF(level, logger, cond) \
+    if (!((level) >= CPPEV_LOG_LEVEL && cppev::log::enabled(level) && (cond))) {} else (logger)
+
+#define CPPEV_INFO CPPEV_LOG_IF(1, cppev::log::info, true)
+
+#define CPPEV_ERROR CPPEV_LOG_IF(2, cppev::log::error, true)
+
+#define CPPEV_INFO_EVERY_N(n) CPPEV_LOG_IF(1, cppev::log::info, CPPEV_LOG_SITE_SAMPLER.every_n(n))
+
+#define CPPEV_ERROR_EVERY_N(n) CPPEV_LOG_IF(2, cppev::log::error, CPPEV_LOG_SITE_SAMPLER.every_n(n))
+
+#define CPPEV_INFO_PER_SECOND(n) \
+    CPPEV_LOG_IF(1, cppev::log::info, CPPEV_LOG_SITE_SAMPLER.per_second(n))
+
+#define CPPEV_ERROR_PER_SECOND(n) \
+    CPPEV_LOG_IF(2, cppev::log::error, CPPEV_LOG_SITE_SAMPLER.per_second(n))
+
 }   // namespace cppev
 
 #endif  // async_logger.h
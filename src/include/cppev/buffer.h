@@ -12,9 +12,10 @@ namespace cppev
 
 class buffer final
 {
-    // Q: Why the two classes should be friend?
+    // Q: Why these classes should be friend?
     // A: To save a memory copy.
     friend class nstream;
+    friend class nsocktcp;
     friend class nsockudp;
 
     static_assert(sizeof(char) == 1, "basic data of buffer is not ok!");
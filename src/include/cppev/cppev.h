@@ -8,8 +8,16 @@
 #include "cppev/event_loop.h"
 #include "cppev/ipc.h"
 #include "cppev/lock.h"
+#include "cppev/log_sink.h"
 #include "cppev/nio.h"
+#include "cppev/parallel.h"
+#include "cppev/prefork.h"
 #include "cppev/runnable.h"
+#include "cppev/seqlock.h"
+#include "cppev/shm_arena.h"
+#include "cppev/shm_cache.h"
+#include "cppev/shm_notifier.h"
+#include "cppev/shm_ring.h"
 #include "cppev/subprocess.h"
 #include "cppev/tcp.h"
 #include "cppev/thread_pool.h"
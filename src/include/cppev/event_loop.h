@@ -8,6 +8,9 @@
 #include <tuple>
 #include <mutex>
 #include <functional>
+#include <chrono>
+#include <vector>
+#include <cstdint>
 #include "cppev/nio.h"
 #include "cppev/sysconfig.h"
 #include "cppev/utils.h"
@@ -36,6 +39,10 @@ constexpr fd_event operator|(fd_event a, fd_event b)
 
 using fd_event_handler = std::function<void(const std::shared_ptr<nio> &)>;
 
+// Triggered in event loop when timer expires
+// @param expirations : expirations since last trigger, more than 1 means some are missed
+using timer_handler = std::function<void(uint64_t expirations)>;
+
 class event_loop
 {
 public:
@@ -87,6 +94,23 @@ public:
     //                      the io-multiplexing api may cause program get killed when fd is closed)
     void fd_remove(const std::shared_ptr<nio> &iop, bool clean = true, bool deactivate = true);
 
+#ifdef __linux__
+    // Register timer backed by timerfd, periodic timers of the same interval share one fd
+    // and are triggered together in descending priority, later ones follow the phase of
+    // the first one.
+    // @param interval  interval of periodic timer or delay of one-shot timer
+    // @param handler   timer handler
+    // @param periodic  whether timer is periodic, one-shot timer is removed after triggered
+    // @param prio      priority among timers of the same fd
+    // @return          timer id used by timer_remove
+    int64_t timer_register(const std::chrono::nanoseconds &interval, const timer_handler &handler,
+        bool periodic = true, priority prio = p0);
+
+    // Remove timer, fd is closed when no timer shares it
+    // @return          whether timer exists
+    bool timer_remove(int64_t id);
+#endif  // __linux__
+
     // Wait for events, only loop once, timeout unit is millisecond
     void loop_once(int timeout = -1);
 
@@ -137,6 +161,53 @@ private:
 
     // Whether loop forever shall be stopped
     bool stop_;
+
+#ifdef __linux__
+    struct timer_entry
+    {
+        int64_t id;
+
+        priority prio;
+
+        std::shared_ptr<timer_handler> handler;
+    };
+
+    // Timers sharing one timerfd
+    struct timer_group
+    {
+        std::shared_ptr<nio> iop;
+
+        // Interval in nanoseconds, 0 for one-shot timer
+        int64_t interval;
+
+        // Descending priority
+        std::vector<timer_entry> timers;
+    };
+
+    // Read expirations and trigger timers of the fd
+    void timer_expire(const std::shared_ptr<nio> &iop);
+
+    // Shall be called with timer_lock_ held
+    void timer_group_remove(int fd);
+
+    // Used for timers, not held while triggering
+    std::mutex timer_lock_;
+
+    // Fd -> timers
+    std::unordered_map<int, timer_group> timer_groups_;
+
+    // Timer id -> fd
+    std::unordered_map<int64_t, int> timer_fds_;
+
+    // Interval -> fd of periodic timers
+    std::unordered_map<int64_t, int> timer_intervals_;
+
+    // Id of next registered timer
+    int64_t timer_id_ = 0;
+
+    // Timers being triggered, only used by loop thread
+    std::vector<timer_entry> timer_batch_;
+#endif  // __linux__
 };
 
 }   // namespace cppev
@@ -8,10 +8,44 @@
 namespace cppev
 {
 
+enum class shm_page
+{
+    normal,
+    // madvise MADV_HUGEPAGE, kernel may back the memory with transparent huge pages
+    transparent_huge,
+    // Huge pages reserved in hugetlbfs, only for memfd
+    huge_2mb,
+    huge_1gb,
+};
+
+struct shm_options
+{
+    // Anonymous memory created by memfd_create, the name is only a label, the memory is
+    // shared by fork or by passing the fd
+    bool memfd = false;
+
+    shm_page page = shm_page::normal;
+
+    // Prefault pages, so readers don't take page faults at first touch
+    bool populate = false;
+
+    // Lock pages in memory, limited by RLIMIT_MEMLOCK
+    bool lock = false;
+
+    // Bind pages to the NUMA node, negative means no binding
+    int numa_node = -1;
+};
+
 class shared_memory final
 {
 public:
-    shared_memory(const std::string &name, int size, mode_t mode = 0600);
+    shared_memory(const std::string &name, size_t size, mode_t mode = 0600);
+
+    // @param options : size shall be multiple of huge page size if huge pages are used
+    shared_memory(const std::string &name, size_t size, const shm_options &options, mode_t mode = 0600);
+
+    // Map memfd received from other process, the fd is owned and closed by shared memory
+    shared_memory(int fd, size_t size, const shm_options &options = shm_options());
 
     shared_memory(const shared_memory &) = delete;
     shared_memory &operator=(const shared_memory &) = delete;
@@ -55,11 +89,17 @@ public:
         return ptr_;
     }
 
-    int size() const noexcept
+    size_t size() const noexcept
     {
         return size_;
     }
 
+    // The memfd, -1 for shared memory opened by name
+    int fd() const noexcept
+    {
+        return fd_;
+    }
+
     bool creator() const noexcept
     {
         return creator_;
@@ -71,20 +111,27 @@ private:
         this->name_ = other.name_;
         this->size_ = other.size_;
         this->ptr_ = other.ptr_;
+        this->fd_ = other.fd_;
         this->creator_ = other.creator_;
 
         other.name_ = "";
         other.size_ = 0;
         other.ptr_ = nullptr;
+        other.fd_ = -1;
         other.creator_ = false;
     }
 
+    // Map fd and apply options
+    void map(int fd, const shm_options &options);
+
     std::string name_;
 
-    int size_;
+    size_t size_;
 
     void *ptr_;
 
+    int fd_;
+
     bool creator_;
 };
 
@@ -5,6 +5,9 @@
 #include <mutex>
 #include <pthread.h>
 #include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstdint>
 #include "cppev/utils.h"
 
 namespace cppev
@@ -43,6 +46,94 @@ private:
 #endif
 };
 
+// Spinlocks below are for lock held for a short time under contention of many threads, all
+// of them back off exponentially and yield cpu at last, so preempted holder or successor
+// can run when threads are more than cores.
+
+// Test-and-test-and-set lock, waiters spin on a read of the flag instead of the atomic
+// exchange, so the cache line is shared until the lock is released. Not fair.
+class ttas_spinlock final
+{
+public:
+    ttas_spinlock();
+
+    ttas_spinlock(const ttas_spinlock &) = delete;
+    ttas_spinlock &operator=(const ttas_spinlock &) = delete;
+    ttas_spinlock(ttas_spinlock &&) = delete;
+    ttas_spinlock &operator=(ttas_spinlock &&) = delete;
+
+    ~ttas_spinlock() = default;
+
+    void lock();
+
+    bool try_lock();
+
+    void unlock();
+
+private:
+    std::atomic<bool> locked_;
+};
+
+// Ticket lock, threads acquire in FIFO order, waiters back off in proportion to their
+// distance from the ticket being served.
+class ticket_spinlock final
+{
+public:
+    ticket_spinlock();
+
+    ticket_spinlock(const ticket_spinlock &) = delete;
+    ticket_spinlock &operator=(const ticket_spinlock &) = delete;
+    ticket_spinlock(ticket_spinlock &&) = delete;
+    ticket_spinlock &operator=(ticket_spinlock &&) = delete;
+
+    ~ticket_spinlock() = default;
+
+    void lock();
+
+    bool try_lock();
+
+    void unlock();
+
+private:
+    // Ticket taken by the next thread
+    alignas(64) std::atomic<uint32_t> next_;
+
+    // Ticket of the holder
+    alignas(64) std::atomic<uint32_t> serving_;
+};
+
+// MCS queue lock, FIFO order and each waiter spins on its own queue node, so the release
+// only touches the cache line of the successor. Nodes are cached per thread, lock and
+// unlock shall be called by the same thread.
+class mcs_spinlock final
+{
+public:
+    // Queue node of a waiting or holding thread
+    struct node;
+
+    mcs_spinlock();
+
+    mcs_spinlock(const mcs_spinlock &) = delete;
+    mcs_spinlock &operator=(const mcs_spinlock &) = delete;
+    mcs_spinlock(mcs_spinlock &&) = delete;
+    mcs_spinlock &operator=(mcs_spinlock &&) = delete;
+
+    ~mcs_spinlock() = default;
+
+    void lock();
+
+    bool try_lock();
+
+    void unlock();
+
+private:
+    // Last node of the queue, nullptr if unlocked
+    alignas(64) std::atomic<node *> tail_;
+
+    // Node of the holder, only accessed by the holder
+    node *owner_;
+};
+
 class pshared_lock final
 {
     friend class pshared_cond;
@@ -206,6 +297,138 @@ private:
     pshared_rwlock *rwlock_;
 };
 
+#ifdef __linux__
+
+// Wait while word == value, spurious wakeup is possible, the futex is process-shared
+// @param timeout : negative means forever
+// @return false if timeout
+bool futex_wait(std::atomic<uint32_t> &word, uint32_t value,
+    std::chrono::nanoseconds timeout = std::chrono::nanoseconds(-1));
+
+// Wake at most count waiters of word
+void futex_wake(std::atomic<uint32_t> &word, int count);
+
+// Process-shared lock on futex, usable in shared memory as pshared_lock
+// 1. Spins for a while adaptively before parking in kernel.
+// 2. Owner died : the lock word holds the owner's thread id, waiter that has been parked
+//    for robust_probe checks whether the owner still exists in /proc, and takes over the
+//    lock if not. The interval doubles up to max_robust_probe while the owner is alive.
+//    Priority inheritance mode relies on kernel which reports the dead owner.
+// 3. Recovery needs processes sharing the lock in the same pid namespace, and /proc of
+//    that namespace mounted. Owner is assumed alive if /proc doesn't show the namespace,
+//    so the lock of a dead owner is never taken over then.
+class futex_lock final
+{
+    friend class futex_cond;
+public:
+    // @param pi : whether uses FUTEX_LOCK_PI, so owner inherits priority of waiters
+    explicit futex_lock(bool pi = false);
+
+    futex_lock(const futex_lock &) = delete;
+    futex_lock &operator=(const futex_lock &) = delete;
+    futex_lock(futex_lock &&) = delete;
+    futex_lock &operator=(futex_lock &&) = delete;
+
+    ~futex_lock() = default;
+
+    void lock();
+
+    bool try_lock();
+
+    void unlock();
+
+    // Whether the lock was taken over from a dead owner by the current holder, the data
+    // protected may be inconsistent
+    bool owner_died() const noexcept
+    {
+        return owner_died_;
+    }
+
+private:
+    static constexpr std::chrono::milliseconds robust_probe = std::chrono::milliseconds(20);
+
+    static constexpr std::chrono::milliseconds max_robust_probe = std::chrono::milliseconds(1000);
+
+    static constexpr int max_spins = 200;
+
+    void lock_slow(uint32_t tid);
+
+    void lock_pi(uint32_t tid);
+
+    // Take over lock of dead owner, word is the value observed
+    bool take_over(uint32_t word, uint32_t tid);
+
+    // Owner's thread id, with waiters bit
+    std::atomic<uint32_t> word_;
+
+    // Estimated spins needed to acquire
+    std::atomic<int> spins_;
+
+    bool pi_;
+
+    bool owner_died_;
+};
+
+// Condition variable on futex, process-shared
+class futex_cond final
+{
+public:
+    using condition = std::function<bool()>;
+
+    futex_cond();
+
+    futex_cond(const futex_cond &) = delete;
+    futex_cond &operator=(const futex_cond &) = delete;
+    futex_cond(futex_cond &&) = delete;
+    futex_cond &operator=(futex_cond &&) = delete;
+
+    ~futex_cond() = default;
+
+    void wait(std::unique_lock<futex_lock> &lock);
+
+    void wait(std::unique_lock<futex_lock> &lock, const condition &cond);
+
+    // @return false if timeout
+    bool wait_for(std::unique_lock<futex_lock> &lock, std::chrono::nanoseconds timeout);
+
+    void notify_one();
+
+    void notify_all();
+
+private:
+    // Incremented by notify
+    std::atomic<uint32_t> seq_;
+
+    std::atomic<uint32_t> waiters_;
+};
+
+// Reusable barrier on futex, process-shared, waiters spin before parking
+class futex_barrier final
+{
+public:
+    explicit futex_barrier(int count);
+
+    futex_barrier(const futex_barrier &) = delete;
+    futex_barrier &operator=(const futex_barrier &) = delete;
+    futex_barrier(futex_barrier &&) = delete;
+    futex_barrier &operator=(futex_barrier &&) = delete;
+
+    ~futex_barrier() = default;
+
+    // @return true for the last one arrived in each round
+    bool wait();
+
+private:
+    const uint32_t count_;
+
+    std::atomic<uint32_t> arrived_;
+
+    // Incremented when all arrived
+    std::atomic<uint32_t> generation_;
+};
+
+#endif  // __linux__
+
 }   // namespace cppev
 
 #endif  // lock.h
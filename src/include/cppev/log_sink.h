@@ -0,0 +1,168 @@
+#ifndef _log_sink_h_6C0224787A17_
+#define _log_sink_h_6C0224787A17_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "cppev/runnable.h"
+
+// Q1 : Why is there a writer thread besides the logger thread ?
+// A1 : Logger thread only copies records to buffers of the pool, writer thread does the
+//      writev, rotation and sync, so a slow disk never stalls the merging of records.
+
+// Q2 : What happens when the disk falls behind ?
+// A2 : Buffers of the pool are all waiting for writer, the caller of append is blocked
+//      until one is written, or the records are dropped, depending on the policy.
+
+namespace cppev
+{
+
+enum class log_sync_policy
+{
+    none,
+    fdatasync,
+    fsync,
+};
+
+enum class log_overflow_policy
+{
+    block,
+    drop,
+};
+
+struct log_file_options
+{
+    // File opened with O_APPEND, rotated files are named as path.YYYYmmdd-HHMMSS.seq
+    std::string path;
+
+    // Rotate when the file reaches the size in bytes, 0 means never
+    int64_t rotate_size = 0;
+
+    // Rotate when the file is opened for the span, 0 means never
+    std::chrono::seconds rotate_interval = std::chrono::seconds(0);
+
+    // Rotated files kept, the oldest ones are removed, 0 means keep all
+    int keep_files = 0;
+
+    log_sync_policy sync = log_sync_policy::none;
+
+    // Minimum span between syncs, 0 means sync after every write
+    std::chrono::milliseconds sync_interval = std::chrono::milliseconds(0);
+
+    // Number of buffers in the pool
+    int buffer_count = 8;
+
+    // Buffer is handed to writer when it reaches the size in bytes
+    int buffer_size = 1 << 20;
+
+    log_overflow_policy overflow = log_overflow_policy::block;
+
+    // Label of lines is ERROR instead of INFO
+    bool error = false;
+};
+
+struct log_sink_stats
+{
+    // Bytes written to files
+    int64_t written;
+
+    // Bytes dropped when the pool is exhausted
+    int64_t dropped;
+
+    // Number of writev calls
+    int64_t writes;
+
+    int64_t syncs;
+
+    int64_t rotations;
+};
+
+class log_file_sink final
+: public runnable
+{
+public:
+    explicit log_file_sink(const log_file_options &options);
+
+    log_file_sink(const log_file_sink &) = delete;
+    log_file_sink &operator=(const log_file_sink &) = delete;
+    log_file_sink(log_file_sink &&) = delete;
+    log_file_sink &operator=(log_file_sink &&) = delete;
+
+    // Write all buffers then stop writer
+    ~log_file_sink();
+
+    // Copy data to the pool, shall be called by one thread
+    // @return false if data is dropped
+    bool append(const char *data, size_t len);
+
+    // Hand the partial buffer to writer and wait until all buffers are written
+    void flush();
+
+    log_sink_stats stats() const;
+
+    void run_impl() override;
+
+private:
+    void open_file();
+
+    // Rotate if size or interval is reached
+    void check_rotate(size_t incoming);
+
+    void rotate();
+
+    // Sync according to policy, force ignores the interval
+    void sync(bool force);
+
+    // Write buffers by batches of writev
+    void write_buffers(std::vector<std::string> &bufs);
+
+    log_file_options options_;
+
+    int fd_;
+
+    // Size of current file
+    int64_t file_size_;
+
+    std::chrono::steady_clock::time_point opened_at_;
+
+    std::chrono::steady_clock::time_point synced_at_;
+
+    // Whether there are writes not synced
+    bool dirty_;
+
+    // Rotated files, oldest at the front
+    std::deque<std::string> rotated_;
+
+    int64_t rotate_seq_;
+
+    mutable std::mutex lock_;
+
+    // Writer waits for full buffers
+    std::condition_variable cond_;
+
+    // Caller waits for free buffers or written
+    std::condition_variable free_cond_;
+
+    // Buffer being filled
+    std::string curr_;
+
+    // Buffers waiting for writer
+    std::vector<std::string> full_;
+
+    std::vector<std::string> free_;
+
+    // Number of flush requests not handled by writer
+    int flush_requests_;
+
+    bool stop_;
+
+    log_sink_stats stats_;
+};
+
+}   // namespace cppev
+
+#endif  // log_sink.h
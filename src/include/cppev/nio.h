@@ -475,6 +475,17 @@ public:
     // getsockopt SO_ERROR, option cannot be set
     int get_so_error() const;
 
+    // Send fd with data of wbuffer over unix domain socket, fd is attached to the first byte
+    // @param fd    Fd to send, it's duplicated in the receiving process
+    // @return      Exact bytes that have been writen from wbuffer, the rest can be written later
+    int send_fd(int fd);
+
+    // Read over unix domain socket until block or unreadable, and receive the attached fds
+    // @param fds   Fds received are appended in order, they shall be closed by caller
+    // @param step  Bytes to read in each loop
+    // @return      Exact bytes that have been read into rbuffer
+    int recv_fds(std::vector<int> &fds, int step = sysconfig::buffer_io_step);
+
 private:
     void move(nsocktcp &&other, bool move_base) noexcept
     {
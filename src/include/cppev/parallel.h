@@ -0,0 +1,253 @@
+#ifndef _parallel_h_6C0224787A17_
+#define _parallel_h_6C0224787A17_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include "cppev/thread_pool.h"
+
+// Q1 : How is the work split ?
+// A1 : Workers claim chunks from a shared cursor, the chunk size shrinks as the remaining
+//      range shrinks (guided scheduling), so uneven iterations still keep every worker busy.
+
+// Q2 : Why nested parallel algorithms don't deadlock ?
+// A2 : The caller always takes part in the work and waits by task_group, which executes
+//      queued tasks while waiting, so progress never depends on a free worker thread.
+
+namespace cppev
+{
+
+namespace parallel_impl
+{
+
+// Execute body(begin, end) over chunks of [0, n), on the pool's workers and the caller
+template <typename Body>
+void for_each_chunk(thread_pool_task_queue &pool, int64_t n, int64_t grain, const Body &body)
+{
+    if (n <= 0)
+    {
+        return;
+    }
+    const int64_t workers = pool.size() + 1;
+    if (grain <= 0)
+    {
+        grain = std::max<int64_t>(1, n / (workers * 64));
+    }
+    const int64_t helpers = std::min(workers - 1, (n + grain - 1) / grain - 1);
+
+    std::atomic<int64_t> next(0);
+    auto worker = [&next, &body, n, grain, workers]()
+    {
+        while (true)
+        {
+            int64_t begin = next.load(std::memory_order_relaxed);
+            int64_t size;
+            do
+            {
+                if (begin >= n)
+                {
+                    return;
+                }
+                size = std::max(grain, (n - begin) / (2 * workers));
+            } while (!next.compare_exchange_weak(begin, begin + size, std::memory_order_relaxed));
+            try
+            {
+                body(begin, std::min(n, begin + size));
+            }
+            catch (...)
+            {
+                next.store(n, std::memory_order_relaxed);
+                throw;
+            }
+        }
+    };
+
+    task_group group(pool);
+    for (int64_t i = 0; i < helpers; ++i)
+    {
+        group.run(worker);
+    }
+    try
+    {
+        worker();
+    }
+    catch (...)
+    {
+        try
+        {
+            group.wait();
+        }
+        catch (...)
+        {
+        }
+        throw;
+    }
+    group.wait();
+}
+
+}   // namespace parallel_impl
+
+// Execute f(i) for every i in [first, last)
+// @param grain : minimum number of iterations per chunk, 0 means chosen automatically
+template <typename Index, typename Func>
+void parallel_for(thread_pool_task_queue &pool, Index first, Index last, const Func &f,
+    Index grain = 0)
+{
+    static_assert(std::is_integral<Index>::value, "Not integral");
+    parallel_impl::for_each_chunk(pool, static_cast<int64_t>(last) - static_cast<int64_t>(first),
+        static_cast<int64_t>(grain),
+        [first, &f](int64_t begin, int64_t end)
+        {
+            for (int64_t i = begin; i < end; ++i)
+            {
+                f(static_cast<Index>(first + i));
+            }
+        }
+    );
+}
+
+// Store op(*(first + i)) to *(out + i) for every element in [first, last)
+template <typename InputIt, typename OutputIt, typename UnaryOp>
+OutputIt parallel_transform(thread_pool_task_queue &pool, InputIt first, InputIt last, OutputIt out,
+    const UnaryOp &op, int64_t grain = 0)
+{
+    int64_t n = std::distance(first, last);
+    parallel_impl::for_each_chunk(pool, n, grain,
+        [first, out, &op](int64_t begin, int64_t end)
+        {
+            auto in = first + begin;
+            auto res = out + begin;
+            for (int64_t i = begin; i < end; ++i)
+            {
+                *res++ = op(*in++);
+            }
+        }
+    );
+    return out + n;
+}
+
+// Reduce [first, last) by op, op shall be associative
+// @param deterministic : if true the range is split into chunks depending only on the range size
+//                        and grain, and partial results are combined from left to right, so the
+//                        result is reproducible even for floating point. Otherwise partial results
+//                        are combined in completion order and op shall be commutative as well.
+template <typename It, typename T, typename BinaryOp = std::plus<>>
+T parallel_reduce(thread_pool_task_queue &pool, It first, It last, T init,
+    const BinaryOp &op = BinaryOp(), bool deterministic = false, int64_t grain = 0)
+{
+    int64_t n = std::distance(first, last);
+    if (n <= 0)
+    {
+        return init;
+    }
+    auto reduce_range = [first, &op](int64_t begin, int64_t end) -> T
+    {
+        auto iter = first + begin;
+        T acc = *iter++;
+        for (int64_t i = begin + 1; i < end; ++i)
+        {
+            acc = op(std::move(acc), *iter++);
+        }
+        return acc;
+    };
+
+    if (deterministic)
+    {
+        if (grain <= 0)
+        {
+            grain = std::max<int64_t>(1, (n + 255) / 256);
+        }
+        int64_t chunks = (n + grain - 1) / grain;
+        std::vector<std::optional<T>> partials(chunks);
+        parallel_impl::for_each_chunk(pool, chunks, 1,
+            [&](int64_t begin, int64_t end)
+            {
+                for (int64_t c = begin; c < end; ++c)
+                {
+                    partials[c].emplace(reduce_range(c * grain, std::min(n, (c + 1) * grain)));
+                }
+            }
+        );
+        for (auto &p : partials)
+        {
+            init = op(std::move(init), std::move(*p));
+        }
+        return init;
+    }
+
+    std::mutex lock;
+    std::optional<T> result;
+    parallel_impl::for_each_chunk(pool, n, grain,
+        [&](int64_t begin, int64_t end)
+        {
+            T part = reduce_range(begin, end);
+            std::unique_lock<std::mutex> _(lock);
+            if (result)
+            {
+                result.emplace(op(std::move(*result), std::move(part)));
+            }
+            else
+            {
+                result.emplace(std::move(part));
+            }
+        }
+    );
+    return op(std::move(init), std::move(*result));
+}
+
+// Sort [first, last) : blocks are sorted in parallel then merged pairwise in parallel rounds
+template <typename It, typename Compare = std::less<>>
+void parallel_sort(thread_pool_task_queue &pool, It first, It last, const Compare &comp = Compare(),
+    int64_t grain = 4096)
+{
+    int64_t n = std::distance(first, last);
+    int64_t workers = pool.size() + 1;
+    if (n <= grain || workers == 1)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+    int64_t blocks = 1;
+    while (blocks < workers && n / (blocks * 2) >= grain)
+    {
+        blocks *= 2;
+    }
+    int64_t block_size = n / blocks;
+    auto bound = [first, n, block_size, blocks](int64_t i) -> It
+    {
+        return i >= blocks ? first + n : first + i * block_size;
+    };
+
+    parallel_impl::for_each_chunk(pool, blocks, 1,
+        [&](int64_t begin, int64_t end)
+        {
+            for (int64_t i = begin; i < end; ++i)
+            {
+                std::sort(bound(i), bound(i + 1), comp);
+            }
+        }
+    );
+    for (int64_t width = 1; width < blocks; width *= 2)
+    {
+        parallel_impl::for_each_chunk(pool, blocks / (width * 2), 1,
+            [&](int64_t begin, int64_t end)
+            {
+                for (int64_t i = begin; i < end; ++i)
+                {
+                    int64_t lo = i * width * 2;
+                    std::inplace_merge(bound(lo), bound(lo + width), bound(lo + width * 2), comp);
+                }
+            }
+        );
+    }
+}
+
+}   // namespace cppev
+
+#endif  // parallel.h
@@ -0,0 +1,220 @@
+#ifndef _prefork_h_6C0224787A17_
+#define _prefork_h_6C0224787A17_
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sys/types.h>
+#include "cppev/nio.h"
+#include "cppev/ipc.h"
+#include "cppev/tcp.h"
+#include "cppev/runnable.h"
+
+// Q1 : Why worker processes instead of more threads ?
+// A1 : A crashed worker only loses its own connections, and each worker has its own heap
+//      and locks, so they don't contend with each other.
+
+// Q2 : How do workers share the listening sockets ?
+// A2 : Sockets are created by supervisor and inherited by workers, each worker accepts from
+//      them in its own tcp_server. Connections arriving while a worker restarts are queued
+//      in the backlog, so none is refused.
+
+// Q3 : How does rolling restart work ?
+// A3 : Workers are restarted one by one, the old one gets SIGTERM and the next one is
+//      restarted after the new one is ready, others keep accepting meanwhile. The old one
+//      stops accepting and waits a while for clients to close, remaining connections are
+//      closed then, use reactor::migrate to keep them.
+
+// Q4 : What if a worker keeps dying ?
+// A4 : Worker that dies soon after started is restarted after a delay, which doubles with
+//      each such death up to a limit, so a worker crashing at startup doesn't make the
+//      supervisor fork in a busy loop.
+
+namespace cppev
+{
+
+namespace reactor
+{
+
+// Load of worker process, read from shared memory
+struct worker_load
+{
+    // 0 if worker is not running
+    pid_t pid;
+
+    // Times that the worker is started
+    int64_t generation;
+
+    // Connections accepted minus connections closed by opposite host
+    int64_t connections;
+
+    // Connections accepted since the worker started
+    int64_t accepted;
+
+    // Whether worker is accepting
+    bool ready;
+};
+
+class prefork_server final
+{
+public:
+    // @param proc_num      : number of worker processes
+    // @param thr_num       : number of io threads of each worker
+    // @param external_data : external data of each worker's tcp_server
+    prefork_server(int proc_num, int thr_num, void *external_data = nullptr);
+
+    prefork_server(const prefork_server &) = delete;
+    prefork_server &operator=(const prefork_server &) = delete;
+    prefork_server(prefork_server &&) = delete;
+    prefork_server &operator=(prefork_server &&) = delete;
+
+    ~prefork_server() noexcept;
+
+    // Callbacks are executed in worker processes
+    void set_on_accept(const tcp_event_handler &handler)
+    {
+        on_accept_ = handler;
+    }
+
+    void set_on_read_complete(const tcp_event_handler &handler)
+    {
+        on_read_complete_ = handler;
+    }
+
+    void set_on_write_complete(const tcp_event_handler &handler)
+    {
+        on_write_complete_ = handler;
+    }
+
+    void set_on_closed(const tcp_event_handler &handler)
+    {
+        on_closed_ = handler;
+    }
+
+    void listen(int port, family f, const char *ip = nullptr);
+
+    void listen_unix(const std::string &path, bool remove = false);
+
+    // Fork workers and start supervising, workers that died are restarted, restart and
+    // shutdown shall be called after it returns
+    void run();
+
+    // Restart workers one by one, returns after all of them are restarted
+    void restart();
+
+    // Stop supervising and workers
+    void shutdown();
+
+    std::vector<worker_load> loads() const;
+
+    // Memfd of the loads, can be passed to monitor process
+    int loads_fd() const noexcept
+    {
+        return shm_->fd();
+    }
+
+private:
+    // Load of worker in shared memory
+    struct worker_slot;
+
+    class supervisor final
+    : public runnable
+    {
+    public:
+        explicit supervisor(prefork_server *server)
+        : server_(server)
+        {
+        }
+
+        supervisor(const supervisor &) = delete;
+        supervisor &operator=(const supervisor &) = delete;
+        supervisor(supervisor &&) = delete;
+        supervisor &operator=(supervisor &&) = delete;
+
+        ~supervisor() = default;
+
+        void run_impl() override;
+
+    private:
+        prefork_server *server_;
+    };
+
+    // Restart state of worker, only accessed with lock_ held
+    struct worker_state
+    {
+        // Whether worker is being started or stopped, others shall wait for it
+        bool busy;
+
+        // Deaths soon after started in a row
+        int failures;
+
+        std::chrono::steady_clock::time_point started;
+
+        // Worker is not restarted before it
+        std::chrono::steady_clock::time_point next_start;
+    };
+
+    // Wait until worker is not busy and mark it busy, return false if stopping
+    bool acquire_worker(std::unique_lock<std::mutex> &lock, int index);
+
+    void release_worker(std::unique_lock<std::mutex> &lock, int index);
+
+    // Update restart state after starting worker, shall be called with lock_ held
+    void worker_started(int index, bool running);
+
+    // Fork worker and wait until it's ready, shall be called by the one marking it busy
+    // without lock_ held
+    // @return false if worker exited when starting
+    bool start_worker(int index);
+
+    // Terminate worker and reap it, shall be called by the one marking it busy
+    void stop_worker(int index);
+
+    // Entry of worker process, never returns
+    [[noreturn]] void worker_main(int index);
+
+    int proc_num_;
+
+    int thr_num_;
+
+    void *external_data_;
+
+    tcp_event_handler on_accept_;
+
+    tcp_event_handler on_read_complete_;
+
+    tcp_event_handler on_write_complete_;
+
+    tcp_event_handler on_closed_;
+
+    // Listening sockets inherited by workers
+    std::vector<std::shared_ptr<nsocktcp>> socks_;
+
+    // Anonymous memory of worker slots
+    std::unique_ptr<shared_memory> shm_;
+
+    worker_slot *slots_;
+
+    // Protects states_ and writing stop_
+    std::mutex lock_;
+
+    std::condition_variable cond_;
+
+    std::vector<worker_state> states_;
+
+    // Also read by start_worker without lock_ to give up waiting
+    std::atomic<bool> stop_;
+
+    std::unique_ptr<supervisor> supervisor_;
+};
+
+}   // namespace reactor
+
+}   // namespace cppev
+
+#endif  // prefork.h
@@ -9,10 +9,22 @@
 #include <chrono>
 #include <memory>
 #include <string>
-#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
 #include <thread>
 #include <algorithm>
+#include <array>
+#include <ctime>
+#include <cerrno>
+#include <type_traits>
+#include <pthread.h>
 #include "cppev/utils.h"
+#include "cppev/thread_pool.h"
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif  // __linux__
 
 namespace cppev
 {
@@ -27,6 +39,55 @@ using exit_task_handler = std::function<void(void)>;
 // @param curr_timestamp : current trigger timestamp
 using timed_task_handler = std::function<void(const std::chrono::nanoseconds &curr_timestamp)>;
 
+// Behavior when timed task finishes later than its next trigger timestamp
+enum class overrun_policy
+{
+    // Trigger the missed ticks one after another without sleeping
+    catch_up,
+
+    // Drop the missed ticks and resume at the next tick in the future
+    skip,
+
+    // Restart the period from the time the task finishes
+    shift_phase,
+};
+
+// Statistics of timed task, all durations are in nanoseconds
+struct timed_task_stats
+{
+    static constexpr int lateness_buckets = 40;
+
+    // Times the task is triggered
+    int64_t triggered;
+
+    // Times the task finishes later than its next trigger timestamp
+    int64_t overruns;
+
+    // Ticks dropped by overrun_policy::skip
+    int64_t skipped;
+
+    // Accumulated run time
+    int64_t run_time_total;
+
+    // Maximum run time
+    int64_t run_time_max;
+
+    // Log2 histogram of start time minus trigger timestamp : lateness[0] counts the ones
+    // not late, lateness[i] counts the ones late by [2^(i-1), 2^i), the last one also
+    // counts the larger ones
+    std::array<int64_t, lateness_buckets> lateness;
+};
+
+// Q1 : How are timed tasks organized ?
+// A1 : Each task owns its next deadline in a min-heap ordered by deadline, then priority,
+//      so tasks of arbitrary frequencies cost O(log n) per trigger and can be added or
+//      removed at runtime. Removed tasks are dropped lazily when they reach the heap top.
+
+// Q2 : How does precise mode work ?
+// A2 : The backend thread sleeps by clock_nanosleep with absolute deadline minus a margin,
+//      then spins on the clock until the deadline. The margin follows the observed wakeup
+//      error, and timer slack of the thread is reduced to 1ns on linux.
+
 template<typename Clock = std::chrono::system_clock>
 class timed_scheduler
 {
@@ -37,47 +98,19 @@ public:
     // @param init_tasks : tasks that will be executed once only when thread starts
     // @param exit_tasks : tasks that will be executed once only when thread exits
     // @param align : whether start time align to 1s.
+    // Tasks in timer_tasks get ids from 0 in order, with overrun_policy::catch_up.
     timed_scheduler(
         const std::vector<std::tuple<double, priority, timed_task_handler>> &timer_tasks,
         const std::vector<init_task_handler> &init_tasks = {},
         const std::vector<exit_task_handler> &exit_tasks = {},
         const bool align = true
     )
-    : stop_(false)
+    : stop_(false), started_(false), next_id_(0), precise_(false), margin_(max_margin / 2),
+      dispatching_(0)
     {
-        std::priority_queue<std::tuple<priority, size_t>, std::vector<std::tuple<priority, size_t>>,
-            tuple_less<std::tuple<priority, size_t>, 0>> timer_tasks_heap;
-        for (size_t i = 0; i < timer_tasks.size(); ++i)
-        {
-            timer_tasks_heap.push({ std::get<1>(timer_tasks[i]) , i });
-        }
-
-        std::vector<int64_t> intervals;
-        for (size_t i = 0; i < timer_tasks.size(); ++i)
-        {
-            intervals.push_back(1'000'000'000 / std::get<0>(timer_tasks[i]));
-        }
-        int64_t lcm = intervals[0];
-        int64_t gcd = intervals[0];
-        if (intervals.size() >= 2)
-        {
-            lcm = least_common_multiple(intervals);
-            gcd = greatest_common_divisor(intervals);
-        }
-        interval_ = lcm;
-
-        while (!timer_tasks_heap.empty())
+        for (const auto &timer_task : timer_tasks)
         {
-            size_t idx = std::get<1>(timer_tasks_heap.top());
-            timer_tasks_heap.pop();
-            timer_handlers_.push_back(std::get<2>(timer_tasks[idx]));
-            for (int64_t stamp = 0; stamp < lcm; stamp += gcd)
-            {
-                if (stamp % intervals[idx] == 0)
-                {
-                    tasks_[stamp].push_back(timer_handlers_.size() - 1);
-                }
-            }
+            add_task(std::get<0>(timer_task), std::get<1>(timer_task), std::get<2>(timer_task));
         }
 
         thr_ = std::thread(
@@ -93,36 +126,8 @@ public:
                     tp_curr = ceil_time_point<Clock>(tp_curr);
                     std::this_thread::sleep_until(tp_curr);
                 }
-                while(!stop_)
-                {
-                    for (auto iter = tasks_.cbegin(); !stop_ && (iter != tasks_.cend()); )
-                    {
-                        auto curr = iter;
-                        auto next = ++iter;
-
-                        int64_t span;
-                        if (next == tasks_.cend())
-                        {
-                            span = interval_ - curr->first;
-                        }
-                        else
-                        {
-                            span = next->first - curr->first;
-                        }
-
-                        for (auto idx : curr->second)
-                        {
-                            timer_handlers_[idx](tp_curr.time_since_epoch());
-                        }
-
-                        auto tp_next = tp_curr + std::chrono::nanoseconds(span);
-
-                        std::this_thread::sleep_until(tp_next);
-
-                        tp_curr = std::chrono::time_point_cast<
-                            typename decltype(tp_curr)::duration>(tp_next);
-                    }
-                }
+                start(tp_curr);
+                loop();
                 for (const auto &task : exit_tasks)
                 {
                     task();
@@ -147,22 +152,540 @@ public:
 
     ~timed_scheduler()
     {
-        stop_ = true;
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            stop_ = true;
+            cond_.notify_one();
+        }
         thr_.join();
+
+        // Dispatched tasks refer to the scheduler
+        std::unique_lock<std::mutex> lock(lock_);
+        cond_.wait(lock, [this]() { return dispatching_ == 0; });
+    }
+
+    // Add task at runtime, it's triggered at the next multiple of its interval since the
+    // scheduler starts, so tasks of the same frequency are always triggered together.
+    // @param freq : trigger frequency in Hz
+    // @param prio : tasks of the same timestamp are executed in descending priority
+    // @param policy : behavior when the task finishes later than its next tick
+    // @param pool : if not null, the task is executed by the pool instead of the backend
+    //               thread, and a tick is skipped if the previous instance is still running.
+    //               Overrun policy doesn't apply to such task. The pool shall outlive
+    //               the scheduler.
+    // @return  id of the task
+    int64_t add_task(double freq, priority prio, const timed_task_handler &handler,
+        overrun_policy policy = overrun_policy::catch_up, thread_pool_task_queue *pool = nullptr)
+    {
+        if (!(freq > 0))
+        {
+            throw_logic_error("timed task frequency shall be positive");
+        }
+        std::unique_lock<std::mutex> lock(lock_);
+        int64_t id = next_id_++;
+        task_info &info = tasks_[id];
+        info.interval = std::max<int64_t>(1, 1'000'000'000 / freq);
+        info.prio = prio;
+        info.policy = policy;
+        info.count = 0;
+        info.handler = std::make_shared<timed_task_handler>(handler);
+        info.stats = timed_task_stats();
+        info.pool = pool;
+        info.running = false;
+        if (started_)
+        {
+            info.origin = start_;
+            int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - start_).count();
+            if (elapsed > 0)
+            {
+                info.count = (elapsed + info.interval - 1) / info.interval;
+            }
+            timers_.push({ deadline(info), prio, id });
+            cond_.notify_one();
+        }
+        return id;
+    }
+
+    // Remove task, it may still be running in the backend thread or pool when this returns
+    // unless it's called by the task itself
+    // @return  whether task exists
+    bool remove_task(int64_t id)
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        return tasks_.erase(id) != 0;
+    }
+
+    // @return  whether task exists
+    bool set_overrun_policy(int64_t id, overrun_policy policy)
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto iter = tasks_.find(id);
+        if (iter == tasks_.end())
+        {
+            return false;
+        }
+        iter->second.policy = policy;
+        return true;
     }
 
+    // Precise mode reduces wakeup jitter to microseconds at the cost of spinning for the
+    // margin before each deadline. Tasks added while the thread is spinning may be delayed
+    // for at most precise_slice.
+    // @param cpu : if not negative, pin the backend thread to the cpu, shall better be an
+    //              isolated one
+    void set_precise_mode(bool enable, int cpu = -1)
+    {
+        if (cpu >= 0)
+        {
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            int ret = pthread_setaffinity_np(thr_.native_handle(), sizeof(set), &set);
+            if (ret != 0)
+            {
+                throw_system_error("pthread_setaffinity_np error", ret);
+            }
+#else
+            throw_logic_error("cpu pinning is not supported");
+#endif  // __linux__
+        }
+        std::unique_lock<std::mutex> lock(lock_);
+        precise_ = enable;
+        cond_.notify_one();
+    }
+
+    // Current margin of precise mode in nanoseconds
+    int64_t precise_margin() const
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        return margin_;
+    }
+
+    // Statistics of the task, throw std::logic_error if the task doesn't exist
+    timed_task_stats task_stats(int64_t id) const
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto iter = tasks_.find(id);
+        if (iter == tasks_.end())
+        {
+            throw_logic_error("timed task doesn't exist");
+        }
+        return iter->second.stats;
+    }
+
+    // Bounds of the spinning margin in nanoseconds
+    static constexpr int64_t min_margin = 2'000;
+
+    static constexpr int64_t max_margin = 500'000;
+
+    // Longest time in nanoseconds that precise mode sleeps without watching added tasks
+    static constexpr int64_t precise_slice = 1'000'000;
+
 private:
+    struct task_info
+    {
+        // trigger interval in nanoseconds
+        int64_t interval;
+
+        priority prio;
+
+        overrun_policy policy;
+
+        // time point that the deadlines are relative to
+        typename Clock::time_point origin;
+
+        // number of intervals since origin for next trigger
+        int64_t count;
+
+        // shared so that it's executed without holding lock
+        std::shared_ptr<timed_task_handler> handler;
+
+        timed_task_stats stats;
+
+        // pool executing the task, null means the backend thread
+        thread_pool_task_queue *pool;
+
+        // whether dispatched instance is running
+        bool running;
+    };
+
+    // Reports the dispatched instance when destroyed, so that instance discarded by
+    // the pool doesn't block the task forever
+    struct dispatch_guard
+    {
+        dispatch_guard(timed_scheduler *s, int64_t i, typename Clock::time_point tp) noexcept
+        : sched(s), id(i), deadline(tp), executed(false)
+        {
+        }
+
+        dispatch_guard(dispatch_guard &&other) noexcept
+        : sched(other.sched), id(other.id), deadline(other.deadline), start(other.start),
+          finish(other.finish), executed(other.executed)
+        {
+            other.sched = nullptr;
+        }
+
+        dispatch_guard &operator=(dispatch_guard &&) = delete;
+
+        ~dispatch_guard() noexcept
+        {
+            if (sched != nullptr)
+            {
+                sched->on_dispatch_done(*this);
+            }
+        }
+
+        timed_scheduler *sched;
+
+        int64_t id;
+
+        typename Clock::time_point deadline;
+
+        typename Clock::time_point start;
+
+        typename Clock::time_point finish;
+
+        bool executed;
+    };
+
+    // one task handed over to pool in a batch
+    struct dispatch
+    {
+        int64_t id;
+
+        std::shared_ptr<timed_task_handler> handler;
+
+        thread_pool_task_queue *pool;
+    };
+
+    // one task triggered in a batch
+    struct execution
+    {
+        int64_t id;
+
+        std::shared_ptr<timed_task_handler> handler;
+
+        typename Clock::time_point start;
+
+        typename Clock::time_point finish;
+    };
+
+    struct timer
+    {
+        typename Clock::time_point deadline;
+
+        priority prio;
+
+        int64_t id;
+    };
+
+    // earlier deadline first, then higher priority, then added earlier
+    struct timer_later
+    {
+        bool operator()(const timer &lhs, const timer &rhs) const noexcept
+        {
+            return std::tie(lhs.deadline, rhs.prio, lhs.id)
+                > std::tie(rhs.deadline, lhs.prio, rhs.id);
+        }
+    };
+
+    typename Clock::time_point deadline(const task_info &info) const noexcept
+    {
+        return info.origin + std::chrono::duration_cast<typename Clock::duration>(
+            std::chrono::nanoseconds(info.interval * info.count));
+    }
+
+    // Schedule tasks added before thread starts
+    void start(typename Clock::time_point tp)
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        start_ = tp;
+        started_ = true;
+        for (auto &kv : tasks_)
+        {
+            kv.second.origin = tp;
+            timers_.push({ deadline(kv.second), kv.second.prio, kv.first });
+        }
+    }
+
+    void loop()
+    {
+        std::vector<execution> batch;
+        std::vector<dispatch> dispatches;
+        bool slack_reduced = false;
+        std::unique_lock<std::mutex> lock(lock_);
+        while (!stop_)
+        {
+            if (slack_reduced != precise_)
+            {
+                slack_reduced = precise_;
+#ifdef __linux__
+                // 0 restores the default slack
+                prctl(PR_SET_TIMERSLACK, slack_reduced ? 1 : 0);
+#endif  // __linux__
+            }
+            if (timers_.empty())
+            {
+                cond_.wait(lock);
+                continue;
+            }
+            timer top = timers_.top();
+            if (tasks_.count(top.id) == 0)
+            {
+                timers_.pop();
+                continue;
+            }
+            if (Clock::now() < top.deadline)
+            {
+                if (precise_)
+                {
+                    wait_precisely(lock, top.deadline);
+                }
+                else
+                {
+                    cond_.wait_until(lock, top.deadline);
+                }
+                continue;
+            }
+
+            // Heap order keeps descending priority among tasks of the same timestamp
+            batch.clear();
+            dispatches.clear();
+            while (!timers_.empty() && timers_.top().deadline == top.deadline)
+            {
+                timer curr = timers_.top();
+                timers_.pop();
+                auto iter = tasks_.find(curr.id);
+                if (iter == tasks_.end())
+                {
+                    continue;
+                }
+                task_info &info = iter->second;
+                if (info.pool == nullptr)
+                {
+                    batch.push_back({ curr.id, info.handler, {}, {} });
+                    continue;
+                }
+                if (info.running)
+                {
+                    ++info.stats.overruns;
+                    ++info.stats.skipped;
+                }
+                else
+                {
+                    info.running = true;
+                    ++dispatching_;
+                    dispatches.push_back({ curr.id, info.handler, info.pool });
+                }
+                ++info.count;
+                timers_.push({ deadline(info), info.prio, curr.id });
+            }
+
+            lock.unlock();
+            auto stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                top.deadline.time_since_epoch());
+            for (auto &disp : dispatches)
+            {
+                disp.pool->add_task(
+                    [handler = std::move(disp.handler), stamp,
+                        guard = dispatch_guard(this, disp.id, top.deadline)]() mutable
+                    {
+                        guard.start = Clock::now();
+                        (*handler)(stamp);
+                        guard.finish = Clock::now();
+                        guard.executed = true;
+                    }
+                );
+            }
+            for (auto &exec : batch)
+            {
+                exec.start = Clock::now();
+                (*exec.handler)(stamp);
+                exec.finish = Clock::now();
+            }
+            lock.lock();
+
+            // Rescheduled after execution, so that overrun is decided by the finish time
+            for (const auto &exec : batch)
+            {
+                reschedule(exec, top.deadline);
+            }
+        }
+    }
+
+    // Shall be called with lock held, which may be released while waiting
+    void wait_precisely(std::unique_lock<std::mutex> &lock, typename Clock::time_point tp)
+    {
+        auto target = tp - std::chrono::duration_cast<typename Clock::duration>(
+            std::chrono::nanoseconds(margin_));
+        auto coarse = target - std::chrono::duration_cast<typename Clock::duration>(
+            std::chrono::nanoseconds(precise_slice));
+        if (Clock::now() < coarse)
+        {
+            cond_.wait_until(lock, coarse);
+            return;
+        }
+
+        lock.unlock();
+        if (Clock::now() < target)
+        {
+            sleep_absolute(target);
+            int64_t error = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - target).count();
+            lock.lock();
+            if (error * 2 > margin_)
+            {
+                margin_ = std::min(max_margin, error * 2);
+            }
+            else
+            {
+                margin_ = std::max(min_margin, margin_ - margin_ / 32);
+            }
+            lock.unlock();
+        }
+        while (Clock::now() < tp)
+        {
+        }
+        lock.lock();
+    }
+
+    static void sleep_absolute(typename Clock::time_point tp)
+    {
+#ifdef __linux__
+        clockid_t clock_id;
+        if constexpr (std::is_same<Clock, std::chrono::steady_clock>::value)
+        {
+            clock_id = CLOCK_MONOTONIC;
+        }
+        else if constexpr (std::is_same<Clock, std::chrono::system_clock>::value)
+        {
+            clock_id = CLOCK_REALTIME;
+        }
+        else
+        {
+            std::this_thread::sleep_until(tp);
+            return;
+        }
+        int64_t stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            tp.time_since_epoch()).count();
+        timespec ts;
+        ts.tv_sec = stamp / 1'000'000'000;
+        ts.tv_nsec = stamp % 1'000'000'000;
+        while (clock_nanosleep(clock_id, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        {
+        }
+#else
+        std::this_thread::sleep_until(tp);
+#endif  // __linux__
+    }
+
+    static void record(timed_task_stats &stats, typename Clock::time_point tp,
+        typename Clock::time_point start, typename Clock::time_point finish) noexcept
+    {
+        ++stats.triggered;
+        int64_t run_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            finish - start).count();
+        stats.run_time_total += run_time;
+        stats.run_time_max = std::max(stats.run_time_max, run_time);
+        int64_t late = std::chrono::duration_cast<std::chrono::nanoseconds>(start - tp).count();
+        int bucket = 0;
+        while (late > 0 && bucket < timed_task_stats::lateness_buckets - 1)
+        {
+            late >>= 1;
+            ++bucket;
+        }
+        ++stats.lateness[bucket];
+    }
+
+    void on_dispatch_done(const dispatch_guard &guard) noexcept
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto iter = tasks_.find(guard.id);
+        if (iter != tasks_.end())
+        {
+            iter->second.running = false;
+            if (guard.executed)
+            {
+                record(iter->second.stats, guard.deadline, guard.start, guard.finish);
+            }
+        }
+        if (--dispatching_ == 0)
+        {
+            cond_.notify_all();
+        }
+    }
+
+    void reschedule(const execution &exec, typename Clock::time_point tp)
+    {
+        auto iter = tasks_.find(exec.id);
+        if (iter == tasks_.end())
+        {
+            return;
+        }
+        task_info &info = iter->second;
+        timed_task_stats &stats = info.stats;
+        record(stats, tp, exec.start, exec.finish);
+
+        ++info.count;
+        if (deadline(info) <= exec.finish)
+        {
+            ++stats.overruns;
+            switch (info.policy)
+            {
+            case overrun_policy::catch_up :
+                break;
+            case overrun_policy::skip :
+            {
+                int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    exec.finish - info.origin).count();
+                int64_t count = elapsed / info.interval + 1;
+                stats.skipped += count - info.count;
+                info.count = count;
+                break;
+            }
+            case overrun_policy::shift_phase :
+                info.origin = exec.finish;
+                info.count = 1;
+                break;
+            }
+        }
+        timers_.push({ deadline(info), info.prio, exec.id });
+    }
+
+    // protects members below except thr_
+    mutable std::mutex lock_;
+
+    // notified when thread shall stop or timer is added
+    std::condition_variable cond_;
+
     // whether thread shall stop
     bool stop_;
 
-    // time interval in nanoseconds
-    int64_t interval_;
+    // whether start_ is decided
+    bool started_;
+
+    // time point that deadlines are relative to
+    typename Clock::time_point start_;
+
+    // id of next added task
+    int64_t next_id_;
+
+    // id -> timed task
+    std::unordered_map<int64_t, task_info> tasks_;
+
+    // whether precise mode is enabled
+    bool precise_;
+
+    // precise mode wakes up earlier than deadline by margin_ nanoseconds
+    int64_t margin_;
 
-    // timed task handlers, discending priority order
-    std::vector<timed_task_handler> timer_handlers_;
+    // dispatched instances not finished yet
+    int64_t dispatching_;
 
-    // timepoint -> timed handler index
-    std::map<int64_t, std::vector<size_t>> tasks_;
+    // min-heap of deadlines, stale ones of removed tasks are skipped
+    std::priority_queue<timer, std::vector<timer>, timer_later> timers_;
 
     // backend thread executing tasks
     std::thread thr_;
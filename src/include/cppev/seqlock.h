@@ -0,0 +1,302 @@
+#ifndef _seqlock_h_6C0224787A17_
+#define _seqlock_h_6C0224787A17_
+
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+// Q1 : Why not pshared_rwlock for read-mostly data ?
+// A1 : Every rdlock writes the lock word, so readers on different cores bounce the cache
+//      line. Readers of seqlock only load the sequence, and retry if a writer overlapped.
+
+// Q2 : Can they be used in shared memory ?
+// A2 : Yes, they only consist of lock-free atomics and trivially copyable data, construct
+//      them in shared memory by the creator.
+
+// Q3 : When to use snapshot instead of seq_value ?
+// A3 : seq_value copies the whole value for each read, which is fine for a few words.
+//      snapshot keeps two buffers, writer fills the spare one and then flips, so readers
+//      of large structure only retry if the writer published twice during one read.
+
+namespace cppev
+{
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "seqlock needs lock-free atomic");
+
+// Sequence lock, the sequence is odd while writer is writing
+class seqlock final
+{
+public:
+    seqlock() noexcept
+    : seq_(0)
+    {
+    }
+
+    seqlock(const seqlock &) = delete;
+    seqlock &operator=(const seqlock &) = delete;
+    seqlock(seqlock &&) = delete;
+    seqlock &operator=(seqlock &&) = delete;
+
+    ~seqlock() = default;
+
+    // Writers are serialized, so it's also usable with multiple writers
+    void lock() noexcept
+    {
+        int spins = 0;
+        while (!try_lock())
+        {
+            if (++spins > 64)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool try_lock() noexcept
+    {
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+        // Acquire on success pairs with release in unlock, so data of previous writer is visible
+        if ((seq & 1) || !seq_.compare_exchange_strong(seq, seq + 1,
+            std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            return false;
+        }
+        // Data written later shall not be visible before the odd sequence
+        std::atomic_thread_fence(std::memory_order_release);
+        return true;
+    }
+
+    void unlock() noexcept
+    {
+        seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Start of read, waits while writer is writing
+    uint32_t read_begin() const noexcept
+    {
+        int spins = 0;
+        uint32_t seq;
+        while ((seq = seq_.load(std::memory_order_acquire)) & 1)
+        {
+            if (++spins > 64)
+            {
+                std::this_thread::yield();
+            }
+        }
+        return seq;
+    }
+
+    // End of read
+    // @return true if data read may be torn, so read again
+    bool read_retry(uint32_t seq) const noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq_.load(std::memory_order_relaxed) != seq;
+    }
+
+    // Even number, increased by 2 for each write
+    uint32_t sequence() const noexcept
+    {
+        return seq_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<uint32_t> seq_;
+};
+
+// Small value protected by seqlock, stored as atomic words so reads never race
+template <typename T>
+class seq_value final
+{
+    static_assert(std::is_trivially_copyable<T>::value, "seq_value needs trivially copyable type");
+public:
+    explicit seq_value(const T &value = T()) noexcept
+    {
+        write_words(value);
+    }
+
+    seq_value(const seq_value &) = delete;
+    seq_value &operator=(const seq_value &) = delete;
+    seq_value(seq_value &&) = delete;
+    seq_value &operator=(seq_value &&) = delete;
+
+    ~seq_value() = default;
+
+    T load() const noexcept
+    {
+        uint64_t buf[words];
+        uint32_t seq;
+        do
+        {
+            seq = lock_.read_begin();
+            for (size_t i = 0; i < words; ++i)
+            {
+                buf[i] = data_[i].load(std::memory_order_relaxed);
+            }
+        } while (lock_.read_retry(seq));
+        T value;
+        memcpy(static_cast<void *>(&value), buf, sizeof(T));
+        return value;
+    }
+
+    void store(const T &value) noexcept
+    {
+        lock_.lock();
+        write_words(value);
+        lock_.unlock();
+    }
+
+    // Read-modify-write of writers
+    // @param func : called with the value to be modified
+    template <typename Func>
+    void update(Func &&func)
+    {
+        lock_.lock();
+        T value = load_locked();
+        func(value);
+        write_words(value);
+        lock_.unlock();
+    }
+
+    uint32_t sequence() const noexcept
+    {
+        return lock_.sequence();
+    }
+
+private:
+    static constexpr size_t words = (sizeof(T) + 7) / 8;
+
+    T load_locked() const noexcept
+    {
+        uint64_t buf[words];
+        for (size_t i = 0; i < words; ++i)
+        {
+            buf[i] = data_[i].load(std::memory_order_relaxed);
+        }
+        T value;
+        memcpy(static_cast<void *>(&value), buf, sizeof(T));
+        return value;
+    }
+
+    void write_words(const T &value) noexcept
+    {
+        uint64_t buf[words] = {};
+        memcpy(buf, &value, sizeof(T));
+        for (size_t i = 0; i < words; ++i)
+        {
+            data_[i].store(buf[i], std::memory_order_relaxed);
+        }
+    }
+
+    seqlock lock_;
+
+    std::atomic<uint64_t> data_[words];
+};
+
+// Double-buffered snapshot of large structure, writers publish versions and readers are
+// wait-free unless the writer laps them
+template <typename T>
+class snapshot final
+{
+    static_assert(std::is_trivially_copyable<T>::value, "snapshot needs trivially copyable type");
+public:
+    explicit snapshot(const T &value = T())
+    : current_(0), version_(0)
+    {
+        memcpy(static_cast<void *>(&buffers_[0].data), &value, sizeof(T));
+        memcpy(static_cast<void *>(&buffers_[1].data), &value, sizeof(T));
+    }
+
+    snapshot(const snapshot &) = delete;
+    snapshot &operator=(const snapshot &) = delete;
+    snapshot(snapshot &&) = delete;
+    snapshot &operator=(snapshot &&) = delete;
+
+    ~snapshot() = default;
+
+    // Call func with the latest version in place, func may be called again if the buffer
+    // is overwritten meanwhile, so it shall only inspect or copy the data
+    template <typename Func>
+    void read(Func &&func) const
+    {
+        int spins = 0;
+        while (true)
+        {
+            const buffer &buf = buffers_[current_.load(std::memory_order_acquire)];
+            uint32_t seq = buf.lock.sequence();
+            if (seq & 1)
+            {
+                // Lapped by writer
+                if (++spins > 64)
+                {
+                    std::this_thread::yield();
+                }
+                continue;
+            }
+            func(static_cast<const T &>(buf.data));
+            if (!buf.lock.read_retry(seq))
+            {
+                return;
+            }
+        }
+    }
+
+    T load() const
+    {
+        T value;
+        read([&value](const T &data) { memcpy(static_cast<void *>(&value), &data, sizeof(T)); });
+        return value;
+    }
+
+    // Modify a copy of the latest version in the spare buffer, then make it the latest
+    // @param func : called with the data to be modified
+    template <typename Func>
+    void publish(Func &&func)
+    {
+        writer_.lock();
+        uint32_t curr = current_.load(std::memory_order_relaxed);
+        buffer &spare = buffers_[1 - curr];
+        spare.lock.lock();
+        memcpy(static_cast<void *>(&spare.data), &buffers_[curr].data, sizeof(T));
+        func(spare.data);
+        spare.lock.unlock();
+        current_.store(1 - curr, std::memory_order_release);
+        version_.fetch_add(1, std::memory_order_release);
+        writer_.unlock();
+    }
+
+    void publish(const T &value)
+    {
+        publish([&value](T &data) { memcpy(static_cast<void *>(&data), &value, sizeof(T)); });
+    }
+
+    // Number of publishes
+    uint64_t version() const noexcept
+    {
+        return version_.load(std::memory_order_acquire);
+    }
+
+private:
+    struct alignas(64) buffer
+    {
+        seqlock lock;
+
+        T data;
+    };
+
+    buffer buffers_[2];
+
+    // Index of the latest buffer
+    alignas(64) std::atomic<uint32_t> current_;
+
+    std::atomic<uint64_t> version_;
+
+    // Serializes writers
+    seqlock writer_;
+};
+
+}   // namespace cppev
+
+#endif  // seqlock.h
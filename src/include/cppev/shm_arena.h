@@ -0,0 +1,865 @@
+#ifndef _shm_arena_h_6C0224787A17_
+#define _shm_arena_h_6C0224787A17_
+
+#include <atomic>
+#include <new>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include "cppev/utils.h"
+#include "cppev/ipc.h"
+
+// Q1 : Why are pointers stored as offsets ?
+// A1 : Shared memory is mapped at different addresses in different processes, offset_ptr
+//      stores the distance from itself to the pointee, which is the same in every mapping.
+//      Raw pointers and references returned by the containers are only valid in the
+//      calling process.
+
+// Q2 : How does the arena allocate ?
+// A2 : Sizes are rounded up to one of the size classes, freed blocks are kept in lock-free
+//      lists of their classes and reused by the same class, fresh blocks are cut from the
+//      untouched end of the segment. Blocks are never split or merged.
+
+// Q3 : Are the containers thread-safe ?
+// A3 : The arena is, the containers are not. The expected usage is that one process builds
+//      the tables and the others read them, otherwise guard them with a pshared lock.
+
+namespace cppev
+{
+
+// Self-relative pointer, valid in shared memory mapped at any address
+template <typename T>
+class offset_ptr final
+{
+public:
+    offset_ptr() noexcept
+    : off_(null_offset)
+    {
+    }
+
+    offset_ptr(T *ptr) noexcept
+    {
+        set(ptr);
+    }
+
+    offset_ptr(const offset_ptr &other) noexcept
+    {
+        set(other.get());
+    }
+
+    offset_ptr &operator=(const offset_ptr &other) noexcept
+    {
+        set(other.get());
+        return *this;
+    }
+
+    offset_ptr &operator=(T *ptr) noexcept
+    {
+        set(ptr);
+        return *this;
+    }
+
+    ~offset_ptr() = default;
+
+    T *get() const noexcept
+    {
+        if (off_ == null_offset)
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<T *>(reinterpret_cast<intptr_t>(this) + off_);
+    }
+
+    T &operator*() const noexcept
+    {
+        return *get();
+    }
+
+    T *operator->() const noexcept
+    {
+        return get();
+    }
+
+    T &operator[](size_t idx) const noexcept
+    {
+        return get()[idx];
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return off_ != null_offset;
+    }
+
+private:
+    // Pointing to itself is not supported, offset 0 means nullptr
+    static constexpr intptr_t null_offset = 0;
+
+    void set(T *ptr) noexcept
+    {
+        off_ = ptr == nullptr ? null_offset :
+            reinterpret_cast<intptr_t>(ptr) - reinterpret_cast<intptr_t>(this);
+    }
+
+    intptr_t off_;
+};
+
+// Allocator of the whole shared memory, the arena itself lives in the front of the segment
+class shm_arena final
+{
+public:
+    // Format the segment by its creator, the others wait until the format is done
+    static shm_arena *attach(shared_memory &shm);
+
+    shm_arena(const shm_arena &) = delete;
+    shm_arena &operator=(const shm_arena &) = delete;
+    shm_arena(shm_arena &&) = delete;
+    shm_arena &operator=(shm_arena &&) = delete;
+
+    ~shm_arena() = default;
+
+    // Block aligned to 16 bytes, throws runtime_error when the segment is exhausted
+    void *allocate(size_t size);
+
+    // @return nullptr when the segment is exhausted or size is too large
+    void *try_allocate(size_t size) noexcept;
+
+    // @param size : the same as allocated
+    void deallocate(void *ptr, size_t size) noexcept;
+
+    // Allocate and construct object, shm_arena * is passed as the first argument if the
+    // constructor accepts it, so containers of containers get the arena
+    template <typename T, typename... Args>
+    T *construct(Args&&... args)
+    {
+        static_assert(alignof(T) <= alignment, "over-aligned type is not supported");
+        void *ptr = allocate(sizeof(T));
+        try
+        {
+            return new (ptr) T(make<T>(this, std::forward<Args>(args)...));
+        }
+        catch (...)
+        {
+            deallocate(ptr, sizeof(T));
+            throw;
+        }
+    }
+
+    template <typename T>
+    void destroy(T *ptr) noexcept
+    {
+        if (ptr != nullptr)
+        {
+            ptr->~T();
+            deallocate(ptr, sizeof(T));
+        }
+    }
+
+    // Object constructed with arena as the first argument if possible
+    template <typename T, typename... Args>
+    static T make(shm_arena *arena, Args&&... args)
+    {
+        if constexpr (!std::is_scalar<T>::value && std::is_constructible<T, shm_arena *, Args...>::value)
+        {
+            return T(arena, std::forward<Args>(args)...);
+        }
+        else
+        {
+            (void)arena;
+            return T(std::forward<Args>(args)...);
+        }
+    }
+
+    // Object for other processes to find the data, nullptr if not set
+    template <typename T>
+    T *root() const noexcept
+    {
+        uint64_t off = root_.load(std::memory_order_acquire);
+        return off == 0 ? nullptr : reinterpret_cast<T *>(base() + off);
+    }
+
+    void set_root(const void *ptr) noexcept;
+
+    // Bytes of segment
+    size_t capacity() const noexcept
+    {
+        return size_;
+    }
+
+    // Bytes of blocks in use, rounded up to size classes
+    size_t allocated() const noexcept
+    {
+        return allocated_.load(std::memory_order_relaxed);
+    }
+
+    // Bytes of blocks ever cut from the segment
+    size_t reserved() const noexcept
+    {
+        return cursor_.load(std::memory_order_relaxed);
+    }
+
+    // Size of block actually used for the size
+    static size_t block_size(size_t size);
+
+    // 16, 32, 48, 64, then four classes between powers of two
+    static constexpr int size_classes = 4 + 4 * 34;
+
+    // Class of blocks for the size, blocks are only reused by the same class
+    // @return size_classes or above if too large
+    static int size_class(size_t size) noexcept;
+
+private:
+    static constexpr size_t alignment = 16;
+
+    explicit shm_arena(size_t size);
+
+    static size_t class_size(int cls) noexcept;
+
+    char *base() const noexcept
+    {
+        return reinterpret_cast<char *>(const_cast<shm_arena *>(this));
+    }
+
+    // Set by creator when formatted
+    std::atomic<uint64_t> magic_;
+
+    size_t size_;
+
+    // Offset of root object, 0 means not set
+    std::atomic<uint64_t> root_;
+
+    std::atomic<uint64_t> allocated_;
+
+    // Offset of untouched memory
+    alignas(64) std::atomic<uint64_t> cursor_;
+
+    // Heads of free lists, offset in units of alignment with ABA tag in the high bits
+    alignas(64) std::atomic<uint64_t> free_[size_classes];
+};
+
+// String in arena, always null terminated
+class shm_string final
+{
+public:
+    explicit shm_string(shm_arena *arena);
+
+    shm_string(shm_arena *arena, std::string_view str);
+
+    shm_string(const shm_string &other);
+
+    shm_string &operator=(const shm_string &other);
+
+    shm_string(shm_string &&other) noexcept;
+
+    // Steals the buffer if both are of the same arena, otherwise copies
+    shm_string &operator=(shm_string &&other);
+
+    shm_string &operator=(std::string_view str);
+
+    ~shm_string() noexcept;
+
+    void assign(std::string_view str);
+
+    void append(std::string_view str);
+
+    void push_back(char c);
+
+    void reserve(size_t cap);
+
+    void clear() noexcept
+    {
+        size_ = 0;
+        if (cap_)
+        {
+            data_[0] = '\0';
+        }
+    }
+
+    const char *c_str() const noexcept
+    {
+        return cap_ ? data_.get() : "";
+    }
+
+    const char *data() const noexcept
+    {
+        return c_str();
+    }
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    bool empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+    char &operator[](size_t idx) noexcept
+    {
+        return data_[idx];
+    }
+
+    char operator[](size_t idx) const noexcept
+    {
+        return data_[idx];
+    }
+
+    operator std::string_view() const noexcept
+    {
+        return std::string_view(c_str(), size_);
+    }
+
+    std::string str() const
+    {
+        return std::string(c_str(), size_);
+    }
+
+    shm_arena *arena() const noexcept
+    {
+        return arena_.get();
+    }
+
+private:
+    offset_ptr<shm_arena> arena_;
+
+    // Buffer of cap_ + 1 bytes, nullptr if cap_ is 0
+    offset_ptr<char> data_;
+
+    size_t size_;
+
+    size_t cap_;
+};
+
+inline bool operator==(const shm_string &lhs, const shm_string &rhs) noexcept
+{
+    return std::string_view(lhs) == std::string_view(rhs);
+}
+
+inline bool operator==(const shm_string &lhs, std::string_view rhs) noexcept
+{
+    return std::string_view(lhs) == rhs;
+}
+
+inline bool operator==(std::string_view lhs, const shm_string &rhs) noexcept
+{
+    return lhs == std::string_view(rhs);
+}
+
+inline bool operator!=(const shm_string &lhs, const shm_string &rhs) noexcept
+{
+    return !(lhs == rhs);
+}
+
+inline bool operator!=(const shm_string &lhs, std::string_view rhs) noexcept
+{
+    return !(lhs == rhs);
+}
+
+inline bool operator!=(std::string_view lhs, const shm_string &rhs) noexcept
+{
+    return !(lhs == rhs);
+}
+
+inline bool operator<(const shm_string &lhs, const shm_string &rhs) noexcept
+{
+    return std::string_view(lhs) < std::string_view(rhs);
+}
+
+// Vector in arena, elements are relocated by move constructor
+template <typename T>
+class shm_vector final
+{
+public:
+    explicit shm_vector(shm_arena *arena)
+    : arena_(arena), data_(nullptr), size_(0), cap_(0)
+    {
+    }
+
+    shm_vector(const shm_vector &other)
+    : shm_vector(other.arena_.get())
+    {
+        reserve(other.size_);
+        for (size_t i = 0; i < other.size_; ++i)
+        {
+            emplace_back(other[i]);
+        }
+    }
+
+    shm_vector &operator=(const shm_vector &other)
+    {
+        if (&other != this)
+        {
+            shm_vector tmp(other);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    shm_vector(shm_vector &&other) noexcept
+    : shm_vector(other.arena_.get())
+    {
+        swap(other);
+    }
+
+    shm_vector &operator=(shm_vector &&other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~shm_vector() noexcept
+    {
+        clear();
+        if (cap_)
+        {
+            arena_->deallocate(data_.get(), cap_ * sizeof(T));
+        }
+    }
+
+    template <typename... Args>
+    T &emplace_back(Args&&... args)
+    {
+        if (size_ == cap_)
+        {
+            // Construct first, args may refer to an element
+            size_t cap = cap_ ? cap_ * 2 : 8;
+            T *data = static_cast<T *>(arena_->allocate(cap * sizeof(T)));
+            try
+            {
+                new (data + size_) T(shm_arena::make<T>(arena_.get(), std::forward<Args>(args)...));
+            }
+            catch (...)
+            {
+                arena_->deallocate(data, cap * sizeof(T));
+                throw;
+            }
+            relocate(data, cap);
+        }
+        else
+        {
+            new (data_.get() + size_) T(shm_arena::make<T>(arena_.get(), std::forward<Args>(args)...));
+        }
+        return data_[size_++];
+    }
+
+    void push_back(const T &value)
+    {
+        emplace_back(value);
+    }
+
+    void push_back(T &&value)
+    {
+        emplace_back(std::move(value));
+    }
+
+    void pop_back() noexcept
+    {
+        data_[--size_].~T();
+    }
+
+    void reserve(size_t cap)
+    {
+        if (cap > cap_)
+        {
+            relocate(static_cast<T *>(arena_->allocate(cap * sizeof(T))), cap);
+        }
+    }
+
+    // New elements are value-initialized
+    void resize(size_t size)
+    {
+        reserve(size);
+        while (size_ < size)
+        {
+            emplace_back();
+        }
+        while (size_ > size)
+        {
+            pop_back();
+        }
+    }
+
+    void clear() noexcept
+    {
+        while (size_)
+        {
+            pop_back();
+        }
+    }
+
+    void swap(shm_vector &other) noexcept
+    {
+        offset_ptr<shm_arena> arena = arena_;
+        offset_ptr<T> data = data_;
+        arena_ = other.arena_;
+        data_ = other.data_;
+        other.arena_ = arena;
+        other.data_ = data;
+        std::swap(size_, other.size_);
+        std::swap(cap_, other.cap_);
+    }
+
+    T &operator[](size_t idx) noexcept
+    {
+        return data_[idx];
+    }
+
+    const T &operator[](size_t idx) const noexcept
+    {
+        return data_[idx];
+    }
+
+    T &at(size_t idx)
+    {
+        if (idx >= size_)
+        {
+            throw_logic_error("shm vector index out of range");
+        }
+        return data_[idx];
+    }
+
+    T &front() noexcept
+    {
+        return data_[0];
+    }
+
+    T &back() noexcept
+    {
+        return data_[size_ - 1];
+    }
+
+    T *data() noexcept
+    {
+        return data_.get();
+    }
+
+    const T *data() const noexcept
+    {
+        return data_.get();
+    }
+
+    T *begin() noexcept
+    {
+        return data_.get();
+    }
+
+    T *end() noexcept
+    {
+        return data_.get() + size_;
+    }
+
+    const T *begin() const noexcept
+    {
+        return data_.get();
+    }
+
+    const T *end() const noexcept
+    {
+        return data_.get() + size_;
+    }
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    size_t capacity() const noexcept
+    {
+        return cap_;
+    }
+
+    bool empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+private:
+    // Move elements to new storage and free the old one
+    void relocate(T *data, size_t cap) noexcept
+    {
+        for (size_t i = 0; i < size_; ++i)
+        {
+            new (data + i) T(std::move(data_[i]));
+            data_[i].~T();
+        }
+        if (cap_)
+        {
+            arena_->deallocate(data_.get(), cap_ * sizeof(T));
+        }
+        data_ = data;
+        cap_ = cap;
+    }
+
+    offset_ptr<shm_arena> arena_;
+
+    offset_ptr<T> data_;
+
+    size_t size_;
+
+    size_t cap_;
+};
+
+// Hash map in arena with separate chaining, lookup accepts any key type that Hash and
+// KeyEqual accept, e.g. std::string for shm_string key
+template <typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<>>
+class shm_hash_map final
+{
+public:
+    explicit shm_hash_map(shm_arena *arena)
+    : arena_(arena), buckets_(nullptr), bucket_count_(0), size_(0)
+    {
+    }
+
+    shm_hash_map(const shm_hash_map &) = delete;
+    shm_hash_map &operator=(const shm_hash_map &) = delete;
+    shm_hash_map(shm_hash_map &&) = delete;
+    shm_hash_map &operator=(shm_hash_map &&) = delete;
+
+    ~shm_hash_map() noexcept
+    {
+        clear();
+        if (bucket_count_)
+        {
+            arena_->deallocate(buckets_.get(), bucket_count_ * sizeof(offset_ptr<node>));
+        }
+    }
+
+    // @return nullptr if not found
+    template <typename Key>
+    V *find(const Key &key) noexcept
+    {
+        node *n = find_node(key, Hash()(key));
+        return n == nullptr ? nullptr : &n->value;
+    }
+
+    template <typename Key>
+    const V *find(const Key &key) const noexcept
+    {
+        return const_cast<shm_hash_map *>(this)->find(key);
+    }
+
+    template <typename Key>
+    bool contains(const Key &key) const noexcept
+    {
+        return find(key) != nullptr;
+    }
+
+    // Insert if key doesn't exist
+    // @return value of the key and whether inserted
+    template <typename Key, typename... Args>
+    std::pair<V *, bool> emplace(const Key &key, Args&&... args)
+    {
+        size_t hash = Hash()(key);
+        node *n = find_node(key, hash);
+        if (n != nullptr)
+        {
+            return std::make_pair(&n->value, false);
+        }
+        if (size_ + 1 > bucket_count_)
+        {
+            rehash(bucket_count_ ? bucket_count_ * 2 : 16);
+        }
+        n = arena_->template construct<node>(hash, key, std::forward<Args>(args)...);
+        offset_ptr<node> &head = buckets_[hash & (bucket_count_ - 1)];
+        n->next = head;
+        head = n;
+        ++size_;
+        return std::make_pair(&n->value, true);
+    }
+
+    template <typename Key>
+    V &operator[](const Key &key)
+    {
+        return *emplace(key).first;
+    }
+
+    // @return whether the key existed
+    template <typename Key>
+    bool erase(const Key &key) noexcept
+    {
+        if (size_ == 0)
+        {
+            return false;
+        }
+        size_t hash = Hash()(key);
+        offset_ptr<node> *link = &buckets_[hash & (bucket_count_ - 1)];
+        while (*link)
+        {
+            node *n = link->get();
+            if (n->hash == hash && KeyEqual()(n->key, key))
+            {
+                *link = n->next;
+                arena_->destroy(n);
+                --size_;
+                return true;
+            }
+            link = &n->next;
+        }
+        return false;
+    }
+
+    // @param func : called with key and value of each entry
+    template <typename Func>
+    void for_each(Func &&func)
+    {
+        for (size_t i = 0; i < bucket_count_; ++i)
+        {
+            for (node *n = buckets_[i].get(); n != nullptr; n = n->next.get())
+            {
+                func(static_cast<const K &>(n->key), n->value);
+            }
+        }
+    }
+
+    template <typename Func>
+    void for_each(Func &&func) const
+    {
+        for (size_t i = 0; i < bucket_count_; ++i)
+        {
+            for (node *n = buckets_[i].get(); n != nullptr; n = n->next.get())
+            {
+                func(static_cast<const K &>(n->key), static_cast<const V &>(n->value));
+            }
+        }
+    }
+
+    void clear() noexcept
+    {
+        for (size_t i = 0; i < bucket_count_; ++i)
+        {
+            node *n = buckets_[i].get();
+            while (n != nullptr)
+            {
+                node *next = n->next.get();
+                arena_->destroy(n);
+                n = next;
+            }
+            buckets_[i] = nullptr;
+        }
+        size_ = 0;
+    }
+
+    // Reserve buckets for count entries, so no rehash happens when filling the table
+    void reserve(size_t count)
+    {
+        size_t buckets = 16;
+        while (buckets < count)
+        {
+            buckets *= 2;
+        }
+        if (buckets > bucket_count_)
+        {
+            rehash(buckets);
+        }
+    }
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    bool empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+    size_t bucket_count() const noexcept
+    {
+        return bucket_count_;
+    }
+
+private:
+    struct node
+    {
+        template <typename Key, typename... Args>
+        node(shm_arena *arena, size_t h, const Key &k, Args&&... args)
+        : hash(h), key(shm_arena::make<K>(arena, k)),
+          value(shm_arena::make<V>(arena, std::forward<Args>(args)...))
+        {
+        }
+
+        offset_ptr<node> next;
+
+        size_t hash;
+
+        K key;
+
+        V value;
+    };
+
+    template <typename Key>
+    node *find_node(const Key &key, size_t hash) const noexcept
+    {
+        if (size_ == 0)
+        {
+            return nullptr;
+        }
+        for (node *n = buckets_[hash & (bucket_count_ - 1)].get(); n != nullptr; n = n->next.get())
+        {
+            if (n->hash == hash && KeyEqual()(n->key, key))
+            {
+                return n;
+            }
+        }
+        return nullptr;
+    }
+
+    // @param count : power of two
+    void rehash(size_t count)
+    {
+        offset_ptr<node> *buckets = static_cast<offset_ptr<node> *>(
+            arena_->allocate(count * sizeof(offset_ptr<node>)));
+        for (size_t i = 0; i < count; ++i)
+        {
+            new (buckets + i) offset_ptr<node>();
+        }
+        for (size_t i = 0; i < bucket_count_; ++i)
+        {
+            node *n = buckets_[i].get();
+            while (n != nullptr)
+            {
+                node *next = n->next.get();
+                offset_ptr<node> &head = buckets[n->hash & (count - 1)];
+                n->next = head;
+                head = n;
+                n = next;
+            }
+        }
+        if (bucket_count_)
+        {
+            arena_->deallocate(buckets_.get(), bucket_count_ * sizeof(offset_ptr<node>));
+        }
+        buckets_ = buckets;
+        bucket_count_ = count;
+    }
+
+    offset_ptr<shm_arena> arena_;
+
+    offset_ptr<offset_ptr<node>> buckets_;
+
+    size_t bucket_count_;
+
+    size_t size_;
+};
+
+}   // namespace cppev
+
+namespace std
+{
+
+template <>
+struct hash<cppev::shm_string>
+{
+    size_t operator()(std::string_view str) const noexcept
+    {
+        return hash<std::string_view>()(str);
+    }
+};
+
+}   // namespace std
+
+#endif  // shm_arena.h
@@ -0,0 +1,142 @@
+#ifndef _shm_cache_h_6C0224787A17_
+#define _shm_cache_h_6C0224787A17_
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+#include "cppev/ipc.h"
+#include "cppev/shm_arena.h"
+
+// Q1 : How is the table organized ?
+// A1 : Open addressing within buckets of a fixed number of ways, the key is hashed to a
+//      bucket and only the ways of the bucket are probed, so there's no tombstone and a
+//      lookup touches a few cache lines. Keys and values are stored in the arena.
+
+// Q2 : How are reads lock-free ?
+// A2 : Each bucket has a sequence which is odd while a writer holds the bucket. Reader
+//      copies the value and retries if the sequence changed, the freed entry it may have
+//      read is still mapped and the length is checked against the segment.
+
+// Q3 : How does eviction work ?
+// A3 : Hit sets the reference bit of the way. When a bucket is full, its CLOCK hand skips
+//      and clears referenced ways and evicts the first unreferenced one. When the arena
+//      is full, a global CLOCK hand evicts entries across buckets until the value fits.
+//      The arena never splits or merges blocks, so only entries of the same size class
+//      as the new one are evicted, and put fails at once if there's none of them.
+
+// Q4 : What if a process dies while writing ?
+// A4 : The bucket stays locked and writers of the bucket spin, so writers shall not be
+//      killed during put or erase.
+
+namespace cppev
+{
+
+struct shm_cache_stats
+{
+    // Number of entries
+    int64_t size;
+
+    int64_t evictions;
+
+    // Bytes of arena in use
+    int64_t allocated;
+};
+
+class shm_cache final
+{
+public:
+    // Cache of whole shared memory, created by the creator of the segment and found by
+    // the others as the root of arena
+    // @param capacity : maximum number of entries, rounded up to the ways of buckets
+    static shm_cache *attach(shared_memory &shm, size_t capacity);
+
+    // Shall be constructed in the arena
+    shm_cache(shm_arena *arena, size_t capacity);
+
+    shm_cache(const shm_cache &) = delete;
+    shm_cache &operator=(const shm_cache &) = delete;
+    shm_cache(shm_cache &&) = delete;
+    shm_cache &operator=(shm_cache &&) = delete;
+
+    ~shm_cache() noexcept;
+
+    // Copy value of key, lock-free
+    // @return false if not found
+    bool get(std::string_view key, std::string &value);
+
+    // Insert or replace, evict entries if needed
+    // @return false if the entry cannot fit in the arena
+    bool put(std::string_view key, std::string_view value);
+
+    // @return whether the key existed
+    bool erase(std::string_view key);
+
+    // Maximum number of entries
+    size_t capacity() const noexcept
+    {
+        return bucket_count_ * ways;
+    }
+
+    shm_cache_stats stats() const noexcept;
+
+private:
+    static constexpr int ways = 8;
+
+    struct bucket;
+
+    // Key and value stored in arena
+    struct entry
+    {
+        uint32_t key_len;
+
+        uint32_t value_len;
+    };
+
+    // Lock bucket for writing
+    uint32_t lock_bucket(bucket &b) noexcept;
+
+    void unlock_bucket(bucket &b, uint32_t seq) noexcept;
+
+    // Remove way of locked bucket, return the entry to be freed after unlocking
+    entry *remove_way(bucket &b, int way) noexcept;
+
+    // Index of way of key in locked bucket, -1 if not found
+    int find_way(bucket &b, uint64_t hash, std::string_view key) noexcept;
+
+    // Evict one entry of the size class by global CLOCK hand
+    bool evict_one(int cls) noexcept;
+
+    entry *entry_of(uint64_t off) const noexcept
+    {
+        return reinterpret_cast<entry *>(reinterpret_cast<char *>(const_cast<shm_cache *>(this)) + off);
+    }
+
+    uint64_t offset_of(const entry *e) const noexcept
+    {
+        return reinterpret_cast<const char *>(e) - reinterpret_cast<const char *>(this);
+    }
+
+    void free_entry(entry *e) noexcept;
+
+    offset_ptr<shm_arena> arena_;
+
+    offset_ptr<bucket> buckets_;
+
+    size_t bucket_count_;
+
+    // Global CLOCK hand over all ways
+    std::atomic<uint64_t> hand_;
+
+    std::atomic<int64_t> size_;
+
+    std::atomic<int64_t> evictions_;
+
+    // Number of entries of each size class of arena
+    std::atomic<int64_t> class_entries_[shm_arena::size_classes];
+};
+
+}   // namespace cppev
+
+#endif  // shm_cache.h
@@ -0,0 +1,82 @@
+#ifndef _shm_notifier_h_6C0224787A17_
+#define _shm_notifier_h_6C0224787A17_
+
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include "cppev/nio.h"
+#include "cppev/ipc.h"
+
+// Q1 : Why not semaphore or pshared_cond ?
+// A1 : Both block a whole thread, while eventfd can be registered to event_loop together
+//      with sockets, so one io thread serves both of them.
+
+// Q2 : How are wakeups coalesced ?
+// A2 : Consumer arms a word in shared memory before draining, producer only writes the
+//      eventfd when it disarms the word, so a burst of notifies costs one syscall and one
+//      wakeup. Both sides issue a full fence between data and the word, so notify after
+//      the last drain check is never lost.
+
+// Q3 : How does the other process get the eventfd ?
+// A3 : Inherited by fork, or received by nsocktcp::recv_fds.
+
+namespace cppev
+{
+
+#ifdef __linux__
+
+class shm_notifier final
+{
+public:
+    // Control block in the front of shared memory
+    struct control;
+
+    // Control block is formatted by creator of the shared memory, the others wait until
+    // the format is done
+    // @param fd : eventfd shared by processes, -1 to create one
+    explicit shm_notifier(shared_memory &shm, int fd = -1);
+
+    shm_notifier(const shm_notifier &) = delete;
+    shm_notifier &operator=(const shm_notifier &) = delete;
+    shm_notifier(shm_notifier &&) = delete;
+    shm_notifier &operator=(shm_notifier &&) = delete;
+
+    ~shm_notifier() = default;
+
+    // Producer : wake consumer after data is published, only the first notify after
+    // consumer rearms writes the eventfd
+    void notify();
+
+    // Consumer : clear eventfd and arm again, shall be called before draining data
+    // @return whether eventfd was written
+    bool rearm();
+
+    // Readable when notified, to be registered to event_loop
+    const std::shared_ptr<nio> &ev() const noexcept
+    {
+        return ev_;
+    }
+
+    int fd() const noexcept
+    {
+        return ev_->fd();
+    }
+
+    // Times of eventfd written since formatted
+    uint64_t wakeups() const noexcept;
+
+    // Shared memory size needed by notifier
+    static size_t required_size() noexcept;
+
+private:
+    control *ctl_;
+
+    // Eventfd
+    std::shared_ptr<nio> ev_;
+};
+
+#endif  // __linux__
+
+}   // namespace cppev
+
+#endif  // shm_notifier.h
@@ -0,0 +1,141 @@
+#ifndef _shm_ring_h_6C0224787A17_
+#define _shm_ring_h_6C0224787A17_
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include "cppev/ipc.h"
+
+// Q1 : How are records laid out ?
+// A1 : Each record is an 8 bytes header followed by payload padded to 8 bytes, record
+//      that doesn't fit the end of ring is preceded by a padding record, so payload is
+//      always contiguous and can be written or read in place.
+
+// Q2 : How do multiple producers share the ring ?
+// A2 : Producers claim space by CAS of the reserve cursor, then commit in the order of
+//      reservation, so consumer only follows the committed cursor. A producer which
+//      dies between reserve and commit stalls the ring.
+
+// Q3 : How does blocking work ?
+// A3 : Waiter announces itself by a counter and sleeps on a futex word in the shared
+//      memory, the other side only issues the wake syscall when there is a waiter.
+
+namespace cppev
+{
+
+enum class shm_ring_mode
+{
+    spsc,
+    mpsc,
+};
+
+class shm_ring final
+{
+public:
+    // Space reserved by producer or record peeked by consumer
+    struct slot
+    {
+        // Payload, nullptr if nothing is reserved or peeked
+        char *data;
+
+        size_t size;
+
+        // Position of record start and end in the ring
+        uint64_t begin;
+
+        uint64_t end;
+    };
+
+    // Control block in the front of shared memory, followed by the ring
+    struct control;
+
+    // Ring takes the whole shared memory, which is formatted by its creator, the others
+    // wait until the format is done
+    // @param mode : shall be the same in all processes
+    shm_ring(shared_memory &shm, shm_ring_mode mode);
+
+    shm_ring(const shm_ring &) = delete;
+    shm_ring &operator=(const shm_ring &) = delete;
+    shm_ring(shm_ring &&) = delete;
+    shm_ring &operator=(shm_ring &&) = delete;
+
+    ~shm_ring() = default;
+
+    // Bytes of ring for records
+    size_t capacity() const noexcept
+    {
+        return cap_;
+    }
+
+    // Maximum payload size of one record
+    size_t max_record() const noexcept
+    {
+        return cap_ / 2 - header_size;
+    }
+
+    // Reserve space for payload, slot.data is nullptr if ring is full
+    slot try_reserve(size_t len);
+
+    // Reserve space for payload, wait until there's space
+    // @param timeout : negative means forever, slot.data is nullptr when timeout
+    slot reserve(size_t len, std::chrono::nanoseconds timeout = std::chrono::nanoseconds(-1));
+
+    // Publish reserved space, len may be less than reserved
+    void commit(const slot &s, size_t len);
+
+    void commit(const slot &s)
+    {
+        commit(s, s.size);
+    }
+
+    // Copy to ring without waiting
+    bool try_push(const void *data, size_t len);
+
+    // Record at the front, slot.data is nullptr if ring is empty
+    slot try_peek();
+
+    // Wait for record at the front
+    // @param timeout : negative means forever, slot.data is nullptr when timeout
+    slot peek(std::chrono::nanoseconds timeout = std::chrono::nanoseconds(-1));
+
+    // Drop the peeked record and free its space
+    void release(const slot &s);
+
+    // Bytes of committed records not released
+    size_t size() const noexcept;
+
+    // Shared memory size needed by ring of the capacity
+    static size_t required_size(size_t capacity) noexcept;
+
+private:
+    static constexpr size_t header_size = 8;
+
+    static size_t aligned(size_t len) noexcept
+    {
+        return (len + 7) & ~static_cast<size_t>(7);
+    }
+
+    // Reserve [begin, end) for record, write padding record if wrapped
+    slot place(uint64_t pos, size_t len) noexcept;
+
+    // Whether space of need bytes after pos is available, also the wrapped size
+    bool fits(uint64_t pos, size_t need, uint64_t head, uint64_t &end) const noexcept;
+
+    void wake_consumer() noexcept;
+
+    void wake_producers() noexcept;
+
+    control *ctl_;
+
+    char *data_;
+
+    size_t cap_;
+
+    size_t mask_;
+
+    shm_ring_mode mode_;
+};
+
+}   // namespace cppev
+
+#endif  // shm_ring.h
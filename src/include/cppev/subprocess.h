@@ -6,22 +6,44 @@
 #include <tuple>
 #include <memory>
 #include <chrono>
+#include <functional>
 #include "cppev/nio.h"
+#include "cppev/event_loop.h"
+
+// Q1 : Why posix_spawn ?
+// A1 : Fork copies page tables of parent, which costs tens of milliseconds and much memory
+//      for parent with large RSS. Posix_spawn shares memory with parent until exec like
+//      vfork, so its cost doesn't grow with RSS.
+
+// Q2 : Why subp_async ?
+// A2 : Subp_open polls the subprocess and buffers the whole output. Subp_async registers
+//      pidfd and pipes to event loop, so exit is handled once it happens, and output is
+//      passed to callbacks chunk by chunk, one event loop serves many subprocesses.
 
 namespace cppev
 {
 
+enum class subp_launch
+{
+    // Fork then exec, command is searched in PATH of env
+    fork,
+    // Posix_spawn, command is searched in PATH of current process, exec failure is thrown
+    spawn,
+};
+
 namespace subprocess
 {
 
-std::tuple<int, std::string, std::string> exec_cmd(const std::string &cmd, const std::vector<std::string> &env = {});
+std::tuple<int, std::string, std::string> exec_cmd(const std::string &cmd, const std::vector<std::string> &env = {},
+    subp_launch launch = subp_launch::fork);
 
 }   // namespace subprocess
 
 class subp_open final
 {
 public:
-    explicit subp_open(const std::string &cmd, const std::vector<std::string> &env);
+    explicit subp_open(const std::string &cmd, const std::vector<std::string> &env,
+        subp_launch launch = subp_launch::fork);
 
     subp_open(const subp_open &) = delete;
     subp_open &operator=(const subp_open &) = delete;
@@ -52,6 +74,7 @@ public:
 
     void wait();
 
+    // Read output and write input, writing to exited subprocess doesn't raise SIGPIPE
     void communicate(const char *input, int len);
 
     void communicate();
@@ -88,6 +111,136 @@ private:
     int returncode_;
 };
 
+#ifdef __linux__
+
+// Chunk of output, data is only valid in the callback
+using subp_output_handler = std::function<void(const char *data, int len)>;
+
+// Wait status of subprocess, same as subp_open::returncode
+using subp_exit_handler = std::function<void(int returncode)>;
+
+class subp_async final
+{
+public:
+    // @param step : maximum bytes of output chunk
+    explicit subp_async(const std::string &cmd, const std::vector<std::string> &env,
+        subp_launch launch = subp_launch::spawn, int step = sysconfig::buffer_io_step);
+
+    subp_async(const subp_async &) = delete;
+    subp_async &operator=(const subp_async &) = delete;
+    subp_async(subp_async &&) = delete;
+    subp_async &operator=(subp_async &&) = delete;
+
+    // Fds are removed from event loop, shall be called in thread of the event loop or after
+    // it stops, subprocess not exited is killed and reaped unless detached
+    ~subp_async() noexcept;
+
+    // Callbacks are executed by thread of the event loop
+    void set_on_stdout(const subp_output_handler &handler)
+    {
+        on_stdout_ = handler;
+    }
+
+    void set_on_stderr(const subp_output_handler &handler)
+    {
+        on_stderr_ = handler;
+    }
+
+    // Executed when subprocess exits, output written before exit has been passed
+    void set_on_exit(const subp_exit_handler &handler)
+    {
+        on_exit_ = handler;
+    }
+
+    // Launch subprocess and register pidfd and pipes to event loop
+    void run(event_loop &evlp);
+
+    // Write to stdin, data not written is flushed when pipe is writable. Shall be called in
+    // thread of the event loop or before run. Data to exited subprocess is discarded
+    // without raising SIGPIPE.
+    void communicate(const char *input, int len);
+
+    void communicate(const std::string &input);
+
+    // Close stdin after data is flushed
+    void close_stdin();
+
+    void terminate() const;
+
+    void kill() const;
+
+    void send_signal(int sig) const;
+
+    // Leave subprocess running when destructed, the caller shall reap it by pid
+    void detach() noexcept
+    {
+        detached_ = true;
+    }
+
+    bool exited() const noexcept;
+
+    int returncode() const noexcept;
+
+    pid_t pid() const noexcept;
+
+private:
+    // Output pipe is readable
+    // @param drain : read until no data, otherwise only one chunk is read
+    void on_output(const std::shared_ptr<nstream> &iopt, const subp_output_handler &handler, bool drain);
+
+    // Stdin pipe is writable
+    void on_input();
+
+    // Pidfd is readable
+    void on_exit();
+
+    void flush_stdin();
+
+    std::string cmd_;
+
+    std::vector<std::string> env_;
+
+    subp_launch launch_;
+
+    int step_;
+
+    subp_output_handler on_stdout_;
+
+    subp_output_handler on_stderr_;
+
+    subp_exit_handler on_exit_;
+
+    event_loop *evlp_;
+
+    std::shared_ptr<nstream> stdin_;
+
+    std::shared_ptr<nstream> stdout_;
+
+    std::shared_ptr<nstream> stderr_;
+
+    // Readable when subprocess exits
+    std::shared_ptr<nio> pidfd_;
+
+    // Pipe ends of subprocess, closed after launched
+    std::vector<int> child_fds_;
+
+    // Whether stdin is registered for writable
+    bool stdin_writing_;
+
+    // Whether stdin shall be closed after flushed
+    bool stdin_closing_;
+
+    bool exited_;
+
+    bool detached_;
+
+    pid_t pid_;
+
+    int returncode_;
+};
+
+#endif  // __linux__
+
 }   // namespace cppev
 
 #endif  // subprocess.h
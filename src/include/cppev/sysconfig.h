@@ -21,6 +21,9 @@ extern int buffer_outdate;
 // batch size for IO
 extern int buffer_io_step;
 
+// per-thread ring size of logger in bytes, power of 2
+extern int log_ring_size;
+
 }   // namespace sysconfig
 
 }   // namespace cppev
@@ -33,6 +33,11 @@ void safely_close(const std::shared_ptr<nsocktcp> &iopt);
 // Get external data of reactor server and client
 void *external_data(const std::shared_ptr<nsocktcp> &iopt);
 
+// Migrate connection to tcp_server of another process which listens for migration in path,
+// data in rbuffer and wbuffer is carried. Shall be called in the callbacks.
+// @return whether migrated, the connection is closed in this process if so
+bool migrate(const std::shared_ptr<nsocktcp> &iopt, const std::string &path);
+
 class acceptor;
 class connector;
 class iohandler;
@@ -174,7 +179,7 @@ class acceptor final
 {
 public:
     explicit acceptor(tp_shared_data *data)
-    : evlp_(reinterpret_cast<void *>(data), reinterpret_cast<void *>(this))
+    : evlp_(reinterpret_cast<void *>(data), reinterpret_cast<void *>(this)), migration_(false)
     {
     }
 
@@ -189,6 +194,14 @@ public:
     // by accept thread to accept connection and assign connection to thread pool
     static void on_acpt_readable(const std::shared_ptr<nio> &iop);
 
+    // Migration listening socket is readable, this callback will be executed by accept thread
+    // to accept channels from other processes
+    static void on_migr_acpt_readable(const std::shared_ptr<nio> &iop);
+
+    // Channel is readable, this callback will be executed by accept thread to receive the
+    // migrated connections and assign them to thread pool
+    static void on_migr_readable(const std::shared_ptr<nio> &iop);
+
     // Register readable to event loop and start loop
     void run_impl() override;
 
@@ -198,6 +211,12 @@ public:
     // Specify unix domain listening socket's path
     void listen_unix(const std::string &path, bool remove = false);
 
+    // Specify socket that is already listening, e.g. inherited from parent process
+    void listen(const std::shared_ptr<nsocktcp> &sock);
+
+    // Specify unix domain listening socket's path for connections migrated by other processes
+    void listen_migration(const std::string &path, bool remove = false);
+
     // Shutdown io eventloop
     void shutdown();
 
@@ -207,6 +226,12 @@ private:
 
     // Listening socket
     std::shared_ptr<nsocktcp> sock_;
+
+    // Whether listening for migration
+    bool migration_;
+
+    // Channel fd -> fds received whose data is incomplete
+    std::unordered_map<int, std::queue<int>> migr_fds_;
 };
 
 
@@ -302,8 +327,19 @@ public:
 
     void listen_unix(const std::string &path, bool remove = false);
 
+    // Listening socket may be shared with other processes
+    void listen(const std::shared_ptr<nsocktcp> &sock);
+
+    // Accept connections migrated by reactor::migrate of other processes, on_accept is
+    // executed for them and then on_read_complete if data is carried
+    void listen_migration(const std::string &path, bool remove = false);
+
     void run();
 
+    // Stop listening threads, connections accepted are still served and on_accept of them
+    // has been executed when returns
+    void stop_accept();
+
     void shutdown();
 
 private:
@@ -4,11 +4,20 @@
 #include <vector>
 #include <memory>
 #include <queue>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
 #include <type_traits>
-#include <vector>
 #include <functional>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <future>
+#include <tuple>
+#include <exception>
+#include <new>
+#include <system_error>
 #include "cppev/utils.h"
 #include "cppev/runnable.h"
 
@@ -91,101 +100,1062 @@ namespace task_queue
 
 using thread_pool_task_handler = std::function<void(void)>;
 
+// Move-only callable, closure no larger than inline_size is stored without heap allocation
+class task final
+{
+public:
+    static constexpr size_t inline_size = 64;
+
+    task() noexcept
+    : ops_(nullptr)
+    {
+    }
+
+    template <typename Callable, typename = std::enable_if_t<
+        !std::is_same<std::decay_t<Callable>, task>::value>>
+    task(Callable &&f)
+    {
+        using Func = std::decay_t<Callable>;
+        static_assert(std::is_invocable<Func &>::value, "Not invocable");
+        if constexpr (stored_inline<Func>())
+        {
+            new (&storage_) Func(std::forward<Callable>(f));
+            ops_ = &inline_ops<Func>;
+        }
+        else
+        {
+            *reinterpret_cast<Func **>(&storage_) = new Func(std::forward<Callable>(f));
+            ops_ = &heap_ops<Func>;
+        }
+    }
+
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    task(task &&other) noexcept
+    : ops_(nullptr)
+    {
+        move(std::forward<task>(other));
+    }
+
+    task &operator=(task &&other) noexcept
+    {
+        if (&other != this)
+        {
+            reset();
+            move(std::forward<task>(other));
+        }
+        return *this;
+    }
+
+    ~task() noexcept
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        ops_->invoke(&storage_);
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return ops_ != nullptr;
+    }
+
+    // Destroy the callable
+    void reset() noexcept
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    // Whether closure of the type is stored without heap allocation
+    template <typename Func>
+    static constexpr bool stored_inline()
+    {
+        return sizeof(Func) <= inline_size && alignof(Func) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<Func>::value;
+    }
+
+private:
+    struct operations
+    {
+        void (*invoke)(void *);
+
+        void (*move)(void *dst, void *src);
+
+        void (*destroy)(void *);
+    };
+
+    template <typename Func>
+    static constexpr operations inline_ops =
+    {
+        [](void *p) { (*static_cast<Func *>(p))(); },
+        [](void *dst, void *src)
+        {
+            new (dst) Func(std::move(*static_cast<Func *>(src)));
+            static_cast<Func *>(src)->~Func();
+        },
+        [](void *p) { static_cast<Func *>(p)->~Func(); },
+    };
+
+    template <typename Func>
+    static constexpr operations heap_ops =
+    {
+        [](void *p) { (**static_cast<Func **>(p))(); },
+        [](void *dst, void *src) { *static_cast<Func **>(dst) = *static_cast<Func **>(src); },
+        [](void *p) { delete *static_cast<Func **>(p); },
+    };
+
+    void move(task &&other) noexcept
+    {
+        if (other.ops_ != nullptr)
+        {
+            other.ops_->move(&storage_, &other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[inline_size];
+
+    const operations *ops_;
+};
+
+// Behavior of add_task when bounded task queue is full
+enum class overflow_policy
+{
+    // Block the caller until free slot is available
+    block,
+
+    // Reject the task and return false
+    try_fail,
+
+    // Execute the task in the caller's thread
+    caller_runs,
+
+    // Discard the oldest queued task to make room
+    drop_oldest,
+};
+
+// Counters of task queue, all latencies are in nanoseconds
+struct task_queue_stats
+{
+    // Tasks waiting in the queue
+    int64_t depth;
+
+    // Tasks accepted by the queue
+    int64_t enqueued;
+
+    // Tasks rejected by overflow_policy::try_fail or after the queue is stopped
+    int64_t rejected;
+
+    // Tasks discarded by overflow_policy::drop_oldest
+    int64_t dropped;
+
+    // Tasks executed by overflow_policy::caller_runs
+    int64_t caller_ran;
+
+    // Accumulated time spent in add_task
+    int64_t enqueue_latency_total;
+
+    // Maximum time spent in add_task
+    int64_t enqueue_latency_max;
+};
+
+// Bounded lock-free multi-producer multi-consumer ring buffer, each cell carries a sequence
+// number which tells producers and consumers whether the cell is ready for them.
+template <typename T>
+class mpmc_ring final
+{
+public:
+    // @param capacity : rounded up to power of 2
+    explicit mpmc_ring(size_t capacity)
+    : enqueue_pos_(0), dequeue_pos_(0)
+    {
+        size_t cap = 1;
+        while (cap < capacity)
+        {
+            cap <<= 1;
+        }
+        mask_ = cap - 1;
+        cells_ = std::unique_ptr<cell[]>(new cell[cap]);
+        for (size_t i = 0; i < cap; ++i)
+        {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    mpmc_ring(const mpmc_ring &) = delete;
+    mpmc_ring &operator=(const mpmc_ring &) = delete;
+    mpmc_ring(mpmc_ring &&) = delete;
+    mpmc_ring &operator=(mpmc_ring &&) = delete;
+
+    ~mpmc_ring() = default;
+
+    // Value is moved only if push succeeds
+    bool try_push(T &&value)
+    {
+        cell *c;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &cells_[pos & mask_];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = std::move(value);
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &value)
+    {
+        cell *c;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &cells_[pos & mask_];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(c->data);
+        c->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const noexcept
+    {
+        return mask_ + 1;
+    }
+
+    // Approximate number of elements
+    size_t size() const noexcept
+    {
+        size_t enq = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t deq = dequeue_pos_.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+private:
+    struct alignas(64) cell
+    {
+        std::atomic<size_t> seq;
+
+        T data;
+    };
+
+    std::unique_ptr<cell[]> cells_;
+
+    size_t mask_;
+
+    alignas(64) std::atomic<size_t> enqueue_pos_;
+
+    alignas(64) std::atomic<size_t> dequeue_pos_;
+};
+
 class task_queue
 {
     friend class thread_pool_task_queue_runnable;
 public:
-    task_queue() noexcept
-    : stop_(false)
+    // @param capacity : 0 means unbounded queue protected by mutex, otherwise lock-free
+    //                   ring buffer whose capacity is rounded up to power of 2
+    // @param policy   : behavior of add_task when the bounded queue is full
+    explicit task_queue(int capacity = 0, overflow_policy policy = overflow_policy::block)
+    : stop_(false), policy_(policy), idle_(0), blocked_(0), wait_target_(0), last_pop_(0)
     {
+        if (capacity < 0)
+        {
+            throw_logic_error("task queue capacity shall not be negative");
+        }
+        if (capacity > 0)
+        {
+            ring_ = std::make_unique<mpmc_ring<entry>>(capacity);
+        }
     }
 
     virtual ~task_queue() = default;
 
-    void add_task(const thread_pool_task_handler &h) noexcept
+    // @return  whether task is accepted, false only if rejected by try_fail policy
+    //          or the queue is stopped
+    bool add_task(const thread_pool_task_handler &h)
     {
-        std::unique_lock<std::mutex> lock(lock_);
-        queue_.push(h);
-        cond_.notify_one();
+        return add_task(task(h));
     }
 
-    void add_task(thread_pool_task_handler &&h) noexcept
+    // @return  whether task is accepted, false only if rejected by try_fail policy
+    //          or the queue is stopped
+    bool add_task(thread_pool_task_handler &&h)
     {
-        std::unique_lock<std::mutex> lock(lock_);
-        queue_.push(std::forward<thread_pool_task_handler>(h));
-        cond_.notify_one();
+        return add_task(task(std::move(h)));
     }
 
-    void add_task(const std::vector<thread_pool_task_handler> &vh) noexcept
+    // Add callable without wrapping it in std::function
+    // @return  whether task is accepted, false only if rejected by try_fail policy
+    //          or the queue is stopped
+    template <typename Callable, typename = std::enable_if_t<
+        std::is_invocable<std::decay_t<Callable> &>::value>>
+    bool add_task(Callable &&f)
     {
-        std::unique_lock<std::mutex> lock(lock_);
-        for (const auto &h : vh)
+        return add_task(task(std::forward<Callable>(f)));
+    }
+
+    // @return  whether task is accepted, false only if rejected by try_fail policy
+    //          or the queue is stopped
+    bool add_task(task &&h)
+    {
+        int64_t start = now_ns();
+        bool ret;
+        if (ring_)
         {
-            queue_.push(h);
+            ret = push_bounded(entry{ std::move(h), start });
         }
-        cond_.notify_all();
+        else
+        {
+            // Rejected task is destroyed after the lock is released
+            entry e{ std::move(h), start };
+            std::unique_lock<std::mutex> lock(lock_);
+            ret = !stop_;
+            if (ret)
+            {
+                queue_.push(std::move(e));
+                counters_.enqueued.fetch_add(1, std::memory_order_relaxed);
+                cond_.notify_one();
+            }
+            else
+            {
+                counters_.rejected.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        record_latency(start);
+        check_congestion();
+        return ret;
+    }
+
+    // @return  number of tasks accepted
+    int add_task(const std::vector<thread_pool_task_handler> &vh)
+    {
+        if (ring_)
+        {
+            int count = 0;
+            for (const auto &h : vh)
+            {
+                count += static_cast<int>(add_task(task(h)));
+            }
+            return count;
+        }
+        int64_t start = now_ns();
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            if (stop_)
+            {
+                counters_.rejected.fetch_add(vh.size(), std::memory_order_relaxed);
+                return 0;
+            }
+            for (const auto &h : vh)
+            {
+                queue_.push(entry{ task(h), start });
+            }
+            counters_.enqueued.fetch_add(vh.size(), std::memory_order_relaxed);
+            cond_.notify_all();
+        }
+        record_latency(start);
+        check_congestion();
+        return vh.size();
+    }
+
+    // Add task without blocking and without applying overflow policy
+    // @return  false if the bounded queue is full
+    bool try_add_task(task &&h)
+    {
+        if (!ring_)
+        {
+            return add_task(std::move(h));
+        }
+        entry e{ std::move(h), wait_target_ > 0 ? now_ns() : 0 };
+        if (!ring_->try_push(std::move(e)))
+        {
+            h = std::move(e.t);
+            return false;
+        }
+        on_pushed();
+        check_congestion();
+        return true;
+    }
+
+    // Add task whose result is retrieved by future, the future throws std::future_error
+    // with broken_promise if the task is rejected.
+    template <typename Callable, typename... Args>
+    auto submit(Callable &&f, Args&&... args)
+        -> std::future<std::invoke_result_t<std::decay_t<Callable>, std::decay_t<Args>...>>
+    {
+        using result_type = std::invoke_result_t<std::decay_t<Callable>, std::decay_t<Args>...>;
+        std::packaged_task<result_type()> ptask(
+            [f = std::forward<Callable>(f), args = std::make_tuple(std::forward<Args>(args)...)]
+            () mutable -> result_type
+            {
+                return std::apply(std::move(f), std::move(args));
+            }
+        );
+        std::future<result_type> fut = ptask.get_future();
+        add_task(task(std::move(ptask)));
+        return fut;
+    }
+
+    // Execute one queued task in the caller's thread if there's any
+    // @return  whether a task is executed
+    bool try_run_one()
+    {
+        entry e;
+        if (ring_)
+        {
+            if (!pop_bounded(e))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            if (queue_.empty())
+            {
+                return false;
+            }
+            e = std::move(queue_.front());
+            queue_.pop();
+            counters_.dequeued.fetch_add(1, std::memory_order_relaxed);
+        }
+        check_wait(e.stamp);
+        e.t();
+        return true;
+    }
+
+    // Capacity of bounded queue, 0 if unbounded
+    int capacity() const noexcept
+    {
+        return ring_ ? ring_->capacity() : 0;
+    }
+
+    overflow_policy policy() const noexcept
+    {
+        return policy_;
+    }
+
+    task_queue_stats stats() const noexcept
+    {
+        task_queue_stats s;
+        s.enqueued = counters_.enqueued.load(std::memory_order_relaxed);
+        s.depth = s.enqueued - counters_.dequeued.load(std::memory_order_relaxed);
+        if (s.depth < 0)
+        {
+            s.depth = 0;
+        }
+        s.rejected = counters_.rejected.load(std::memory_order_relaxed);
+        s.dropped = counters_.dropped.load(std::memory_order_relaxed);
+        s.caller_ran = counters_.caller_ran.load(std::memory_order_relaxed);
+        s.enqueue_latency_total = counters_.latency_total.load(std::memory_order_relaxed);
+        s.enqueue_latency_max = counters_.latency_max.load(std::memory_order_relaxed);
+        return s;
     }
 
 protected:
-    std::queue<thread_pool_task_handler> queue_;
+    // Task with the time it's enqueued in nanoseconds
+    struct entry
+    {
+        task t;
+
+        int64_t stamp;
+    };
+
+    // Fetch one task, block until there's one
+    // @param keepalive : if positive, give up after being idle for so long
+    // @return  false if the queue is stopped and drained, or keepalive expires
+    bool pop_task(task &h, std::chrono::nanoseconds keepalive = std::chrono::nanoseconds(0))
+    {
+        entry e;
+        bool retire = false;
+        auto deadline = std::chrono::steady_clock::now() + keepalive;
+        if (!ring_)
+        {
+            {
+                std::unique_lock<std::mutex> lock(lock_);
+                while (queue_.empty())
+                {
+                    if (stop_ || retire)
+                    {
+                        lock.unlock();
+                        if (retire)
+                        {
+                            on_worker_retired();
+                        }
+                        return false;
+                    }
+                    idle_.fetch_add(1, std::memory_order_relaxed);
+                    if (keepalive.count() > 0)
+                    {
+                        retire = cond_.wait_until(lock, deadline) == std::cv_status::timeout;
+                    }
+                    else
+                    {
+                        cond_.wait(lock);
+                    }
+                    idle_.fetch_sub(1, std::memory_order_relaxed);
+                }
+                e = std::move(queue_.front());
+                queue_.pop();
+                counters_.dequeued.fetch_add(1, std::memory_order_relaxed);
+            }
+            cond_.notify_all();
+            h = std::move(e.t);
+            check_wait(e.stamp);
+            return true;
+        }
+
+        while (true)
+        {
+            if (pop_bounded(e))
+            {
+                break;
+            }
+            std::unique_lock<std::mutex> lock(lock_);
+            idle_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ring_->try_pop(e))
+            {
+                idle_.fetch_sub(1, std::memory_order_relaxed);
+                lock.unlock();
+                on_popped();
+                break;
+            }
+            if (stop_ || retire)
+            {
+                idle_.fetch_sub(1, std::memory_order_relaxed);
+                lock.unlock();
+                if (retire)
+                {
+                    on_worker_retired();
+                }
+                return false;
+            }
+            if (keepalive.count() > 0)
+            {
+                retire = cond_.wait_until(lock, deadline) == std::cv_status::timeout;
+            }
+            else
+            {
+                cond_.wait(lock);
+            }
+            idle_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        h = std::move(e.t);
+        check_wait(e.stamp);
+        return true;
+    }
+
+    // Mark the queue stopped and wake up all waiters
+    void stop_queue() noexcept
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        stop_ = true;
+        cond_.notify_all();
+        space_cond_.notify_all();
+    }
+
+    // Called when queue wait exceeds wait_target_, at most once per wait_target_
+    virtual void on_queue_congested()
+    {
+    }
+
+    // Called when pop_task gives up because keepalive expires
+    virtual void on_worker_retired()
+    {
+    }
+
+    static int64_t now_ns() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::queue<entry> queue_;
+
+    std::unique_ptr<mpmc_ring<entry>> ring_;
 
     std::mutex lock_;
 
     std::condition_variable cond_;
 
     bool stop_;
+
+    // Call on_queue_congested when tasks wait in the queue longer than target, shall be
+    // called before any worker starts
+    void monitor_wait(std::chrono::nanoseconds target) noexcept
+    {
+        wait_target_ = target.count();
+        last_pop_.store(now_ns(), std::memory_order_relaxed);
+    }
+
+private:
+    bool push_bounded(entry &&e)
+    {
+        bool pushed = ring_->try_push(std::move(e));
+        while (!pushed)
+        {
+            switch (policy_)
+            {
+            case overflow_policy::try_fail :
+                counters_.rejected.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case overflow_policy::caller_runs :
+                counters_.caller_ran.fetch_add(1, std::memory_order_relaxed);
+                e.t();
+                return true;
+            case overflow_policy::drop_oldest :
+            {
+                entry victim;
+                if (pop_bounded(victim))
+                {
+                    counters_.dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+                pushed = ring_->try_push(std::move(e));
+                break;
+            }
+            case overflow_policy::block :
+            {
+                std::unique_lock<std::mutex> lock(lock_);
+                blocked_.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                pushed = ring_->try_push(std::move(e));
+                if (!pushed)
+                {
+                    if (stop_)
+                    {
+                        blocked_.fetch_sub(1, std::memory_order_relaxed);
+                        counters_.rejected.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                    space_cond_.wait(lock);
+                }
+                blocked_.fetch_sub(1, std::memory_order_relaxed);
+                break;
+            }
+            }
+        }
+        on_pushed();
+        return true;
+    }
+
+    // Shall be called without holding lock_
+    void on_pushed()
+    {
+        counters_.enqueued.fetch_add(1, std::memory_order_relaxed);
+
+        // Workers only sleep when the queue is empty, so the mutex is never touched
+        // by producers as long as the pool is saturated.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle_.load(std::memory_order_relaxed) > 0)
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            cond_.notify_one();
+        }
+    }
+
+    bool pop_bounded(entry &e)
+    {
+        if (!ring_->try_pop(e))
+        {
+            return false;
+        }
+        on_popped();
+        return true;
+    }
+
+    // Shall be called without holding lock_
+    void on_popped()
+    {
+        counters_.dequeued.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (blocked_.load(std::memory_order_relaxed) > 0)
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            space_cond_.notify_one();
+        }
+    }
+
+    // Consumer side : the popped task waited longer than target
+    void check_wait(int64_t stamp)
+    {
+        if (wait_target_ > 0)
+        {
+            int64_t now = now_ns();
+            last_pop_.store(now, std::memory_order_relaxed);
+            if (now - stamp > wait_target_)
+            {
+                congested(now);
+            }
+        }
+    }
+
+    // Producer side : no worker is idle and nothing is popped for longer than target,
+    // which happens when all workers are occupied by long tasks
+    void check_congestion()
+    {
+        if (wait_target_ > 0 && idle_.load(std::memory_order_relaxed) == 0)
+        {
+            int64_t now = now_ns();
+            if (now - last_pop_.load(std::memory_order_relaxed) > wait_target_)
+            {
+                congested(now);
+            }
+        }
+    }
+
+    void congested(int64_t now)
+    {
+        int64_t prev = last_congested_.load(std::memory_order_relaxed);
+        if (now - prev > wait_target_ && last_congested_.compare_exchange_strong(prev, now,
+            std::memory_order_relaxed))
+        {
+            on_queue_congested();
+        }
+    }
+
+    void record_latency(int64_t start) noexcept
+    {
+        int64_t span = now_ns() - start;
+        counters_.latency_total.fetch_add(span, std::memory_order_relaxed);
+        int64_t prev = counters_.latency_max.load(std::memory_order_relaxed);
+        while (prev < span && !counters_.latency_max.compare_exchange_weak(prev, span,
+            std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Policy when bounded queue is full
+    overflow_policy policy_;
+
+    // Consumers sleeping for tasks
+    std::atomic<int> idle_;
+
+    // Producers sleeping for free slots
+    std::atomic<int> blocked_;
+
+    // Notified when free slot is available
+    std::condition_variable space_cond_;
+
+    // Queue wait in nanoseconds regarded as congestion, 0 means not monitored
+    int64_t wait_target_;
+
+    // Time of the latest pop in nanoseconds, only updated if wait_target_ is set
+    std::atomic<int64_t> last_pop_;
+
+    // Time of the latest on_queue_congested call in nanoseconds
+    std::atomic<int64_t> last_congested_{0};
+
+    struct alignas(64) counters
+    {
+        std::atomic<int64_t> enqueued{0};
+
+        std::atomic<int64_t> dequeued{0};
+
+        std::atomic<int64_t> rejected{0};
+
+        std::atomic<int64_t> dropped{0};
+
+        std::atomic<int64_t> caller_ran{0};
+
+        std::atomic<int64_t> latency_total{0};
+
+        std::atomic<int64_t> latency_max{0};
+    } counters_;
 };
 
-class thread_pool_task_queue_runnable final
-: public runnable
+// Group of tasks that can be waited together, the waiting thread helps executing queued
+// tasks so that waiting inside a worker thread doesn't deadlock the pool.
+class task_group final
 {
 public:
-    thread_pool_task_queue_runnable(task_queue *task_queue) noexcept
-    : task_queue_(task_queue)
+    explicit task_group(task_queue &queue)
+    : queue_(queue), state_(std::make_shared<state>())
     {
     }
 
-    void run_impl() override
+    task_group(const task_group &) = delete;
+    task_group &operator=(const task_group &) = delete;
+    task_group(task_group &&) = delete;
+    task_group &operator=(task_group &&) = delete;
+
+    ~task_group() noexcept
+    {
+        try
+        {
+            wait();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    // Add task to the queue without blocking, task is executed by caller if the queue is full
+    template <typename Callable>
+    void run(Callable &&f)
+    {
+        state_->pending.fetch_add(1, std::memory_order_relaxed);
+        task t(
+            [tk = token(state_), f = std::forward<Callable>(f)]() mutable
+            {
+                try
+                {
+                    f();
+                }
+                catch (...)
+                {
+                    tk.st->set_error(std::current_exception());
+                }
+                tk.executed = true;
+            }
+        );
+        if (!queue_.try_add_task(std::move(t)))
+        {
+            t();
+        }
+    }
+
+    // Wait until all tasks finish, rethrow the first exception thrown by tasks
+    void wait()
+    {
+        while (state_->pending.load(std::memory_order_acquire) != 0)
+        {
+            if (queue_.try_run_one())
+            {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(state_->lock);
+            state_->cond.wait_for(lock, std::chrono::milliseconds(1), [this]()
+            {
+                return state_->pending.load(std::memory_order_acquire) == 0;
+            });
+        }
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(state_->lock);
+            error = state_->error;
+            state_->error = nullptr;
+        }
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    // Shared with tasks, so tasks never touch a destroyed group
+    struct state
+    {
+        void set_error(std::exception_ptr e)
+        {
+            std::unique_lock<std::mutex> lock(this->lock);
+            if (!error)
+            {
+                error = e;
+            }
+        }
+
+        void finish() noexcept
+        {
+            if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                std::unique_lock<std::mutex> lock(this->lock);
+                cond.notify_all();
+            }
+        }
+
+        std::atomic<int64_t> pending{0};
+
+        std::mutex lock;
+
+        std::condition_variable cond;
+
+        std::exception_ptr error;
+    };
+
+    // Counts the task as finished when the closure is destroyed, so task discarded by
+    // overflow_policy::drop_oldest doesn't hang the group
+    struct token
     {
-        thread_pool_task_handler handler;
-        while(true)
+        explicit token(const std::shared_ptr<state> &s) noexcept
+        : st(s), executed(false)
+        {
+        }
+
+        token(token &&other) noexcept
+        : st(std::move(other.st)), executed(other.executed)
+        {
+        }
+
+        token &operator=(token &&) = delete;
+
+        ~token() noexcept
         {
+            if (st)
             {
-                std::unique_lock<std::mutex> lock(task_queue_->lock_);
-                if (task_queue_->queue_.empty())
+                if (!executed)
                 {
-                    if (task_queue_->stop_)
+                    try
                     {
-                        break;
+                        throw_runtime_error("task discarded by task queue");
                     }
-                    task_queue_->cond_.wait(lock, [this]()->bool
+                    catch (...)
                     {
-                        return task_queue_->queue_.size() || task_queue_->stop_;
-                    });
-                    if (task_queue_->queue_.empty() && task_queue_->stop_)
-                    {
-                        break;
+                        st->set_error(std::current_exception());
                     }
                 }
-                handler = std::move(task_queue_->queue_.front());
-                task_queue_->queue_.pop();
+                st->finish();
             }
-            task_queue_->cond_.notify_all();
+        }
+
+        std::shared_ptr<state> st;
+
+        bool executed;
+    };
+
+    task_queue &queue_;
+
+    std::shared_ptr<state> state_;
+};
+
+class thread_pool_task_queue_runnable final
+: public runnable
+{
+public:
+    // @param keepalive : if positive, the worker exits after being idle for so long
+    thread_pool_task_queue_runnable(task_queue *task_queue,
+        std::chrono::nanoseconds keepalive = std::chrono::nanoseconds(0)) noexcept
+    : task_queue_(task_queue), keepalive_(keepalive)
+    {
+    }
+
+    void run_impl() override
+    {
+        task handler;
+        while (task_queue_->pop_task(handler, keepalive_))
+        {
             handler();
+            handler.reset();
         }
     }
 
 private:
     task_queue *task_queue_;
+
+    std::chrono::nanoseconds keepalive_;
+};
+
+// Pool size of thread_pool_task_queue
+struct thread_pool_stats
+{
+    struct sample
+    {
+        std::chrono::steady_clock::time_point stamp;
+
+        int size;
+    };
+
+    // Current number of workers
+    int size;
+
+    // Maximum number of workers ever reached
+    int peak_size;
+
+    // Workers spawned because of queue congestion
+    int64_t spawned;
+
+    // Workers retired because of keepalive expiration
+    int64_t retired;
+
+    // Recent pool size changes, oldest first
+    std::vector<sample> history;
 };
 
 class thread_pool_task_queue final
 : public task_queue, public thread_pool<thread_pool_task_queue_runnable, task_queue *>
 {
+    using base_pool = thread_pool<thread_pool_task_queue_runnable, task_queue *>;
 public:
-    thread_pool_task_queue(int thr_num)
-    : task_queue(), thread_pool<thread_pool_task_queue_runnable, task_queue *>(thr_num, this)
+    // Number of pool size changes kept in thread_pool_stats::history
+    static constexpr size_t history_limit = 1024;
+
+    // @param thr_num  : number of worker threads
+    // @param capacity : 0 means unbounded, otherwise capacity of lock-free bounded queue
+    // @param policy   : behavior of add_task when the bounded queue is full
+    explicit thread_pool_task_queue(int thr_num, int capacity = 0,
+        overflow_policy policy = overflow_policy::block)
+    : task_queue(capacity, policy), base_pool(thr_num, this),
+      max_size_(thr_num), keepalive_(0), running_(false), stopped_(false),
+      size_(thr_num), peak_size_(thr_num), spawned_(0), retired_(0)
+    {
+        record_size(thr_num);
+    }
+
+    // Elastic thread pool : grows when tasks wait in the queue longer than target_wait,
+    // workers beyond min_thr retire after being idle for keepalive
+    // @param min_thr     : number of workers that never retire, shall be positive
+    // @param max_thr     : maximum number of workers
+    // @param target_wait : queue wait that triggers spawning one more worker
+    // @param keepalive   : idle time after which an extra worker retires
+    // @param capacity    : 0 means unbounded, otherwise capacity of lock-free bounded queue
+    // @param policy      : behavior of add_task when the bounded queue is full
+    thread_pool_task_queue(int min_thr, int max_thr, std::chrono::nanoseconds target_wait,
+        std::chrono::nanoseconds keepalive, int capacity = 0,
+        overflow_policy policy = overflow_policy::block)
+    : task_queue(capacity, policy), base_pool(min_thr, this),
+      max_size_(max_thr), keepalive_(keepalive), running_(false), stopped_(false),
+      size_(min_thr), peak_size_(min_thr), spawned_(0), retired_(0)
     {
+        if (min_thr < 1 || max_thr < min_thr)
+        {
+            throw_logic_error("elastic thread pool requires 1 <= min_thr <= max_thr");
+        }
+        if (target_wait.count() <= 0 || keepalive.count() <= 0)
+        {
+            throw_logic_error("elastic thread pool requires positive target_wait and keepalive");
+        }
+        monitor_wait(target_wait);
+        record_size(min_thr);
     }
 
     thread_pool_task_queue(const thread_pool_task_queue &) = delete;
@@ -193,17 +1163,169 @@ public:
     thread_pool_task_queue(thread_pool_task_queue &&) = delete;
     thread_pool_task_queue &operator=(thread_pool_task_queue &&) = delete;
 
-    ~thread_pool_task_queue() = default;
+    // Elastic workers refer to the pool, so they're joined here if not stopped, they exit
+    // once cancelled or idle for keepalive
+    ~thread_pool_task_queue()
+    {
+        std::vector<std::unique_ptr<thread_pool_task_queue_runnable>> extra;
+        {
+            std::unique_lock<std::mutex> lock(elastic_lock_);
+            stopped_ = true;
+            extra.swap(extra_);
+        }
+        for (auto &thr : extra)
+        {
+            try
+            {
+                thr->join();
+            }
+            catch (const std::system_error &)
+            {
+            }
+        }
+    }
 
+    // Run all threads, elastic workers are only spawned after this
+    void run()
+    {
+        base_pool::run();
+        std::unique_lock<std::mutex> lock(elastic_lock_);
+        running_ = true;
+    }
+
+    // Current number of workers, including elastic ones
+    int size() const noexcept
+    {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    // Stop the queue, wait until queued tasks are done and all workers exit
     void stop() noexcept
     {
+        stop_queue();
+        join();
+        std::vector<std::unique_ptr<thread_pool_task_queue_runnable>> extra;
         {
-            std::unique_lock<std::mutex> lock(lock_);
-            stop_ = true;
-            cond_.notify_all();
+            std::unique_lock<std::mutex> lock(elastic_lock_);
+            stopped_ = true;
+            extra.swap(extra_);
         }
-        join();
+        for (auto &thr : extra)
+        {
+            thr->join();
+        }
+    }
+
+    // Cancel all threads including elastic ones, no more worker is spawned after this
+    void cancel() override
+    {
+        base_pool::cancel();
+        std::unique_lock<std::mutex> lock(elastic_lock_);
+        stopped_ = true;
+        for (auto &thr : extra_)
+        {
+            thr->cancel();
+        }
+    }
+
+    thread_pool_stats pool_stats() const
+    {
+        std::unique_lock<std::mutex> lock(elastic_lock_);
+        thread_pool_stats s;
+        s.size = size_.load(std::memory_order_relaxed);
+        s.peak_size = peak_size_;
+        s.spawned = spawned_;
+        s.retired = retired_;
+        s.history.assign(history_.begin(), history_.end());
+        return s;
+    }
+
+private:
+    void on_queue_congested() override
+    {
+        std::unique_lock<std::mutex> lock(elastic_lock_, std::try_to_lock);
+        if (!lock.owns_lock() || !running_ || stopped_
+            || size_.load(std::memory_order_relaxed) >= max_size_)
+        {
+            return;
+        }
+        reap();
+        auto thr = std::make_unique<thread_pool_task_queue_runnable>(this, keepalive_);
+        try
+        {
+            thr->run();
+        }
+        catch (const std::system_error &)
+        {
+            // Keep serving with current workers
+            return;
+        }
+        extra_.push_back(std::move(thr));
+        ++spawned_;
+        int size = size_.fetch_add(1, std::memory_order_relaxed) + 1;
+        peak_size_ = std::max(peak_size_, size);
+        record_size(size);
+    }
+
+    void on_worker_retired() override
+    {
+        std::unique_lock<std::mutex> lock(elastic_lock_);
+        ++retired_;
+        record_size(size_.fetch_sub(1, std::memory_order_relaxed) - 1);
     }
+
+    // Join retired workers, shall be called with elastic_lock_ held
+    void reap()
+    {
+        for (auto iter = extra_.begin(); iter != extra_.end();)
+        {
+            if ((*iter)->wait_for(std::chrono::seconds(0)))
+            {
+                (*iter)->join();
+                iter = extra_.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+    // Shall be called with elastic_lock_ held
+    void record_size(int size)
+    {
+        if (history_.size() == history_limit)
+        {
+            history_.pop_front();
+        }
+        history_.push_back({ std::chrono::steady_clock::now(), size });
+    }
+
+    // Maximum number of workers
+    int max_size_;
+
+    // Idle time after which elastic worker retires
+    std::chrono::nanoseconds keepalive_;
+
+    // Protects members below
+    mutable std::mutex elastic_lock_;
+
+    bool running_;
+
+    bool stopped_;
+
+    // Workers spawned beyond the core ones, retired ones are joined lazily
+    std::vector<std::unique_ptr<thread_pool_task_queue_runnable>> extra_;
+
+    std::atomic<int> size_;
+
+    int peak_size_;
+
+    int64_t spawned_;
+
+    int64_t retired_;
+
+    std::deque<thread_pool_stats::sample> history_;
 };
 
 }   // namespace task_queue
@@ -212,6 +1334,16 @@ using thread_pool_task_queue = task_queue::thread_pool_task_queue;
 
 using thread_pool_task_handler = task_queue::thread_pool_task_handler;
 
+using thread_pool_task = task_queue::task;
+
+using task_group = task_queue::task_group;
+
+using task_queue_stats = task_queue::task_queue_stats;
+
+using thread_pool_stats = task_queue::thread_pool_stats;
+
+using overflow_policy = task_queue::overflow_policy;
+
 }   // namespace cppev
 
 #endif  // thread_pool.h
@@ -1,13 +1,22 @@
 #include <sstream>
 #include <tuple>
+#include <algorithm>
 #include <mutex>
 #include <ctime>
 #include <sstream>
 #include <thread>
 #include <string>
 #include <unordered_set>
+#include <unordered_map>
 #include <cassert>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <new>
 #include <unistd.h>
+#include <pthread.h>
 #include "cppev/utils.h"
 #include "cppev/sysconfig.h"
 #include "cppev/async_logger.h"
@@ -15,30 +24,681 @@
 namespace cppev
 {
 
-async_logger::async_logger(int level)
-: level_(level), stop_(false), curr_(0), recur_level_(0)
+// Byte ring of one thread, records are laid out as header followed by text padded to
+// 8 bytes. Record that doesn't fit the end of ring is preceded by a wrap marker.
+struct async_logger::thread_ring
+{
+    struct header
+    {
+        // text length, wrap_marker means the rest of ring shall be skipped
+        uint32_t len;
+
+        // text_record or deferred_record
+        uint32_t kind;
+
+        // system clock timestamp in nanoseconds
+        int64_t stamp;
+    };
+
+    static constexpr uint32_t wrap_marker = UINT32_MAX;
+
+    static constexpr uint32_t text_record = 0;
+
+    static constexpr uint32_t deferred_record = 1;
+
+    thread_ring(int cap, uint64_t tid)
+    : cap(cap), mask(cap - 1), data(new char[cap]), head(0), tail(0), closed(false),
+      tid(tid), stamp(0)
+    {
+        if (cap <= 0 || (cap & (cap - 1)) != 0)
+        {
+            throw_logic_error("log ring size shall be power of 2");
+        }
+    }
+
+    static size_t aligned(size_t len) noexcept
+    {
+        return (len + 7) & ~static_cast<size_t>(7);
+    }
+
+    // Producer side, record shall be smaller than half of the ring
+    bool try_push(int64_t ts, uint32_t kind, const char *text, size_t len) noexcept
+    {
+        size_t need = sizeof(header) + aligned(len);
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        size_t off = t & mask;
+        size_t skip = off + need > cap ? cap - off : 0;
+        if (t + skip + need - head.load(std::memory_order_acquire) > cap)
+        {
+            return false;
+        }
+        if (skip)
+        {
+            reinterpret_cast<header *>(data.get() + off)->len = wrap_marker;
+            t += skip;
+            off = 0;
+        }
+        header *h = reinterpret_cast<header *>(data.get() + off);
+        h->len = len;
+        h->kind = kind;
+        h->stamp = ts;
+        memcpy(data.get() + off + sizeof(header), text, len);
+        tail.store(t + need, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, the record stays valid until pop
+    const header *peek() noexcept
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        while (h != tail.load(std::memory_order_acquire))
+        {
+            const header *rec = reinterpret_cast<const header *>(data.get() + (h & mask));
+            if (rec->len != wrap_marker)
+            {
+                return rec;
+            }
+            h += cap - (h & mask);
+            head.store(h, std::memory_order_release);
+        }
+        return nullptr;
+    }
+
+    void pop(const header *rec) noexcept
+    {
+        head.store(head.load(std::memory_order_relaxed) + sizeof(header) + aligned(rec->len),
+            std::memory_order_release);
+    }
+
+    const size_t cap;
+
+    const size_t mask;
+
+    std::unique_ptr<char[]> data;
+
+    // Consumed bytes
+    alignas(64) std::atomic<uint64_t> head;
+
+    // Produced bytes
+    alignas(64) std::atomic<uint64_t> tail;
+
+    // Set when the thread exits
+    std::atomic<bool> closed;
+
+    // Owner thread, header of text record is formatted by the background thread
+    const uint64_t tid;
+
+    // Line under construction without header, only touched by the owner thread
+    std::string line;
+
+    int64_t stamp;
+};
+
+// Rings of the thread indexed by logger, marked closed when the thread exits
+struct async_logger::thread_rings
+{
+    ~thread_rings()
+    {
+        for (auto &ring : rings)
+        {
+            if (ring)
+            {
+                ring->closed.store(true, std::memory_order_release);
+            }
+        }
+    }
+
+    std::vector<std::shared_ptr<thread_ring>> rings;
+};
+
+namespace
+{
+
+std::atomic<int> logger_count(0);
+
+// Loggers with background thread, locked over fork
+std::mutex loggers_lock;
+
+std::vector<async_logger *> loggers;
+
+// Whether handlers of pthread_atfork take effect
+std::atomic<bool> fork_support(false);
+
+// Whether the ongoing fork is handled, only accessed with loggers_lock held
+bool fork_handled = false;
+
+int64_t now_stamp() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+struct site_info
+{
+    const char *format;
+
+    const char *file;
+
+    int line;
+};
+
+// Sites are never unregistered, id is the index
+std::mutex sites_lock;
+
+std::vector<site_info> sites;
+
+// Copy sites registered after the last call
+void refresh_sites(std::vector<site_info> &local)
+{
+    std::unique_lock<std::mutex> lock(sites_lock);
+    local.insert(local.end(), sites.begin() + local.size(), sites.end());
+}
+
+// Binary log is the magic followed by label byte and frames
+const char binary_magic[] = "CPPEVLG1";
+
+const size_t binary_magic_len = sizeof(binary_magic) - 1;
+
+// 'S' id line file_len format_len file format
+const char site_frame = 'S';
+
+// 'R' len stamp record, record is site id, thread id and arguments
+const char record_frame = 'R';
+
+// 'T' len stamp text
+const char text_frame = 'T';
+
+uint32_t site_id(const char *rec) noexcept
+{
+    uint32_t id;
+    memcpy(&id, rec, sizeof(id));
+    return id;
+}
+
+template <typename T>
+void append_raw(std::string &out, T x)
+{
+    out.append(reinterpret_cast<const char *>(&x), sizeof(x));
+}
+
+// Bound checked reader of raw bytes, throw std::runtime_error if out of range
+class raw_reader final
+{
+public:
+    raw_reader(const char *data, size_t len)
+    : data_(data), len_(len), pos_(0)
+    {
+    }
+
+    template <typename T>
+    T read()
+    {
+        T x;
+        memcpy(&x, take(sizeof(T)), sizeof(T));
+        return x;
+    }
+
+    const char *take(size_t len)
+    {
+        if (len > len_ - pos_)
+        {
+            throw_runtime_error("log record corrupted");
+        }
+        const char *ptr = data_ + pos_;
+        pos_ += len;
+        return ptr;
+    }
+
+    bool empty() const noexcept
+    {
+        return pos_ == len_;
+    }
+
+private:
+    const char *data_;
+
+    size_t len_;
+
+    size_t pos_;
+};
+
+// Append the next argument of deferred record as text
+void append_arg(std::string &out, raw_reader &reader)
+{
+    char buf[32];
+    switch (reader.read<char>())
+    {
+    case 'b' :
+        out.append(reader.read<char>() ? "true" : "false");
+        break;
+    case 'c' :
+        out.push_back(reader.read<char>());
+        break;
+    case 'i' :
+        out.append(std::to_string(reader.read<int64_t>()));
+        break;
+    case 'u' :
+        out.append(std::to_string(reader.read<uint64_t>()));
+        break;
+    case 'd' :
+        out.append(std::to_string(reader.read<double>()));
+        break;
+    case 's' :
+    {
+        uint32_t len = reader.read<uint32_t>();
+        out.append(reader.take(len), len);
+        break;
+    }
+    case 'p' :
+        snprintf(buf, sizeof(buf), "0x%llx", static_cast<unsigned long long>(reader.read<uint64_t>()));
+        out.append(buf);
+        break;
+    default :
+        throw_runtime_error("log record corrupted");
+    }
+}
+
+// Formats line header as write_header does, the timestamp string is cached per second
+class header_formatter final
+{
+public:
+    explicit header_formatter(bool info)
+    : label_(info ? "- [INFO] [" : "- [ERROR] ["), sec_(-1)
+    {
+    }
+
+    void append(std::string &out, int64_t stamp, uint64_t tid)
+    {
+        time_t sec = stamp / 1000000000;
+        if (sec != sec_)
+        {
+            sec_ = sec;
+            time_str_ = timestamp(sec);
+        }
+        out.append(label_);
+        out.append(time_str_);
+#ifdef __linux__
+        out.append("] [LWP ");
+        out.append(std::to_string(tid));
+#else
+        char buf[32];
+        snprintf(buf, sizeof(buf), "0x%llx", static_cast<unsigned long long>(tid));
+        out.append("] [TID ");
+        out.append(buf);
+#endif
+        out.append("] ");
+    }
+
+private:
+    const char *label_;
+
+    time_t sec_;
+
+    std::string time_str_;
+};
+
+// Format deferred record to a line, "{}" without argument is kept as it is
+void format_record(std::string &out, header_formatter &header, const char *format, int64_t stamp,
+    const char *rec, size_t len)
+{
+    raw_reader reader(rec, len);
+    reader.read<uint32_t>();
+    uint64_t tid = reader.read<uint64_t>();
+    header.append(out, stamp, tid);
+    for (const char *p = format; *p; ++p)
+    {
+        if (p[0] == '{' && p[1] == '}' && !reader.empty())
+        {
+            append_arg(out, reader);
+            ++p;
+        }
+        else
+        {
+            out.push_back(*p);
+        }
+    }
+    out.push_back('\n');
+}
+
+// Walk the shared buffer, text between deferred records is passed as it is
+template <typename Spans, typename TextFunc, typename DeferredFunc>
+void walk_shared(const char *data, int len, const Spans &spans, TextFunc &&on_text,
+    DeferredFunc &&on_deferred)
+{
+    int pos = 0;
+    for (const auto &span : spans)
+    {
+        if (span.offset > pos)
+        {
+            on_text(data + pos, span.offset - pos);
+        }
+        on_deferred(span.stamp, data + span.offset, span.len);
+        pos = span.offset + span.len;
+    }
+    if (pos < len)
+    {
+        on_text(data + pos, len - pos);
+    }
+}
+
+void write_all(int fd, const char *data, size_t len)
+{
+    while (len)
+    {
+        ssize_t ret = write(fd, data, len);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw_system_error("write error");
+        }
+        data += ret;
+        len -= ret;
+    }
+}
+
+}   // namespace
+
+log_site::log_site(const char *format, const char *file, int line)
+{
+    std::unique_lock<std::mutex> lock(sites_lock);
+    id_ = sites.size();
+    sites.push_back(site_info{ format, file, line });
+}
+
+std::atomic<int> async_logger::forks_(0);
+
+async_logger::async_logger(int level, bool per_thread, bool binary)
+: level_(level), stop_(false), curr_(0), recur_level_(0), per_thread_(per_thread),
+  index_(logger_count.fetch_add(1)), rings_version_(0), sleeping_(false), binary_(binary),
+  generation_(forks_.load())
 {
     if (level_ < 0)
     {
         return;
     }
+    start();
+}
+
+async_logger::async_logger(const log_file_options &options, bool per_thread, bool binary)
+: level_(options.error ? STDERR_FILENO : STDOUT_FILENO), stop_(false), curr_(0), recur_level_(0),
+  per_thread_(per_thread), index_(logger_count.fetch_add(1)), rings_version_(0), sleeping_(false),
+  binary_(binary), generation_(forks_.load())
+{
+    if (binary_ && (options.rotate_size > 0 || options.rotate_interval.count() > 0))
+    {
+        // Site frames are only written once, so rotated files cannot be decoded alone
+        throw_logic_error("binary log cannot be rotated");
+    }
+    sink_ = std::make_unique<log_file_sink>(options);
+    start();
+}
+
+void async_logger::start()
+{
+    if (binary_ && !per_thread_)
+    {
+        throw_logic_error("binary log is only available in per-thread mode");
+    }
     for (int i = 0; i < 2; ++i) {
         buffers_.emplace_back();
     }
+    {
+        std::unique_lock<std::mutex> lock(loggers_lock);
+        loggers.push_back(this);
+    }
     run();
 }
 
+void async_logger::set_fork_support(bool enable)
+{
+    static int atfork_ret = pthread_atfork(prepare_fork, parent_after_fork, child_after_fork);
+    if (atfork_ret != 0)
+    {
+        throw_system_error("pthread_atfork error", atfork_ret);
+    }
+    fork_support.store(enable);
+}
+
+void async_logger::prepare_fork() noexcept
+{
+    // Child shall not inherit the locks held by other threads
+    loggers_lock.lock();
+    fork_handled = fork_support.load();
+    if (!fork_handled)
+    {
+        return;
+    }
+    for (async_logger *logger : loggers)
+    {
+        logger->lock_.lock();
+        logger->rings_lock_.lock();
+    }
+    sites_lock.lock();
+}
+
+void async_logger::parent_after_fork() noexcept
+{
+    if (!fork_handled)
+    {
+        loggers_lock.unlock();
+        return;
+    }
+    sites_lock.unlock();
+    for (auto iter = loggers.rbegin(); iter != loggers.rend(); ++iter)
+    {
+        (*iter)->rings_lock_.unlock();
+        (*iter)->lock_.unlock();
+    }
+    loggers_lock.unlock();
+}
+
+void async_logger::child_after_fork() noexcept
+{
+    // Locks are owned by the thread id of parent, so they're reinitialized instead of
+    // unlocked, as well as conditions that may have waiters of parent
+    if (!fork_handled)
+    {
+        new (&loggers_lock) std::mutex();
+        return;
+    }
+    new (&sites_lock) std::mutex();
+    for (async_logger *logger : loggers)
+    {
+        new (&logger->lock_) std::recursive_mutex();
+        new (&logger->rings_lock_) std::mutex();
+        new (&logger->cond_) std::condition_variable_any();
+        new (&logger->rings_cond_) std::condition_variable();
+    }
+    new (&loggers_lock) std::mutex();
+    forks_.fetch_add(1);
+}
+
+void async_logger::restart_after_fork()
+{
+    std::unique_lock<std::recursive_mutex> lock(lock_);
+    int forks = forks_.load();
+    if (generation_.load() == forks)
+    {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> rings_lock(rings_lock_);
+        for (auto &ring : rings_)
+        {
+            ring->head.store(ring->tail.load());
+        }
+    }
+    for (auto &buf : buffers_)
+    {
+        buf.clear();
+    }
+    for (auto &spans : spans_)
+    {
+        spans.clear();
+    }
+    sleeping_.store(false);
+    run();
+    generation_.store(forks);
+}
+
+log_sink_stats async_logger::sink_stats() const
+{
+    if (!sink_)
+    {
+        throw_logic_error("logger has no file sink");
+    }
+    return sink_->stats();
+}
+
+void async_logger::output(const char *data, size_t len)
+{
+    if (sink_)
+    {
+        sink_->append(data, len);
+    }
+    else
+    {
+        write(level_, data, len);
+    }
+}
+
 async_logger::~async_logger()
 {
     if (level_ < 0)
     {
         return;
     }
-    stop_ = true;
+    {
+        std::unique_lock<std::mutex> lock(loggers_lock);
+        loggers.erase(std::find(loggers.begin(), loggers.end(), this));
+    }
+    if (generation_.load() != forks_.load())
+    {
+        // Background thread is not running in forked child
+        return;
+    }
+    {
+        std::unique_lock<std::recursive_mutex> lock(lock_);
+        stop_ = true;
+    }
     cond_.notify_one();
+    {
+        std::unique_lock<std::mutex> lock(rings_lock_);
+        rings_cond_.notify_one();
+    }
     join();
 }
 
+async_logger::thread_ring &async_logger::local_ring()
+{
+    thread_local thread_rings local_rings;
+    auto &rings = local_rings.rings;
+    if (static_cast<int>(rings.size()) <= index_)
+    {
+        rings.resize(index_ + 1);
+    }
+    if (!rings[index_])
+    {
+        rings[index_] = std::make_shared<thread_ring>(sysconfig::log_ring_size,
+            static_cast<uint64_t>(gettid()));
+        std::unique_lock<std::mutex> lock(rings_lock_);
+        rings_.push_back(rings[index_]);
+        rings_version_.fetch_add(1, std::memory_order_release);
+    }
+    return *rings[index_];
+}
+
+void async_logger::commit_line(thread_ring &ring)
+{
+    if (ring.line.empty())
+    {
+        ring.stamp = now_stamp();
+    }
+    ring.line.push_back('\n');
+    if (!push_record(ring, ring.stamp, thread_ring::text_record, ring.line))
+    {
+        header_formatter header(level_ == 1);
+        std::string text;
+        header.append(text, ring.stamp, ring.tid);
+        text.append(ring.line);
+        push_text(text);
+    }
+    ring.line.clear();
+}
+
+bool async_logger::push_record(thread_ring &ring, int64_t stamp, uint32_t kind,
+    const std::string &rec)
+{
+    check_fork();
+    if (rec.size() + sizeof(thread_ring::header) > ring.cap / 2)
+    {
+        return false;
+    }
+    while (!ring.try_push(stamp, kind, rec.c_str(), rec.size()))
+    {
+        // Ring is full, background thread may be sleeping
+        std::unique_lock<std::mutex> lock(rings_lock_);
+        rings_cond_.notify_one();
+        lock.unlock();
+        std::this_thread::yield();
+    }
+    // Background thread only sleeps when all rings are empty, so the lock is
+    // never touched as long as it's busy
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed))
+    {
+        std::unique_lock<std::mutex> lock(rings_lock_);
+        rings_cond_.notify_one();
+    }
+    return true;
+}
+
+void async_logger::push_text(const std::string &text)
+{
+    check_fork();
+    // Oversized record goes through the shared buffer
+    std::unique_lock<std::recursive_mutex> lock(lock_);
+    buffers_[curr_].produce(text.c_str(), text.size());
+    cond_.notify_one();
+}
+
+void async_logger::push_deferred(int64_t stamp, const std::string &rec)
+{
+    check_fork();
+    std::unique_lock<std::recursive_mutex> lock(lock_);
+    buffer &buf = buffers_[curr_];
+    spans_[curr_].push_back(deferred_span{ buf.size(), static_cast<int>(rec.size()), stamp });
+    buf.produce(rec.c_str(), rec.size());
+    cond_.notify_one();
+}
+
+std::string &async_logger::deferred_record(const log_site &site)
+{
+    thread_local std::string rec;
+    rec.clear();
+    append_raw(rec, site.id());
+    append_raw(rec, static_cast<uint64_t>(gettid()));
+    return rec;
+}
+
+void async_logger::commit_deferred(std::string &rec)
+{
+    if (level_ < 0)
+    {
+        return;
+    }
+    int64_t stamp = now_stamp();
+    if (per_thread_ && push_record(local_ring(), stamp, thread_ring::deferred_record, rec))
+    {
+        return;
+    }
+    // Formatted by background thread as well
+    push_deferred(stamp, rec);
+}
+
 async_logger &async_logger::operator<<(const std::string &str)
 {
     return (*this) << str.c_str();
@@ -88,9 +748,20 @@ void async_logger::write_header(buffer &buf)
 
 async_logger &async_logger::operator<<(const char *str)
 {
+    if (per_thread_)
+    {
+        thread_ring &ring = local_ring();
+        if (ring.line.empty())
+        {
+            ring.stamp = now_stamp();
+        }
+        ring.line.append(str);
+        return *this;
+    }
     lock_.lock();
     if (0 == recur_level_++)
     {
+        check_fork();
         write_header(buffers_[curr_]);
     }
     buffers_[curr_].put_string(str);
@@ -99,6 +770,11 @@ async_logger &async_logger::operator<<(const char *str)
 
 async_logger &async_logger::operator<<(const async_logger &)
 {
+    if (per_thread_)
+    {
+        commit_line(local_ring());
+        return *this;
+    }
     (*this) << "\n";
     auto recur = recur_level_;
     recur_level_ = 0;
@@ -112,7 +788,28 @@ async_logger &async_logger::operator<<(const async_logger &)
 
 void async_logger::run_impl()
 {
-    while (!stop_)
+    if (per_thread_)
+    {
+        run_rings();
+        return;
+    }
+    std::vector<site_info> local_sites;
+    header_formatter header(level_ == 1);
+    std::vector<deferred_span> spans;
+    std::string out;
+    auto append_deferred = [&](int64_t stamp, const char *rec, int len)
+    {
+        uint32_t id = site_id(rec);
+        if (id >= local_sites.size())
+        {
+            refresh_sites(local_sites);
+        }
+        format_record(out, header, local_sites[id].format, stamp, rec, len);
+    };
+
+    // Records logged before stop are drained by the last round
+    bool stop = false;
+    while (!stop)
     {
         int prev = -1;
         {
@@ -128,18 +825,307 @@ void async_logger::run_impl()
             }
             prev = curr_;
             curr_ = 1 - curr_;
+            stop = stop_;
+            spans.clear();
+            spans.swap(spans_[prev]);
         }
 
         buffer &buf = buffers_[prev];
 
         if (buf.size())
         {
-            write(level_, buf.rawbuf(), buf.size());
+            if (spans.empty())
+            {
+                output(buf.rawbuf(), buf.size());
+            }
+            else
+            {
+                walk_shared(buf.rawbuf(), buf.size(), spans,
+                    [&out](const char *text, int len) { out.append(text, len); },
+                    append_deferred);
+                output(out.c_str(), out.size());
+                out.clear();
+            }
             buf.clear();
         }
     }
 }
 
+void async_logger::run_rings()
+{
+    std::vector<std::shared_ptr<thread_ring>> rings;
+    std::vector<const thread_ring::header *> heads;
+    std::string out;
+    int version = -1;
+    bool stop = false;
+
+    std::vector<site_info> local_sites;
+    // Whether site frame is written, binary only
+    std::vector<bool> site_written;
+    header_formatter header(level_ == 1);
+    if (binary_)
+    {
+        out.append(binary_magic, binary_magic_len);
+        out.push_back(level_ == 1 ? 'I' : 'E');
+    }
+    auto append_text = [&](int64_t stamp, const char *text, size_t len)
+    {
+        if (binary_)
+        {
+            out.push_back(text_frame);
+            append_raw(out, static_cast<uint32_t>(len));
+            append_raw(out, stamp);
+        }
+        out.append(text, len);
+    };
+    std::string line;
+    auto append_line = [&](int64_t stamp, uint64_t tid, const char *text, size_t len)
+    {
+        if (!binary_)
+        {
+            header.append(out, stamp, tid);
+            out.append(text, len);
+            return;
+        }
+        line.clear();
+        header.append(line, stamp, tid);
+        line.append(text, len);
+        append_text(stamp, line.c_str(), line.size());
+    };
+    auto append_deferred = [&](int64_t stamp, const char *rec, size_t len)
+    {
+        uint32_t id = site_id(rec);
+        if (id >= local_sites.size())
+        {
+            refresh_sites(local_sites);
+        }
+        if (!binary_)
+        {
+            format_record(out, header, local_sites[id].format, stamp, rec, len);
+            return;
+        }
+        if (id >= site_written.size())
+        {
+            site_written.resize(local_sites.size(), false);
+        }
+        if (!site_written[id])
+        {
+            const site_info &site = local_sites[id];
+            uint32_t file_len = strlen(site.file);
+            uint32_t format_len = strlen(site.format);
+            out.push_back(site_frame);
+            append_raw(out, id);
+            append_raw(out, static_cast<uint32_t>(site.line));
+            append_raw(out, file_len);
+            append_raw(out, format_len);
+            out.append(site.file, file_len);
+            out.append(site.format, format_len);
+            site_written[id] = true;
+        }
+        out.push_back(record_frame);
+        append_raw(out, static_cast<uint32_t>(len));
+        append_raw(out, stamp);
+        out.append(rec, len);
+    };
+
+    while (true)
+    {
+        if (version != rings_version_.load(std::memory_order_acquire))
+        {
+            std::unique_lock<std::mutex> lock(rings_lock_);
+            version = rings_version_.load(std::memory_order_relaxed);
+            rings = rings_;
+        }
+
+        // Merge heads of all rings in timestamp order
+        heads.assign(rings.size(), nullptr);
+        for (size_t i = 0; i < rings.size(); ++i)
+        {
+            heads[i] = rings[i]->peek();
+        }
+        while (out.size() < (1 << 20))
+        {
+            int min = -1;
+            for (size_t i = 0; i < heads.size(); ++i)
+            {
+                if (heads[i] && (min == -1 || heads[i]->stamp < heads[min]->stamp))
+                {
+                    min = i;
+                }
+            }
+            if (min == -1)
+            {
+                break;
+            }
+            const thread_ring::header *rec = heads[min];
+            const char *data = reinterpret_cast<const char *>(rec + 1);
+            if (rec->kind == thread_ring::deferred_record)
+            {
+                append_deferred(rec->stamp, data, rec->len);
+            }
+            else
+            {
+                append_line(rec->stamp, rings[min]->tid, data, rec->len);
+            }
+            rings[min]->pop(rec);
+            heads[min] = rings[min]->peek();
+        }
+
+        // Oversized records
+        {
+            std::unique_lock<std::recursive_mutex> lock(lock_);
+            buffer &buf = buffers_[curr_];
+            if (buf.size())
+            {
+                int64_t stamp = now_stamp();
+                walk_shared(buf.rawbuf(), buf.size(), spans_[curr_],
+                    [&](const char *text, int len) { append_text(stamp, text, len); },
+                    append_deferred);
+                buf.clear();
+                spans_[curr_].clear();
+            }
+        }
+
+        if (!out.empty())
+        {
+            output(out.c_str(), out.size());
+            out.clear();
+            continue;
+        }
+        if (stop)
+        {
+            break;
+        }
+
+        // Drop drained rings of exited threads
+        {
+            std::unique_lock<std::mutex> lock(rings_lock_);
+            for (auto iter = rings_.begin(); iter != rings_.end();)
+            {
+                if ((*iter)->closed.load(std::memory_order_acquire) && !(*iter)->peek())
+                {
+                    iter = rings_.erase(iter);
+                    rings_version_.fetch_add(1, std::memory_order_release);
+                }
+                else
+                {
+                    ++iter;
+                }
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(rings_lock_);
+        sleeping_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool empty = true;
+        for (const auto &ring : rings)
+        {
+            if (ring->peek())
+            {
+                empty = false;
+                break;
+            }
+        }
+        if (empty)
+        {
+            rings_cond_.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        sleeping_.store(false, std::memory_order_relaxed);
+        lock.unlock();
+        std::unique_lock<std::recursive_mutex> stop_lock(lock_);
+        stop = stop_;
+    }
+}
+
+void decode_binary_log(int in_fd, int out_fd)
+{
+    std::string data;
+    char buf[1 << 16];
+    while (true)
+    {
+        ssize_t ret = read(in_fd, buf, sizeof(buf));
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw_system_error("read error");
+        }
+        if (ret == 0)
+        {
+            break;
+        }
+        data.append(buf, ret);
+    }
+
+    raw_reader reader(data.c_str(), data.size());
+    if (data.size() < binary_magic_len + 1 ||
+        memcmp(reader.take(binary_magic_len), binary_magic, binary_magic_len) != 0)
+    {
+        throw_runtime_error("not a binary log");
+    }
+    header_formatter header(reader.read<char>() == 'I');
+
+    std::unordered_map<uint32_t, std::string> formats;
+    std::string out;
+    while (!reader.empty())
+    {
+        char type = reader.read<char>();
+        if (type == site_frame)
+        {
+            uint32_t id = reader.read<uint32_t>();
+            reader.read<uint32_t>();
+            uint32_t file_len = reader.read<uint32_t>();
+            uint32_t format_len = reader.read<uint32_t>();
+            reader.take(file_len);
+            formats[id] = std::string(reader.take(format_len), format_len);
+        }
+        else if (type == record_frame || type == text_frame)
+        {
+            uint32_t len = reader.read<uint32_t>();
+            int64_t stamp = reader.read<int64_t>();
+            const char *body = reader.take(len);
+            if (type == text_frame)
+            {
+                out.append(body, len);
+            }
+            else
+            {
+                uint32_t id = raw_reader(body, len).read<uint32_t>();
+                auto iter = formats.find(id);
+                if (iter == formats.end())
+                {
+                    throw_runtime_error("log site not found");
+                }
+                format_record(out, header, iter->second.c_str(), stamp, body, len);
+            }
+        }
+        else
+        {
+            throw_runtime_error("log frame corrupted");
+        }
+        if (out.size() >= (1 << 20))
+        {
+            write_all(out_fd, out.c_str(), out.size());
+            out.clear();
+        }
+    }
+    write_all(out_fd, out.c_str(), out.size());
+}
+
+bool log_sampler::per_second(int64_t n) noexcept
+{
+    int64_t sec = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t window = window_.load(std::memory_order_relaxed);
+    if (window != sec && window_.compare_exchange_strong(window, sec, std::memory_order_relaxed))
+    {
+        passed_.store(0, std::memory_order_relaxed);
+    }
+    return passed_.fetch_add(1, std::memory_order_relaxed) < n;
+}
+
 namespace log
 {
 
@@ -147,6 +1133,8 @@ async_logger info(1);
 async_logger error(2);
 async_logger endl(-1);
 
+std::atomic<int> runtime_level(1);
+
 }   // namespace log
 
 }   // namespace cppev
@@ -11,6 +11,9 @@
 #include "cppev/utils.h"
 #include "cppev/sysconfig.h"
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <algorithm>
 
 namespace cppev
 {
@@ -192,6 +195,150 @@ void event_loop::loop_once(int timeout)
 
 }
 
+int64_t event_loop::timer_register(const std::chrono::nanoseconds &interval,
+    const timer_handler &handler, bool periodic, priority prio)
+{
+    if (interval.count() <= 0)
+    {
+        throw_logic_error("timer interval shall be positive");
+    }
+    std::unique_lock<std::mutex> lock(timer_lock_);
+    int64_t id = timer_id_++;
+    timer_entry entry{ id, prio, std::make_shared<timer_handler>(handler) };
+
+    if (periodic)
+    {
+        auto iter = timer_intervals_.find(interval.count());
+        if (iter != timer_intervals_.end())
+        {
+            auto &timers = timer_groups_[iter->second].timers;
+            auto pos = std::find_if(timers.begin(), timers.end(),
+                [prio](const timer_entry &t) { return t.prio < prio; });
+            timers.insert(pos, std::move(entry));
+            timer_fds_[id] = iter->second;
+            return id;
+        }
+    }
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+    {
+        throw_system_error("timerfd_create error");
+    }
+    auto iop = std::make_shared<nio>(fd);
+    itimerspec spec;
+    spec.it_value.tv_sec = interval.count() / 1'000'000'000;
+    spec.it_value.tv_nsec = interval.count() % 1'000'000'000;
+    if (periodic)
+    {
+        spec.it_interval = spec.it_value;
+    }
+    else
+    {
+        spec.it_interval.tv_sec = 0;
+        spec.it_interval.tv_nsec = 0;
+    }
+    if (timerfd_settime(fd, 0, &spec, nullptr) < 0)
+    {
+        throw_system_error("timerfd_settime error");
+    }
+
+    timer_group &group = timer_groups_[fd];
+    group.iop = iop;
+    group.interval = periodic ? interval.count() : 0;
+    group.timers.push_back(std::move(entry));
+    timer_fds_[id] = fd;
+    if (periodic)
+    {
+        timer_intervals_[interval.count()] = fd;
+    }
+    fd_register(iop, fd_event::fd_readable,
+        [this](const std::shared_ptr<nio> &iopt)
+        {
+            timer_expire(iopt);
+        }
+    );
+    return id;
+}
+
+bool event_loop::timer_remove(int64_t id)
+{
+    std::unique_lock<std::mutex> lock(timer_lock_);
+    auto iter = timer_fds_.find(id);
+    if (iter == timer_fds_.end())
+    {
+        return false;
+    }
+    int fd = iter->second;
+    timer_fds_.erase(iter);
+    auto &timers = timer_groups_[fd].timers;
+    timers.erase(std::find_if(timers.begin(), timers.end(),
+        [id](const timer_entry &t) { return t.id == id; }));
+    if (timers.empty())
+    {
+        timer_group_remove(fd);
+    }
+    return true;
+}
+
+void event_loop::timer_group_remove(int fd)
+{
+    auto iter = timer_groups_.find(fd);
+    if (iter->second.interval != 0)
+    {
+        timer_intervals_.erase(iter->second.interval);
+    }
+    for (const auto &t : iter->second.timers)
+    {
+        timer_fds_.erase(t.id);
+    }
+    fd_remove(iter->second.iop);
+    timer_groups_.erase(iter);
+}
+
+void event_loop::timer_expire(const std::shared_ptr<nio> &iop)
+{
+    uint64_t expirations = 0;
+    if (read(iop->fd(), &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        if (errno == EAGAIN || errno == EINTR)
+        {
+            return;
+        }
+        throw_system_error("timerfd read error");
+    }
+
+    bool oneshot;
+    {
+        std::unique_lock<std::mutex> lock(timer_lock_);
+        auto iter = timer_groups_.find(iop->fd());
+        if (iter == timer_groups_.end() || iter->second.iop != iop)
+        {
+            return;
+        }
+        timer_batch_.assign(iter->second.timers.begin(), iter->second.timers.end());
+        oneshot = iter->second.interval == 0;
+        if (oneshot)
+        {
+            timer_group_remove(iop->fd());
+        }
+    }
+    for (size_t i = 0; i < timer_batch_.size(); ++i)
+    {
+        if (!oneshot)
+        {
+            // Skip the ones removed by former handlers of the same trigger
+            std::unique_lock<std::mutex> lock(timer_lock_);
+            if (timer_fds_.count(timer_batch_[i].id) == 0)
+            {
+                continue;
+            }
+        }
+        (*timer_batch_[i].handler)(expirations);
+    }
+    timer_batch_.clear();
+}
+
 }   // namespace cppev
 
 #endif  // event loop for linux
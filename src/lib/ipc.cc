@@ -2,64 +2,152 @@
 #include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
+#include <vector>
 #include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+#include <linux/mempolicy.h>
+#endif  // __linux__
 
 namespace cppev
 {
 
-shared_memory::shared_memory(const std::string &name, int size, mode_t mode)
-: name_(name), size_(size), ptr_(nullptr), creator_(false)
+namespace
 {
+
+#ifdef __linux__
+size_t huge_page_size(shm_page page) noexcept
+{
+    switch (page)
+    {
+    case shm_page::huge_2mb:
+        return static_cast<size_t>(2) << 20;
+    case shm_page::huge_1gb:
+        return static_cast<size_t>(1) << 30;
+    default:
+        return 0;
+    }
+}
+#endif  // __linux__
+
+}   // namespace
+
+shared_memory::shared_memory(const std::string &name, size_t size, mode_t mode)
+: shared_memory(name, size, shm_options(), mode)
+{
+}
+
+shared_memory::shared_memory(const std::string &name, size_t size, const shm_options &options, mode_t mode)
+: name_(name), size_(size), ptr_(nullptr), fd_(-1), creator_(false)
+{
+    if ((options.page == shm_page::huge_2mb || options.page == shm_page::huge_1gb) && !options.memfd)
+    {
+        throw_logic_error("huge pages need memfd");
+    }
     int fd = -1;
-    fd = shm_open(name_.c_str(), O_RDWR, mode);
-    if (fd < 0)
+    if (options.memfd)
     {
-        if (errno == ENOENT)
+#ifdef __linux__
+        unsigned int flags = MFD_CLOEXEC;
+        if (options.page == shm_page::huge_2mb)
+        {
+            flags |= MFD_HUGETLB | MFD_HUGE_2MB;
+        }
+        else if (options.page == shm_page::huge_1gb)
+        {
+            flags |= MFD_HUGETLB | MFD_HUGE_1GB;
+        }
+        fd = memfd_create(name_.c_str(), flags);
+        if (fd < 0)
+        {
+            throw_system_error("memfd_create error");
+        }
+        fd_ = fd;
+        creator_ = true;
+#else
+        throw_logic_error("memfd is only supported on linux");
+#endif  // __linux__
+    }
+    else
+    {
+        fd = shm_open(name_.c_str(), O_RDWR, mode);
+        if (fd < 0)
         {
-            fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, mode);
-            if (fd < 0)
+            if (errno == ENOENT)
             {
-                if (errno == EEXIST)
+                fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, mode);
+                if (fd < 0)
                 {
-                    fd = shm_open(name_.c_str(), O_RDWR, mode);
-                    if (fd < 0)
+                    if (errno == EEXIST)
+                    {
+                        fd = shm_open(name_.c_str(), O_RDWR, mode);
+                        if (fd < 0)
+                        {
+                            throw_system_error("shm_open error");
+                        }
+                    }
+                    else
                     {
                         throw_system_error("shm_open error");
                     }
                 }
                 else
                 {
-                    throw_system_error("shm_open error");
+                    creator_ = true;
                 }
             }
             else
             {
-                creator_ = true;
+                throw_system_error("shm_open error");
             }
         }
-        else
-        {
-            throw_system_error("shm_open error");
-        }
     }
 
-    if (creator_)
+    try
     {
-        int ret = ftruncate(fd, size_);
-        if (ret == -1)
+        // New object is filled with zero by kernel
+        if (creator_)
         {
-            throw_system_error("ftruncate error");
+#ifdef __linux__
+            size_t page = huge_page_size(options.page);
+            if (page != 0 && size_ % page != 0)
+            {
+                throw_logic_error("size shall be multiple of huge page size");
+            }
+#endif  // __linux__
+            int ret = ftruncate(fd, size_);
+            if (ret == -1)
+            {
+                throw_system_error("ftruncate error");
+            }
         }
+        map(fd, options);
     }
-    ptr_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (ptr_ == MAP_FAILED)
+    catch (...)
     {
-        throw_system_error("mmap error");
+        close(fd);
+        fd_ = -1;
+        throw;
+    }
+    if (fd_ < 0)
+    {
+        close(fd);
     }
-    close(fd);
-    if (creator_)
+}
+
+shared_memory::shared_memory(int fd, size_t size, const shm_options &options)
+: name_(), size_(size), ptr_(nullptr), fd_(fd), creator_(false)
+{
+    try
+    {
+        map(fd, options);
+    }
+    catch (...)
     {
-        memset(ptr_, 0, size_);
+        close(fd);
+        fd_ = -1;
+        throw;
     }
 }
 
@@ -69,11 +157,83 @@ shared_memory::~shared_memory() noexcept
     {
         munmap(ptr_, size_);
     }
+    if (fd_ >= 0)
+    {
+        close(fd_);
+    }
+}
+
+void shared_memory::map(int fd, const shm_options &options)
+{
+    ptr_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr_ == MAP_FAILED)
+    {
+        ptr_ = nullptr;
+        throw_system_error("mmap error");
+    }
+
+    auto fail = [this](const char *msg)
+    {
+        int err = errno;
+        munmap(ptr_, size_);
+        ptr_ = nullptr;
+        throw_system_error(msg, err);
+    };
+
+#ifdef __linux__
+    if (options.page == shm_page::transparent_huge && madvise(ptr_, size_, MADV_HUGEPAGE) == -1)
+    {
+        fail("madvise error");
+    }
+    // Policy shall be set before pages are faulted in
+    if (options.numa_node >= 0)
+    {
+        const size_t bits = sizeof(unsigned long) * 8;
+        std::vector<unsigned long> mask(options.numa_node / bits + 1, 0);
+        mask[options.numa_node / bits] |= 1UL << (options.numa_node % bits);
+        if (syscall(SYS_mbind, ptr_, size_, MPOL_BIND, mask.data(), mask.size() * bits + 1,
+            MPOL_MF_MOVE) == -1)
+        {
+            fail("mbind error");
+        }
+    }
+#else
+    if (options.page != shm_page::normal || options.numa_node >= 0)
+    {
+        munmap(ptr_, size_);
+        ptr_ = nullptr;
+        throw_logic_error("huge pages and numa binding are only supported on linux");
+    }
+#endif  // __linux__
+
+    if (options.populate)
+    {
+        bool done = false;
+#if defined(__linux__) && defined(MADV_POPULATE_WRITE)
+        done = madvise(ptr_, size_, MADV_POPULATE_WRITE) == 0;
+#endif
+        // Reading faults in the page without changing the data
+        if (!done)
+        {
+            size_t page = sysconf(_SC_PAGESIZE);
+            volatile const char *p = static_cast<const char *>(ptr_);
+            for (size_t off = 0; off < size_; off += page)
+            {
+                (void)p[off];
+            }
+        }
+    }
+
+    if (options.lock && mlock(ptr_, size_) == -1)
+    {
+        fail("mlock error");
+    }
 }
 
 void shared_memory::unlink()
 {
-    if (name_.size() && (shm_unlink(name_.c_str()) == -1))
+    // Memfd is released when all fds and mappings are closed
+    if (fd_ < 0 && name_.size() && (shm_unlink(name_.c_str()) == -1))
     {
         throw_system_error("shm_unlink error");
     }
@@ -1,8 +1,67 @@
 #include "cppev/lock.h"
+#include <climits>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif  // __linux__
 
 namespace cppev
 {
 
+namespace
+{
+
+// Pauses of the longest backoff, yield cpu when it's exceeded
+constexpr int max_backoff = 1024;
+
+// Pauses per waiter ahead in ticket lock
+constexpr int ticket_backoff = 64;
+
+void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Exponential backoff, which ends up in yield
+class backoff final
+{
+public:
+    backoff()
+    : delay_(1)
+    {
+    }
+
+    void pause()
+    {
+        if (delay_ > max_backoff)
+        {
+            std::this_thread::yield();
+            return;
+        }
+        for (int i = 0; i < delay_; ++i)
+        {
+            cpu_relax();
+        }
+        delay_ *= 2;
+    }
+
+private:
+    int delay_;
+};
+
+}   // namespace
+
 spinlock::spinlock()
 {
 #ifdef CPPEV_SPINLOCK_USE_PTHREAD
@@ -72,6 +131,186 @@ bool spinlock::trylock()
 }
 
 
+ttas_spinlock::ttas_spinlock()
+: locked_(false)
+{
+}
+
+void ttas_spinlock::lock()
+{
+    backoff bo;
+    while (locked_.exchange(true, std::memory_order_acquire))
+    {
+        do
+        {
+            bo.pause();
+        } while (locked_.load(std::memory_order_relaxed));
+    }
+}
+
+bool ttas_spinlock::try_lock()
+{
+    return !locked_.load(std::memory_order_relaxed) &&
+        !locked_.exchange(true, std::memory_order_acquire);
+}
+
+void ttas_spinlock::unlock()
+{
+    locked_.store(false, std::memory_order_release);
+}
+
+
+ticket_spinlock::ticket_spinlock()
+: next_(0), serving_(0)
+{
+}
+
+void ticket_spinlock::lock()
+{
+    uint32_t ticket = next_.fetch_add(1, std::memory_order_relaxed);
+    int rounds = 0;
+    while (true)
+    {
+        uint32_t ahead = ticket - serving_.load(std::memory_order_acquire);
+        if (ahead == 0)
+        {
+            return;
+        }
+        // Successor may be preempted, so yield after waiting for a while
+        if (++rounds > max_backoff / ticket_backoff)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        for (uint32_t i = 0; i < ahead * ticket_backoff; ++i)
+        {
+            cpu_relax();
+        }
+    }
+}
+
+bool ticket_spinlock::try_lock()
+{
+    uint32_t serving = serving_.load(std::memory_order_acquire);
+    uint32_t ticket = serving;
+    return next_.compare_exchange_strong(ticket, serving + 1, std::memory_order_acquire,
+        std::memory_order_relaxed);
+}
+
+void ticket_spinlock::unlock()
+{
+    serving_.store(serving_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+struct alignas(64) mcs_spinlock::node
+{
+    std::atomic<node *> next;
+
+    // Cleared by predecessor when the lock is handed over
+    std::atomic<bool> locked;
+};
+
+namespace
+{
+
+// Free nodes of the thread
+struct mcs_node_pool
+{
+    ~mcs_node_pool()
+    {
+        for (auto n : nodes)
+        {
+            delete n;
+        }
+    }
+
+    std::vector<mcs_spinlock::node *> nodes;
+};
+
+thread_local mcs_node_pool mcs_pool;
+
+mcs_spinlock::node *get_mcs_node()
+{
+    if (mcs_pool.nodes.empty())
+    {
+        return new mcs_spinlock::node;
+    }
+    mcs_spinlock::node *n = mcs_pool.nodes.back();
+    mcs_pool.nodes.pop_back();
+    return n;
+}
+
+void put_mcs_node(mcs_spinlock::node *n)
+{
+    mcs_pool.nodes.push_back(n);
+}
+
+}   // namespace
+
+mcs_spinlock::mcs_spinlock()
+: tail_(nullptr), owner_(nullptr)
+{
+}
+
+void mcs_spinlock::lock()
+{
+    node *n = get_mcs_node();
+    n->next.store(nullptr, std::memory_order_relaxed);
+    n->locked.store(true, std::memory_order_relaxed);
+    node *pred = tail_.exchange(n, std::memory_order_acq_rel);
+    if (pred != nullptr)
+    {
+        pred->next.store(n, std::memory_order_release);
+        backoff bo;
+        while (n->locked.load(std::memory_order_acquire))
+        {
+            bo.pause();
+        }
+    }
+    owner_ = n;
+}
+
+bool mcs_spinlock::try_lock()
+{
+    node *n = get_mcs_node();
+    n->next.store(nullptr, std::memory_order_relaxed);
+    node *expected = nullptr;
+    if (tail_.compare_exchange_strong(expected, n, std::memory_order_acquire,
+        std::memory_order_relaxed))
+    {
+        owner_ = n;
+        return true;
+    }
+    put_mcs_node(n);
+    return false;
+}
+
+void mcs_spinlock::unlock()
+{
+    node *n = owner_;
+    node *succ = n->next.load(std::memory_order_acquire);
+    if (succ == nullptr)
+    {
+        node *expected = n;
+        if (tail_.compare_exchange_strong(expected, nullptr, std::memory_order_release,
+            std::memory_order_relaxed))
+        {
+            put_mcs_node(n);
+            return;
+        }
+        // Successor has swapped the tail but not linked yet
+        backoff bo;
+        while ((succ = n->next.load(std::memory_order_acquire)) == nullptr)
+        {
+            bo.pause();
+        }
+    }
+    succ->locked.store(false, std::memory_order_release);
+    put_mcs_node(n);
+}
+
+
 pshared_lock::pshared_lock()
 {
     int ret = 0;
@@ -448,4 +687,321 @@ void wrlockguard::unlock()
     rwlock_->unlock();
 }
 
+
+#ifdef __linux__
+
+namespace
+{
+
+constexpr uint32_t waiters_bit = FUTEX_WAITERS;
+
+constexpr uint32_t tid_mask = FUTEX_TID_MASK;
+
+constexpr int barrier_spins = 1000;
+
+long futex(std::atomic<uint32_t> *addr, int op, uint32_t val, const timespec *ts)
+{
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), op, val, ts, nullptr, 0);
+}
+
+// Whether /proc is mounted and shows the pid namespace of this process
+bool proc_usable()
+{
+    int fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    char buf[32];
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+    {
+        return false;
+    }
+    buf[len] = '\0';
+    return strtol(buf, nullptr, 10) == getpid();
+}
+
+// Thread is regarded as dead if it doesn't exist or it's a zombie, it's assumed alive
+// whenever that cannot be told
+bool thread_alive(uint32_t tid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%u/stat", tid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        // Entry may be hidden by hidepid, which doesn't apply to kill
+        return errno != ENOENT || !proc_usable() || kill(tid, 0) == 0 || errno != ESRCH;
+    }
+    char buf[512];
+    ssize_t len = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (len <= 0)
+    {
+        return true;
+    }
+    // State follows the command name in parentheses
+    const char *p = static_cast<const char *>(memrchr(buf, ')', len));
+    if (p == nullptr || p + 2 >= buf + len)
+    {
+        return true;
+    }
+    return p[2] != 'Z' && p[2] != 'X';
+}
+
+}   // namespace
+
+bool futex_wait(std::atomic<uint32_t> &word, uint32_t value, std::chrono::nanoseconds timeout)
+{
+    timespec ts;
+    timespec *pts = nullptr;
+    if (timeout.count() >= 0)
+    {
+        ts.tv_sec = timeout.count() / 1000000000;
+        ts.tv_nsec = timeout.count() % 1000000000;
+        pts = &ts;
+    }
+    return !(futex(&word, FUTEX_WAIT, value, pts) == -1 && errno == ETIMEDOUT);
+}
+
+void futex_wake(std::atomic<uint32_t> &word, int count)
+{
+    futex(&word, FUTEX_WAKE, count, nullptr);
+}
+
+
+futex_lock::futex_lock(bool pi)
+: word_(0), spins_(0), pi_(pi), owner_died_(false)
+{
+}
+
+void futex_lock::lock()
+{
+    uint32_t tid = gettid();
+    uint32_t word = 0;
+    if (word_.compare_exchange_strong(word, tid, std::memory_order_acquire, std::memory_order_relaxed))
+    {
+        owner_died_ = false;
+        return;
+    }
+
+    // Spin limit adapts to the spins that succeeded recently
+    int spins = spins_.load(std::memory_order_relaxed);
+    int limit = std::min(max_spins, spins * 2 + 10);
+    for (int i = 0; i < limit; ++i)
+    {
+        cpu_relax();
+        word = word_.load(std::memory_order_relaxed);
+        if (word == 0 && word_.compare_exchange_weak(word, tid, std::memory_order_acquire,
+            std::memory_order_relaxed))
+        {
+            spins_.store(spins + (i - spins) / 8, std::memory_order_relaxed);
+            owner_died_ = false;
+            return;
+        }
+    }
+    spins_.store(spins + (limit - spins) / 8, std::memory_order_relaxed);
+
+    if (pi_)
+    {
+        lock_pi(tid);
+    }
+    else
+    {
+        lock_slow(tid);
+    }
+}
+
+void futex_lock::lock_slow(uint32_t tid)
+{
+    uint32_t word = word_.load(std::memory_order_relaxed);
+    // Owner is probed less often the longer it holds the lock
+    std::chrono::milliseconds probe = robust_probe;
+    while (true)
+    {
+        if ((word & tid_mask) == 0)
+        {
+            // Others may be parked, so waiters bit is kept
+            if (word_.compare_exchange_weak(word, tid | waiters_bit, std::memory_order_acquire,
+                std::memory_order_relaxed))
+            {
+                owner_died_ = false;
+                return;
+            }
+            continue;
+        }
+        if (!(word & waiters_bit))
+        {
+            if (!word_.compare_exchange_weak(word, word | waiters_bit, std::memory_order_relaxed))
+            {
+                continue;
+            }
+            word |= waiters_bit;
+        }
+        if (!futex_wait(word_, word, probe))
+        {
+            if (!thread_alive(word & tid_mask) && take_over(word, tid))
+            {
+                return;
+            }
+            probe = std::min(probe * 2, max_robust_probe);
+        }
+        word = word_.load(std::memory_order_relaxed);
+    }
+}
+
+void futex_lock::lock_pi(uint32_t tid)
+{
+    while (true)
+    {
+        if (futex(&word_, FUTEX_LOCK_PI, 0, nullptr) == 0)
+        {
+            owner_died_ = false;
+            return;
+        }
+        if (errno == EINTR || errno == EAGAIN)
+        {
+            continue;
+        }
+        if (errno != ESRCH)
+        {
+            throw_system_error("futex lock pi error");
+        }
+        // Kernel cannot find the owner
+        uint32_t word = word_.load(std::memory_order_relaxed);
+        if ((word & tid_mask) != 0 && !thread_alive(word & tid_mask) && take_over(word, tid))
+        {
+            return;
+        }
+    }
+}
+
+bool futex_lock::take_over(uint32_t word, uint32_t tid)
+{
+    if (word_.compare_exchange_strong(word, tid | (word & waiters_bit), std::memory_order_acquire,
+        std::memory_order_relaxed))
+    {
+        owner_died_ = true;
+        return true;
+    }
+    return false;
+}
+
+bool futex_lock::try_lock()
+{
+    uint32_t word = 0;
+    if (word_.compare_exchange_strong(word, gettid(), std::memory_order_acquire,
+        std::memory_order_relaxed))
+    {
+        owner_died_ = false;
+        return true;
+    }
+    return false;
+}
+
+void futex_lock::unlock()
+{
+    if (pi_)
+    {
+        uint32_t word = gettid();
+        if (!word_.compare_exchange_strong(word, 0, std::memory_order_release,
+            std::memory_order_relaxed) && futex(&word_, FUTEX_UNLOCK_PI, 0, nullptr) == -1)
+        {
+            throw_system_error("futex unlock pi error");
+        }
+        return;
+    }
+    if (word_.exchange(0, std::memory_order_release) & waiters_bit)
+    {
+        futex_wake(word_, 1);
+    }
+}
+
+
+futex_cond::futex_cond()
+: seq_(0), waiters_(0)
+{
+}
+
+void futex_cond::wait(std::unique_lock<futex_lock> &lock)
+{
+    wait_for(lock, std::chrono::nanoseconds(-1));
+}
+
+void futex_cond::wait(std::unique_lock<futex_lock> &lock, const condition &cond)
+{
+    while (!cond())
+    {
+        wait(lock);
+    }
+}
+
+bool futex_cond::wait_for(std::unique_lock<futex_lock> &lock, std::chrono::nanoseconds timeout)
+{
+    waiters_.fetch_add(1);
+    uint32_t seq = seq_.load();
+    lock.unlock();
+    bool ret = futex_wait(seq_, seq, timeout);
+    lock.lock();
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return ret;
+}
+
+void futex_cond::notify_one()
+{
+    seq_.fetch_add(1);
+    if (waiters_.load())
+    {
+        futex_wake(seq_, 1);
+    }
+}
+
+void futex_cond::notify_all()
+{
+    seq_.fetch_add(1);
+    if (waiters_.load())
+    {
+        futex_wake(seq_, INT_MAX);
+    }
+}
+
+
+futex_barrier::futex_barrier(int count)
+: count_(count), arrived_(0), generation_(0)
+{
+    if (count <= 0)
+    {
+        throw_logic_error("barrier count shall be positive");
+    }
+}
+
+bool futex_barrier::wait()
+{
+    uint32_t gen = generation_.load(std::memory_order_acquire);
+    if (arrived_.fetch_add(1, std::memory_order_acq_rel) + 1 == count_)
+    {
+        arrived_.store(0, std::memory_order_relaxed);
+        generation_.fetch_add(1, std::memory_order_release);
+        futex_wake(generation_, INT_MAX);
+        return true;
+    }
+    for (int i = 0; i < barrier_spins; ++i)
+    {
+        if (generation_.load(std::memory_order_acquire) != gen)
+        {
+            return false;
+        }
+        cpu_relax();
+    }
+    while (generation_.load(std::memory_order_acquire) == gen)
+    {
+        futex_wait(generation_, gen);
+    }
+    return false;
+}
+
+#endif  // __linux__
+
 }   // namespace cppev
\ No newline at end of file
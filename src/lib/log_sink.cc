@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "cppev/utils.h"
+#include "cppev/sysconfig.h"
+#include "cppev/log_sink.h"
+
+namespace cppev
+{
+
+log_file_sink::log_file_sink(const log_file_options &options)
+: options_(options), fd_(-1), file_size_(0), dirty_(false), rotate_seq_(0),
+  flush_requests_(0), stop_(false), stats_{0, 0, 0, 0, 0}
+{
+    if (options_.buffer_count < 2 || options_.buffer_size <= 0)
+    {
+        throw_logic_error("log sink needs at least 2 buffers");
+    }
+    if (options_.keep_files < 0 || options_.rotate_size < 0)
+    {
+        throw_logic_error("invalid log rotation");
+    }
+    open_file();
+    if (fd_ < 0)
+    {
+        throw_system_error("open error");
+    }
+    synced_at_ = opened_at_;
+    curr_.reserve(options_.buffer_size);
+    free_.resize(options_.buffer_count - 1);
+    for (auto &buf : free_)
+    {
+        buf.reserve(options_.buffer_size);
+    }
+    run();
+}
+
+log_file_sink::~log_file_sink()
+{
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        stop_ = true;
+        cond_.notify_one();
+    }
+    join();
+    if (fd_ >= 0)
+    {
+        close(fd_);
+    }
+}
+
+bool log_file_sink::append(const char *data, size_t len)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    if (!curr_.empty() && curr_.size() + len > static_cast<size_t>(options_.buffer_size))
+    {
+        while (free_.empty())
+        {
+            if (options_.overflow == log_overflow_policy::drop)
+            {
+                stats_.dropped += len;
+                return false;
+            }
+            free_cond_.wait(lock);
+        }
+        full_.push_back(std::move(curr_));
+        curr_ = std::move(free_.back());
+        free_.pop_back();
+        cond_.notify_one();
+    }
+    curr_.append(data, len);
+    return true;
+}
+
+void log_file_sink::flush()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    ++flush_requests_;
+    cond_.notify_one();
+    free_cond_.wait(lock, [this]() { return flush_requests_ == 0; });
+}
+
+log_sink_stats log_file_sink::stats() const
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    return stats_;
+}
+
+void log_file_sink::run_impl()
+{
+    std::vector<std::string> bufs;
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true)
+    {
+        cond_.wait_for(lock, std::chrono::seconds(sysconfig::buffer_outdate),
+            [this]() { return !full_.empty() || flush_requests_ || stop_; });
+
+        // Partial buffer is taken when outdated, flushed or stopped
+        if (full_.empty() && !curr_.empty() && !free_.empty())
+        {
+            full_.push_back(std::move(curr_));
+            curr_ = std::move(free_.back());
+            free_.pop_back();
+        }
+        bufs.swap(full_);
+        bool stop = stop_;
+        lock.unlock();
+
+        if (!bufs.empty())
+        {
+            write_buffers(bufs);
+        }
+        sync(stop);
+
+        lock.lock();
+        for (auto &buf : bufs)
+        {
+            buf.clear();
+            free_.push_back(std::move(buf));
+        }
+        bufs.clear();
+        free_cond_.notify_all();
+
+        if (full_.empty() && curr_.empty())
+        {
+            if (flush_requests_)
+            {
+                flush_requests_ = 0;
+                free_cond_.notify_all();
+            }
+            if (stop_)
+            {
+                break;
+            }
+        }
+    }
+}
+
+void log_file_sink::open_file()
+{
+    fd_ = open(options_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    opened_at_ = std::chrono::steady_clock::now();
+    file_size_ = 0;
+    if (fd_ < 0)
+    {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) == 0)
+    {
+        file_size_ = st.st_size;
+    }
+}
+
+void log_file_sink::check_rotate(size_t incoming)
+{
+    if (fd_ < 0)
+    {
+        open_file();
+        return;
+    }
+    if (file_size_ == 0)
+    {
+        return;
+    }
+    bool by_size = options_.rotate_size > 0 &&
+        file_size_ + static_cast<int64_t>(incoming) > options_.rotate_size;
+    bool by_time = options_.rotate_interval.count() > 0 &&
+        std::chrono::steady_clock::now() - opened_at_ >= options_.rotate_interval;
+    if (by_size || by_time)
+    {
+        rotate();
+    }
+}
+
+void log_file_sink::rotate()
+{
+    sync(true);
+    close(fd_);
+    fd_ = -1;
+    std::string name = options_.path + "." + timestamp(-1, "%Y%m%d-%H%M%S") + "." +
+        std::to_string(rotate_seq_++);
+    if (rename(options_.path.c_str(), name.c_str()) == 0)
+    {
+        rotated_.push_back(name);
+        while (options_.keep_files > 0 && static_cast<int>(rotated_.size()) > options_.keep_files)
+        {
+            unlink(rotated_.front().c_str());
+            rotated_.pop_front();
+        }
+    }
+    open_file();
+    std::unique_lock<std::mutex> lock(lock_);
+    ++stats_.rotations;
+}
+
+void log_file_sink::sync(bool force)
+{
+    if (options_.sync == log_sync_policy::none || !dirty_ || fd_ < 0)
+    {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!force && now - synced_at_ < options_.sync_interval)
+    {
+        return;
+    }
+#ifdef __linux__
+    int ret = options_.sync == log_sync_policy::fdatasync ? fdatasync(fd_) : fsync(fd_);
+#else
+    int ret = fsync(fd_);
+#endif  // __linux__
+    if (ret == 0)
+    {
+        dirty_ = false;
+    }
+    synced_at_ = now;
+    std::unique_lock<std::mutex> lock(lock_);
+    ++stats_.syncs;
+}
+
+void log_file_sink::write_buffers(std::vector<std::string> &bufs)
+{
+    std::vector<iovec> iovs;
+    size_t pending = 0;
+    int64_t written = 0;
+    int64_t dropped = 0;
+    int64_t writes = 0;
+
+    auto write_pending = [&]()
+    {
+        size_t idx = 0;
+        while (idx < iovs.size())
+        {
+            ++writes;
+            ssize_t ret = fd_ < 0 ? -1 :
+                writev(fd_, iovs.data() + idx, std::min<size_t>(iovs.size() - idx, IOV_MAX));
+            if (ret < 0)
+            {
+                if (fd_ >= 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                // Records are lost if the file cannot be written
+                for (; idx < iovs.size(); ++idx)
+                {
+                    dropped += iovs[idx].iov_len;
+                }
+                break;
+            }
+            written += ret;
+            file_size_ += ret;
+            for (; idx < iovs.size() && static_cast<size_t>(ret) >= iovs[idx].iov_len; ++idx)
+            {
+                ret -= iovs[idx].iov_len;
+            }
+            if (ret > 0)
+            {
+                iovs[idx].iov_base = static_cast<char *>(iovs[idx].iov_base) + ret;
+                iovs[idx].iov_len -= ret;
+            }
+        }
+        dirty_ = dirty_ || written > 0;
+        iovs.clear();
+        pending = 0;
+    };
+
+    for (auto &buf : bufs)
+    {
+        if (buf.empty())
+        {
+            continue;
+        }
+        size_t before = fd_ < 0 ? 0 : file_size_ + pending;
+        if (options_.rotate_size > 0 && before > 0 &&
+            static_cast<int64_t>(before + buf.size()) > options_.rotate_size)
+        {
+            write_pending();
+        }
+        if (iovs.empty())
+        {
+            check_rotate(buf.size());
+        }
+        iovs.push_back(iovec{ const_cast<char *>(buf.data()), buf.size() });
+        pending += buf.size();
+    }
+    write_pending();
+
+    std::unique_lock<std::mutex> lock(lock_);
+    stats_.written += written;
+    stats_.dropped += dropped;
+    stats_.writes += writes;
+}
+
+}   // namespace cppev
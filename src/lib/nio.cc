@@ -243,10 +243,10 @@ static void set_path(sockaddr_storage &addr, const char *path)
 
 static std::tuple<std::string, int, family> query_ip_port_family(sockaddr_storage &addr)
 {
-    int port;
+    int port = 0;
     char ip[sizeof(sockaddr_storage)];
     memset(ip, 0, sizeof(ip));
-    family f;
+    family f = family::ipv4;
     switch(addr.ss_family)
     {
     case AF_INET :
@@ -491,6 +491,130 @@ int nsocktcp::get_so_error() const
     return optval;
 }
 
+int nsocktcp::send_fd(int fd)
+{
+    if (0 == wbuffer().size())
+    {
+        throw_logic_error("fd shall be sent with data");
+    }
+    iovec iov;
+    iov.iov_base = wbuffer().buffer_.get() + wbuffer().start_;
+    iov.iov_len = wbuffer().size();
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    int curr;
+    while ((curr = sendmsg(fd_, &msg, 0)) == -1)
+    {
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return 0;
+        }
+        else if (errno == EPIPE)
+        {
+            eop_ = true;
+            return 0;
+        }
+        else if (errno == ECONNRESET)
+        {
+            reset_ = true;
+            return 0;
+        }
+        else
+        {
+            throw_system_error("sendmsg error");
+        }
+    }
+    wbuffer().start_ += curr;
+    if (0 == wbuffer().size())
+    {
+        wbuffer().clear();
+    }
+    return curr;
+}
+
+int nsocktcp::recv_fds(std::vector<int> &fds, int step)
+{
+    // SCM_MAX_FD of linux, one message carries at most these fds
+    constexpr int max_fds = 253;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_fds)];
+    int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+    int origin_offset = rbuffer().offset_;
+    while (true)
+    {
+        rbuffer().resize(rbuffer().offset_ + step);
+        iovec iov;
+        iov.iov_base = rbuffer().buffer_.get() + rbuffer().offset_;
+        iov.iov_len = step;
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int curr = recvmsg(fd_, &msg, flags);
+        if (curr == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            else if (errno == ECONNRESET)
+            {
+                reset_ = true;
+                break;
+            }
+            else
+            {
+                throw_system_error("recvmsg error");
+            }
+        }
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            {
+                continue;
+            }
+            int num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < num; ++i)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fds.push_back(fd);
+            }
+        }
+        if (curr == 0)
+        {
+            eof_ = true;
+            break;
+        }
+        rbuffer().offset_ += curr;
+    }
+    return rbuffer().offset_ - origin_offset;
+}
+
 void nsocktcp::shutdown(shut_mode howto) noexcept
 {
     switch (howto)
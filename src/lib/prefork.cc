@@ -0,0 +1,416 @@
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "cppev/prefork.h"
+
+namespace cppev
+{
+
+namespace reactor
+{
+
+struct alignas(64) prefork_server::worker_slot
+{
+    std::atomic<pid_t> pid;
+
+    std::atomic<int64_t> generation;
+
+    std::atomic<int64_t> connections;
+
+    std::atomic<int64_t> accepted;
+
+    std::atomic<bool> ready;
+};
+
+namespace
+{
+
+// Interval of checking workers
+constexpr std::chrono::milliseconds supervise_interval(100);
+
+// Time waiting for worker to be ready or to exit
+constexpr std::chrono::milliseconds worker_timeout(10000);
+
+// Time waiting for connections of stopping worker to be closed by clients
+constexpr std::chrono::milliseconds drain_timeout(1000);
+
+// Worker dying within it after started is restarted with backoff
+constexpr std::chrono::milliseconds stable_time(10000);
+
+// Limit of restart backoff
+constexpr std::chrono::milliseconds max_backoff(5000);
+
+// Delay of restarting worker that died soon after started for failures times in a row
+std::chrono::milliseconds restart_backoff(int failures)
+{
+    return std::min<std::chrono::milliseconds>(supervise_interval * (1 << std::min(failures - 1, 16)),
+        max_backoff);
+}
+
+// Reap worker
+// @return whether worker exited before timeout
+bool wait_worker(pid_t pid, std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        int ret = waitpid(pid, nullptr, WNOHANG);
+        if (ret == pid || (ret == -1 && errno == ECHILD))
+        {
+            return true;
+        }
+        if (ret == -1 && errno != EINTR)
+        {
+            throw_system_error("waitpid error");
+        }
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+}   // namespace
+
+prefork_server::prefork_server(int proc_num, int thr_num, void *external_data)
+: proc_num_(proc_num), thr_num_(thr_num), external_data_(external_data), stop_(false)
+{
+    if (proc_num_ <= 0)
+    {
+        throw_logic_error("prefork server needs at least one worker");
+    }
+    shm_options options;
+    options.memfd = true;
+    shm_ = std::make_unique<shared_memory>("cppev_prefork", sizeof(worker_slot) * proc_num_, options);
+    slots_ = static_cast<worker_slot *>(shm_->ptr());
+    for (int i = 0; i < proc_num_; ++i)
+    {
+        new (&slots_[i]) worker_slot();
+    }
+    states_.resize(proc_num_, worker_state{ false, 0, {}, {} });
+}
+
+prefork_server::~prefork_server() noexcept
+{
+    if (supervisor_)
+    {
+        try
+        {
+            shutdown();
+        }
+        catch (const std::exception &e)
+        {
+            CPPEV_ERROR << "prefork server shutdown failed : " << e.what() << log::endl;
+        }
+    }
+}
+
+void prefork_server::listen(int port, family f, const char *ip)
+{
+    std::shared_ptr<nsocktcp> sock = nio_factory::get_nsocktcp(f);
+    sock->bind(ip, port);
+    sock->listen();
+    socks_.push_back(sock);
+    CPPEV_INFO << "fd " << sock->fd() << " listening in port " << port << " for workers" << log::endl;
+}
+
+void prefork_server::listen_unix(const std::string &path, bool remove)
+{
+    std::shared_ptr<nsocktcp> sock = nio_factory::get_nsocktcp(family::local);
+    sock->bind_unix(path, remove);
+    sock->listen();
+    socks_.push_back(sock);
+    CPPEV_INFO << "fd " << sock->fd() << " listening in path " << path << " for workers" << log::endl;
+}
+
+void prefork_server::run()
+{
+    // Workers log by loggers inherited from supervisor
+    async_logger::set_fork_support(true);
+    for (int i = 0; i < proc_num_; ++i)
+    {
+        bool running = start_worker(i);
+        std::unique_lock<std::mutex> lock(lock_);
+        worker_started(i, running);
+    }
+    supervisor_ = std::make_unique<supervisor>(this);
+    supervisor_->run();
+}
+
+void prefork_server::restart()
+{
+    for (int i = 0; i < proc_num_; ++i)
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        if (!acquire_worker(lock, i))
+        {
+            return;
+        }
+        lock.unlock();
+        stop_worker(i);
+        bool running = start_worker(i);
+        lock.lock();
+        worker_started(i, running);
+        release_worker(lock, i);
+    }
+}
+
+void prefork_server::shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    if (supervisor_)
+    {
+        supervisor_->join();
+        supervisor_.reset();
+    }
+    // Wait for restart in progress
+    std::unique_lock<std::mutex> lock(lock_);
+    cond_.wait(lock, [this]() -> bool
+        {
+            return std::none_of(states_.begin(), states_.end(),
+                [](const worker_state &state) { return state.busy; });
+        }
+    );
+    for (int i = 0; i < proc_num_; ++i)
+    {
+        stop_worker(i);
+    }
+}
+
+std::vector<worker_load> prefork_server::loads() const
+{
+    std::vector<worker_load> loads;
+    for (int i = 0; i < proc_num_; ++i)
+    {
+        const worker_slot &slot = slots_[i];
+        loads.push_back(worker_load{ slot.pid.load(), slot.generation.load(),
+            slot.connections.load(), slot.accepted.load(), slot.ready.load() });
+    }
+    return loads;
+}
+
+bool prefork_server::acquire_worker(std::unique_lock<std::mutex> &lock, int index)
+{
+    cond_.wait(lock, [this, index]() -> bool
+        {
+            return !states_[index].busy || stop_;
+        }
+    );
+    if (stop_)
+    {
+        return false;
+    }
+    states_[index].busy = true;
+    return true;
+}
+
+void prefork_server::release_worker(std::unique_lock<std::mutex> &lock, int index)
+{
+    states_[index].busy = false;
+    lock.unlock();
+    cond_.notify_all();
+    lock.lock();
+}
+
+void prefork_server::worker_started(int index, bool running)
+{
+    worker_state &state = states_[index];
+    state.started = std::chrono::steady_clock::now();
+    if (!running)
+    {
+        ++state.failures;
+        state.next_start = state.started + restart_backoff(state.failures);
+    }
+}
+
+bool prefork_server::start_worker(int index)
+{
+    worker_slot &slot = slots_[index];
+    slot.ready.store(false);
+    slot.connections.store(0);
+    slot.accepted.store(0);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw_system_error("fork error");
+    }
+    else if (pid == 0)
+    {
+        worker_main(index);
+    }
+    slot.pid.store(pid);
+    slot.generation.fetch_add(1);
+
+    auto deadline = std::chrono::steady_clock::now() + worker_timeout;
+    while (!slot.ready.load())
+    {
+        if (waitpid(pid, nullptr, WNOHANG) == pid)
+        {
+            CPPEV_ERROR << "worker " << index << " pid " << pid << " exited when starting" << log::endl;
+            slot.pid.store(0);
+            return false;
+        }
+        if (stop_.load())
+        {
+            // Stopped by shutdown
+            return true;
+        }
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            CPPEV_ERROR << "worker " << index << " pid " << pid << " is not ready in time" << log::endl;
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CPPEV_INFO << "worker " << index << " started with pid " << pid << log::endl;
+    return true;
+}
+
+void prefork_server::stop_worker(int index)
+{
+    worker_slot &slot = slots_[index];
+    pid_t pid = slot.pid.load();
+    if (pid == 0)
+    {
+        return;
+    }
+    slot.ready.store(false);
+    if (check_process(pid))
+    {
+        send_signal(pid, SIGTERM);
+    }
+    if (!wait_worker(pid, worker_timeout))
+    {
+        CPPEV_ERROR << "worker " << index << " pid " << pid << " is killed after timeout" << log::endl;
+        send_signal(pid, SIGKILL);
+        wait_worker(pid, worker_timeout);
+    }
+    slot.pid.store(0);
+}
+
+void prefork_server::worker_main(int index)
+{
+    worker_slot &slot = slots_[index];
+    try
+    {
+        // Blocked before io threads are created, so only the main thread waits for it
+        thread_block_signal(SIGTERM);
+        tcp_server server(thr_num_, external_data_);
+        server.set_on_accept([this, &slot](const std::shared_ptr<nsocktcp> &iopt)
+        {
+            slot.accepted.fetch_add(1, std::memory_order_relaxed);
+            slot.connections.fetch_add(1, std::memory_order_relaxed);
+            if (on_accept_)
+            {
+                on_accept_(iopt);
+            }
+        });
+        server.set_on_closed([this, &slot](const std::shared_ptr<nsocktcp> &iopt)
+        {
+            slot.connections.fetch_sub(1, std::memory_order_relaxed);
+            if (on_closed_)
+            {
+                on_closed_(iopt);
+            }
+        });
+        if (on_read_complete_)
+        {
+            server.set_on_read_complete(on_read_complete_);
+        }
+        if (on_write_complete_)
+        {
+            server.set_on_write_complete(on_write_complete_);
+        }
+        for (auto &sock : socks_)
+        {
+            server.listen(sock);
+        }
+        server.run();
+        slot.ready.store(true);
+        thread_wait_for_signal(SIGTERM);
+
+        // Serve connections already accepted, new ones are left to other workers
+        server.stop_accept();
+        auto deadline = std::chrono::steady_clock::now() + drain_timeout;
+        while (slot.connections.load() > 0 && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        server.shutdown();
+    }
+    catch (const std::exception &e)
+    {
+        CPPEV_ERROR << "worker " << index << " failed : " << e.what() << log::endl;
+        _exit(1);
+    }
+    // Resources of supervisor copied by fork shall not be released
+    _exit(0);
+}
+
+void prefork_server::supervisor::run_impl()
+{
+    std::unique_lock<std::mutex> lock(server_->lock_);
+    while (!server_->stop_)
+    {
+        server_->cond_.wait_for(lock, supervise_interval);
+        if (server_->stop_)
+        {
+            break;
+        }
+        for (int i = 0; i < server_->proc_num_ && !server_->stop_; ++i)
+        {
+            worker_state &state = server_->states_[i];
+            if (state.busy)
+            {
+                continue;
+            }
+            auto now = std::chrono::steady_clock::now();
+            pid_t pid = server_->slots_[i].pid.load();
+            if (pid != 0)
+            {
+                // Worker may be reaped by others, so check the existence as well
+                if (waitpid(pid, nullptr, WNOHANG) != pid && check_process(pid))
+                {
+                    continue;
+                }
+                server_->slots_[i].ready.store(false);
+                server_->slots_[i].pid.store(0);
+                if (now - state.started < stable_time)
+                {
+                    ++state.failures;
+                    state.next_start = now + restart_backoff(state.failures);
+                }
+                else
+                {
+                    state.failures = 0;
+                }
+                CPPEV_ERROR << "worker " << i << " pid " << pid << " exited, restarting" << log::endl;
+            }
+            if (now < state.next_start)
+            {
+                continue;
+            }
+            state.busy = true;
+            lock.unlock();
+            bool running = server_->start_worker(i);
+            lock.lock();
+            server_->worker_started(i, running);
+            server_->release_worker(lock, i);
+        }
+    }
+}
+
+}   // namespace reactor
+
+}   // namespace cppev
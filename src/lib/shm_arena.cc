@@ -0,0 +1,322 @@
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include "cppev/shm_arena.h"
+
+namespace cppev
+{
+
+namespace
+{
+
+constexpr uint64_t ready_magic = 0x616e657261766570;
+
+// Free list head is offset in units of alignment in the low bits, and a tag incremented by
+// each push and pop in the high bits, so a stale head never compares equal
+constexpr int offset_bits = 40;
+
+constexpr uint64_t offset_mask = (static_cast<uint64_t>(1) << offset_bits) - 1;
+
+constexpr uint64_t tag_unit = static_cast<uint64_t>(1) << offset_bits;
+
+uint64_t next_tag(uint64_t head) noexcept
+{
+    return (head & ~offset_mask) + tag_unit;
+}
+
+// Freed block stores the next block of the list in its first word
+std::atomic<uint64_t> *link_of(char *block) noexcept
+{
+    return reinterpret_cast<std::atomic<uint64_t> *>(block);
+}
+
+}   // namespace
+
+shm_arena::shm_arena(size_t size)
+: magic_(0), size_(size), root_(0), allocated_(0),
+  cursor_((sizeof(shm_arena) + alignment - 1) & ~(alignment - 1))
+{
+    for (auto &head : free_)
+    {
+        head.store(0, std::memory_order_relaxed);
+    }
+}
+
+shm_arena *shm_arena::attach(shared_memory &shm)
+{
+    if (shm.size() < sizeof(shm_arena))
+    {
+        throw_logic_error("shared memory is too small for arena");
+    }
+    if (shm.size() / alignment > offset_mask)
+    {
+        throw_logic_error("shared memory is too large for arena");
+    }
+    shm_arena *arena = nullptr;
+    if (shm.creator())
+    {
+        arena = new (shm.ptr()) shm_arena(shm.size());
+        arena->magic_.store(ready_magic, std::memory_order_release);
+    }
+    else
+    {
+        arena = static_cast<shm_arena *>(shm.ptr());
+        while (arena->magic_.load(std::memory_order_acquire) != ready_magic)
+        {
+            std::this_thread::yield();
+        }
+    }
+    if (arena->size_ != shm.size())
+    {
+        throw_logic_error("shm arena is formatted differently");
+    }
+    return arena;
+}
+
+int shm_arena::size_class(size_t size) noexcept
+{
+    if (size <= 64)
+    {
+        return size == 0 ? 0 : (size - 1) / 16;
+    }
+    // 2 ^ p < size <= 2 ^ (p + 1), classes step by 2 ^ (p - 2)
+    int p = 63 - __builtin_clzll(size - 1);
+    size_t step = static_cast<size_t>(1) << (p - 2);
+    int k = (size - (static_cast<size_t>(1) << p) + step - 1) / step;
+    return 4 + (p - 6) * 4 + (k - 1);
+}
+
+size_t shm_arena::class_size(int cls) noexcept
+{
+    if (cls < 4)
+    {
+        return (cls + 1) * 16;
+    }
+    int p = 6 + (cls - 4) / 4;
+    int k = (cls - 4) % 4 + 1;
+    return (static_cast<size_t>(1) << p) + k * (static_cast<size_t>(1) << (p - 2));
+}
+
+size_t shm_arena::block_size(size_t size)
+{
+    int cls = size_class(size);
+    if (cls >= size_classes)
+    {
+        throw_logic_error("allocation is too large for shm arena");
+    }
+    return class_size(cls);
+}
+
+void *shm_arena::allocate(size_t size)
+{
+    if (size_class(size) >= size_classes)
+    {
+        throw_logic_error("allocation is too large for shm arena");
+    }
+    void *ptr = try_allocate(size);
+    if (ptr == nullptr)
+    {
+        throw_runtime_error("shm arena is exhausted");
+    }
+    return ptr;
+}
+
+void *shm_arena::try_allocate(size_t size) noexcept
+{
+    int cls = size_class(size);
+    if (cls >= size_classes)
+    {
+        return nullptr;
+    }
+    size_t bsize = class_size(cls);
+
+    // Pop from free list, the block read may be reused by others meanwhile, but it's
+    // still mapped, and the tag makes the CAS fail
+    std::atomic<uint64_t> &list = free_[cls];
+    uint64_t head = list.load(std::memory_order_acquire);
+    while (head & offset_mask)
+    {
+        char *block = base() + (head & offset_mask) * alignment;
+        uint64_t next = link_of(block)->load(std::memory_order_relaxed) & offset_mask;
+        if (list.compare_exchange_weak(head, next | next_tag(head), std::memory_order_acquire,
+            std::memory_order_acquire))
+        {
+            allocated_.fetch_add(bsize, std::memory_order_relaxed);
+            return block;
+        }
+    }
+
+    uint64_t cursor = cursor_.load(std::memory_order_relaxed);
+    do
+    {
+        if (cursor + bsize > size_)
+        {
+            return nullptr;
+        }
+    } while (!cursor_.compare_exchange_weak(cursor, cursor + bsize, std::memory_order_relaxed));
+    allocated_.fetch_add(bsize, std::memory_order_relaxed);
+    return base() + cursor;
+}
+
+void shm_arena::deallocate(void *ptr, size_t size) noexcept
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    int cls = size_class(size);
+    char *block = static_cast<char *>(ptr);
+    uint64_t off = (block - base()) / alignment;
+    std::atomic<uint64_t> &list = free_[cls];
+    uint64_t head = list.load(std::memory_order_relaxed);
+    do
+    {
+        link_of(block)->store(head & offset_mask, std::memory_order_relaxed);
+    } while (!list.compare_exchange_weak(head, off | next_tag(head), std::memory_order_release,
+        std::memory_order_relaxed));
+    allocated_.fetch_sub(class_size(cls), std::memory_order_relaxed);
+}
+
+void shm_arena::set_root(const void *ptr) noexcept
+{
+    root_.store(ptr == nullptr ? 0 : static_cast<const char *>(ptr) - base(),
+        std::memory_order_release);
+}
+
+
+shm_string::shm_string(shm_arena *arena)
+: arena_(arena), data_(nullptr), size_(0), cap_(0)
+{
+}
+
+shm_string::shm_string(shm_arena *arena, std::string_view str)
+: shm_string(arena)
+{
+    assign(str);
+}
+
+shm_string::shm_string(const shm_string &other)
+: shm_string(other.arena_.get(), std::string_view(other))
+{
+}
+
+shm_string &shm_string::operator=(const shm_string &other)
+{
+    if (&other != this)
+    {
+        assign(other);
+    }
+    return *this;
+}
+
+shm_string::shm_string(shm_string &&other) noexcept
+: arena_(other.arena_), data_(other.data_), size_(other.size_), cap_(other.cap_)
+{
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.cap_ = 0;
+}
+
+shm_string &shm_string::operator=(shm_string &&other)
+{
+    if (&other == this)
+    {
+        return *this;
+    }
+    if (arena_.get() != other.arena_.get())
+    {
+        assign(other);
+        return *this;
+    }
+    offset_ptr<char> data = data_;
+    data_ = other.data_;
+    other.data_ = data;
+    std::swap(size_, other.size_);
+    std::swap(cap_, other.cap_);
+    other.clear();
+    return *this;
+}
+
+shm_string &shm_string::operator=(std::string_view str)
+{
+    assign(str);
+    return *this;
+}
+
+shm_string::~shm_string() noexcept
+{
+    if (cap_)
+    {
+        arena_->deallocate(data_.get(), cap_ + 1);
+    }
+}
+
+void shm_string::assign(std::string_view str)
+{
+    if (str.empty())
+    {
+        clear();
+        return;
+    }
+    // str may be part of this string
+    if (str.size() > cap_)
+    {
+        shm_string tmp(arena_.get());
+        tmp.reserve(str.size());
+        tmp.assign(str);
+        *this = std::move(tmp);
+        return;
+    }
+    memmove(data_.get(), str.data(), str.size());
+    size_ = str.size();
+    data_[size_] = '\0';
+}
+
+void shm_string::append(std::string_view str)
+{
+    if (str.empty())
+    {
+        return;
+    }
+    if (size_ + str.size() > cap_)
+    {
+        shm_string tmp(arena_.get());
+        tmp.reserve(std::max(size_ + str.size(), cap_ * 2));
+        tmp.assign(*this);
+        tmp.append(str);
+        *this = std::move(tmp);
+        return;
+    }
+    memmove(data_.get() + size_, str.data(), str.size());
+    size_ += str.size();
+    data_[size_] = '\0';
+}
+
+void shm_string::push_back(char c)
+{
+    append(std::string_view(&c, 1));
+}
+
+void shm_string::reserve(size_t cap)
+{
+    if (cap <= cap_)
+    {
+        return;
+    }
+    // Use up the block of the size class
+    size_t bsize = shm_arena::block_size(cap + 1);
+    char *data = static_cast<char *>(arena_->allocate(bsize));
+    if (size_)
+    {
+        memcpy(data, data_.get(), size_);
+    }
+    data[size_] = '\0';
+    if (cap_)
+    {
+        arena_->deallocate(data_.get(), cap_ + 1);
+    }
+    data_ = data;
+    cap_ = bsize - 1;
+}
+
+}   // namespace cppev
@@ -0,0 +1,360 @@
+#include <thread>
+#include <cstring>
+#include "cppev/shm_cache.h"
+
+namespace cppev
+{
+
+struct shm_cache::bucket
+{
+    // Odd while a writer holds the bucket
+    std::atomic<uint32_t> seq;
+
+    // Reference bits of ways, set by hits
+    std::atomic<uint32_t> referenced;
+
+    // CLOCK hand of ways, only accessed by writer
+    uint32_t hand;
+
+    // Hash of key in way, 0 means empty
+    std::atomic<uint64_t> hashes[ways];
+
+    // Offset of entry from the cache
+    std::atomic<uint64_t> entries[ways];
+
+    // Size class of entry in arena
+    std::atomic<uint8_t> classes[ways];
+};
+
+namespace
+{
+
+// FNV-1a, which is the same in every process unlike std::hash, 0 is reserved for empty
+uint64_t hash_key(std::string_view key) noexcept
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3;
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+void relax(int &spins) noexcept
+{
+    if (++spins > 64)
+    {
+        std::this_thread::yield();
+    }
+}
+
+}   // namespace
+
+shm_cache *shm_cache::attach(shared_memory &shm, size_t capacity)
+{
+    shm_arena *arena = shm_arena::attach(shm);
+    shm_cache *cache = nullptr;
+    if (shm.creator())
+    {
+        cache = arena->construct<shm_cache>(capacity);
+        arena->set_root(cache);
+    }
+    else
+    {
+        while ((cache = arena->root<shm_cache>()) == nullptr)
+        {
+            std::this_thread::yield();
+        }
+    }
+    if (cache->capacity() != (capacity + ways - 1) / ways * ways)
+    {
+        throw_logic_error("shm cache is formatted differently");
+    }
+    return cache;
+}
+
+shm_cache::shm_cache(shm_arena *arena, size_t capacity)
+: arena_(arena), buckets_(nullptr), bucket_count_((capacity + ways - 1) / ways),
+  hand_(0), size_(0), evictions_(0)
+{
+    if (bucket_count_ == 0)
+    {
+        throw_logic_error("shm cache capacity shall be positive");
+    }
+    for (auto &count : class_entries_)
+    {
+        count.store(0, std::memory_order_relaxed);
+    }
+    bucket *buckets = static_cast<bucket *>(arena_->allocate(bucket_count_ * sizeof(bucket)));
+    memset(static_cast<void *>(buckets), 0, bucket_count_ * sizeof(bucket));
+    buckets_ = buckets;
+}
+
+shm_cache::~shm_cache() noexcept
+{
+    for (size_t i = 0; i < bucket_count_; ++i)
+    {
+        for (int w = 0; w < ways; ++w)
+        {
+            uint64_t off = buckets_[i].entries[w].load(std::memory_order_relaxed);
+            if (off)
+            {
+                free_entry(entry_of(off));
+            }
+        }
+    }
+    arena_->deallocate(buckets_.get(), bucket_count_ * sizeof(bucket));
+}
+
+bool shm_cache::get(std::string_view key, std::string &value)
+{
+    uint64_t hash = hash_key(key);
+    bucket &b = buckets_[hash % bucket_count_];
+    const char *low = reinterpret_cast<const char *>(arena_.get());
+    const char *high = low + arena_->capacity();
+    int spins = 0;
+    while (true)
+    {
+        uint32_t seq = b.seq.load(std::memory_order_acquire);
+        if (seq & 1)
+        {
+            relax(spins);
+            continue;
+        }
+        int found = -1;
+        for (int w = 0; w < ways; ++w)
+        {
+            if (b.hashes[w].load(std::memory_order_relaxed) != hash)
+            {
+                continue;
+            }
+            const entry *e = entry_of(b.entries[w].load(std::memory_order_relaxed));
+            const char *data = reinterpret_cast<const char *>(e + 1);
+            // Entry may be freed and reused, never read beyond the segment
+            if (reinterpret_cast<const char *>(e) < low || data > high ||
+                static_cast<size_t>(high - data) < static_cast<size_t>(e->key_len) + e->value_len)
+            {
+                break;
+            }
+            if (std::string_view(data, e->key_len) == key)
+            {
+                value.assign(data + e->key_len, e->value_len);
+                found = w;
+                break;
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (b.seq.load(std::memory_order_relaxed) != seq)
+        {
+            relax(spins);
+            continue;
+        }
+        if (found < 0)
+        {
+            return false;
+        }
+        uint32_t bit = 1u << found;
+        if (!(b.referenced.load(std::memory_order_relaxed) & bit))
+        {
+            b.referenced.fetch_or(bit, std::memory_order_relaxed);
+        }
+        return true;
+    }
+}
+
+bool shm_cache::put(std::string_view key, std::string_view value)
+{
+    if (key.size() > UINT32_MAX || value.size() > UINT32_MAX)
+    {
+        return false;
+    }
+    size_t need = sizeof(entry) + key.size() + value.size();
+    int cls = shm_arena::size_class(need);
+    if (cls >= shm_arena::size_classes)
+    {
+        return false;
+    }
+    void *mem = arena_->try_allocate(need);
+    // Block freed by evicting other classes cannot be reused, so fail fast
+    for (size_t i = 0; mem == nullptr && i < capacity(); ++i)
+    {
+        if (class_entries_[cls].load(std::memory_order_relaxed) <= 0 || !evict_one(cls))
+        {
+            break;
+        }
+        mem = arena_->try_allocate(need);
+    }
+    if (mem == nullptr)
+    {
+        return false;
+    }
+    entry *e = static_cast<entry *>(mem);
+    e->key_len = key.size();
+    e->value_len = value.size();
+    memcpy(reinterpret_cast<char *>(e + 1), key.data(), key.size());
+    memcpy(reinterpret_cast<char *>(e + 1) + key.size(), value.data(), value.size());
+
+    uint64_t hash = hash_key(key);
+    bucket &b = buckets_[hash % bucket_count_];
+    uint32_t seq = lock_bucket(b);
+    entry *old = nullptr;
+    int way = find_way(b, hash, key);
+    if (way < 0)
+    {
+        for (int w = 0; w < ways; ++w)
+        {
+            if (b.entries[w].load(std::memory_order_relaxed) == 0)
+            {
+                way = w;
+                break;
+            }
+        }
+    }
+    if (way < 0)
+    {
+        // Referenced ways get a second chance
+        while (true)
+        {
+            int w = b.hand++ % ways;
+            uint32_t bit = 1u << w;
+            if (b.referenced.load(std::memory_order_relaxed) & bit)
+            {
+                b.referenced.fetch_and(~bit, std::memory_order_relaxed);
+                continue;
+            }
+            way = w;
+            break;
+        }
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (b.entries[way].load(std::memory_order_relaxed))
+    {
+        old = remove_way(b, way);
+    }
+    b.referenced.fetch_and(~(1u << way), std::memory_order_relaxed);
+    b.hashes[way].store(hash, std::memory_order_relaxed);
+    b.entries[way].store(offset_of(e), std::memory_order_relaxed);
+    b.classes[way].store(cls, std::memory_order_relaxed);
+    class_entries_[cls].fetch_add(1, std::memory_order_relaxed);
+    size_.fetch_add(1, std::memory_order_relaxed);
+    unlock_bucket(b, seq);
+
+    if (old != nullptr)
+    {
+        free_entry(old);
+    }
+    return true;
+}
+
+bool shm_cache::erase(std::string_view key)
+{
+    uint64_t hash = hash_key(key);
+    bucket &b = buckets_[hash % bucket_count_];
+    uint32_t seq = lock_bucket(b);
+    int way = find_way(b, hash, key);
+    entry *old = way < 0 ? nullptr : remove_way(b, way);
+    unlock_bucket(b, seq);
+    if (old != nullptr)
+    {
+        free_entry(old);
+    }
+    return old != nullptr;
+}
+
+shm_cache_stats shm_cache::stats() const noexcept
+{
+    return shm_cache_stats{ size_.load(std::memory_order_relaxed),
+        evictions_.load(std::memory_order_relaxed), static_cast<int64_t>(arena_->allocated()) };
+}
+
+uint32_t shm_cache::lock_bucket(bucket &b) noexcept
+{
+    int spins = 0;
+    uint32_t seq = b.seq.load(std::memory_order_relaxed);
+    while ((seq & 1) || !b.seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire,
+        std::memory_order_relaxed))
+    {
+        relax(spins);
+        seq = b.seq.load(std::memory_order_relaxed);
+    }
+    // Readers that see the writes also see the odd sequence
+    std::atomic_thread_fence(std::memory_order_release);
+    return seq + 1;
+}
+
+void shm_cache::unlock_bucket(bucket &b, uint32_t seq) noexcept
+{
+    b.seq.store(seq + 1, std::memory_order_release);
+}
+
+shm_cache::entry *shm_cache::remove_way(bucket &b, int way) noexcept
+{
+    entry *e = entry_of(b.entries[way].load(std::memory_order_relaxed));
+    b.hashes[way].store(0, std::memory_order_relaxed);
+    b.entries[way].store(0, std::memory_order_relaxed);
+    class_entries_[b.classes[way].load(std::memory_order_relaxed)].fetch_sub(1, std::memory_order_relaxed);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return e;
+}
+
+int shm_cache::find_way(bucket &b, uint64_t hash, std::string_view key) noexcept
+{
+    for (int w = 0; w < ways; ++w)
+    {
+        if (b.hashes[w].load(std::memory_order_relaxed) == hash)
+        {
+            entry *e = entry_of(b.entries[w].load(std::memory_order_relaxed));
+            if (std::string_view(reinterpret_cast<char *>(e + 1), e->key_len) == key)
+            {
+                return w;
+            }
+        }
+    }
+    return -1;
+}
+
+bool shm_cache::evict_one(int cls) noexcept
+{
+    // Two rounds clear all reference bits at most, only ways of the class are considered
+    for (size_t i = 0; i < capacity() * 2; ++i)
+    {
+        uint64_t idx = hand_.fetch_add(1, std::memory_order_relaxed) % capacity();
+        bucket &b = buckets_[idx / ways];
+        int way = idx % ways;
+        uint32_t bit = 1u << way;
+        if (b.entries[way].load(std::memory_order_relaxed) == 0 ||
+            b.classes[way].load(std::memory_order_relaxed) != cls)
+        {
+            continue;
+        }
+        if (b.referenced.load(std::memory_order_relaxed) & bit)
+        {
+            b.referenced.fetch_and(~bit, std::memory_order_relaxed);
+            continue;
+        }
+        uint32_t seq = lock_bucket(b);
+        entry *old = nullptr;
+        if (b.entries[way].load(std::memory_order_relaxed) &&
+            b.classes[way].load(std::memory_order_relaxed) == cls &&
+            !(b.referenced.load(std::memory_order_relaxed) & bit))
+        {
+            old = remove_way(b, way);
+        }
+        unlock_bucket(b, seq);
+        if (old != nullptr)
+        {
+            free_entry(old);
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void shm_cache::free_entry(entry *e) noexcept
+{
+    arena_->deallocate(e, sizeof(entry) + e->key_len + e->value_len);
+}
+
+}   // namespace cppev
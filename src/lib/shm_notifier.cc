@@ -0,0 +1,115 @@
+#include "cppev/shm_notifier.h"
+
+#ifdef __linux__
+
+#include <atomic>
+#include <thread>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+namespace cppev
+{
+
+struct shm_notifier::control
+{
+    static constexpr uint64_t ready_magic = 0x7966697465766570;
+
+    // Set by creator when formatted
+    std::atomic<uint64_t> magic;
+
+    // 1 if consumer waits for eventfd
+    alignas(64) std::atomic<uint32_t> armed;
+
+    std::atomic<uint64_t> wakeups;
+};
+
+shm_notifier::shm_notifier(shared_memory &shm, int fd)
+{
+    if (shm.size() < required_size())
+    {
+        throw_logic_error("shared memory is too small for notifier");
+    }
+    if (fd < 0)
+    {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0)
+        {
+            throw_system_error("eventfd error");
+        }
+    }
+    ev_ = std::make_shared<nio>(fd);
+
+    if (shm.creator())
+    {
+        ctl_ = shm.construct<control>();
+        ctl_->armed.store(1, std::memory_order_relaxed);
+        ctl_->wakeups.store(0, std::memory_order_relaxed);
+        ctl_->magic.store(control::ready_magic, std::memory_order_release);
+    }
+    else
+    {
+        ctl_ = static_cast<control *>(shm.ptr());
+        while (ctl_->magic.load(std::memory_order_acquire) != control::ready_magic)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+size_t shm_notifier::required_size() noexcept
+{
+    return sizeof(control);
+}
+
+uint64_t shm_notifier::wakeups() const noexcept
+{
+    return ctl_->wakeups.load(std::memory_order_relaxed);
+}
+
+void shm_notifier::notify()
+{
+    // Pairs with the fence in rearm, data published before is visible to the drain
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ctl_->armed.load(std::memory_order_relaxed) == 0 ||
+        ctl_->armed.exchange(0, std::memory_order_acq_rel) == 0)
+    {
+        return;
+    }
+    ctl_->wakeups.fetch_add(1, std::memory_order_relaxed);
+    uint64_t one = 1;
+    while (write(ev_->fd(), &one, sizeof(one)) != sizeof(one))
+    {
+        if (errno != EINTR)
+        {
+            throw_system_error("eventfd write error");
+        }
+    }
+}
+
+bool shm_notifier::rearm()
+{
+    uint64_t count = 0;
+    bool written = true;
+    while (read(ev_->fd(), &count, sizeof(count)) != sizeof(count))
+    {
+        if (errno == EAGAIN)
+        {
+            written = false;
+            break;
+        }
+        if (errno != EINTR)
+        {
+            throw_system_error("eventfd read error");
+        }
+    }
+    ctl_->armed.store(1, std::memory_order_relaxed);
+    // Pairs with the fence in notify, data published after is either seen by the drain or
+    // notified again
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return written;
+}
+
+}   // namespace cppev
+
+#endif  // __linux__
@@ -0,0 +1,342 @@
+#include <atomic>
+#include <thread>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include "cppev/utils.h"
+#include "cppev/lock.h"
+#include "cppev/shm_ring.h"
+
+namespace cppev
+{
+
+struct shm_ring::control
+{
+    static constexpr uint64_t ready_magic = 0x676e697276657070;
+
+    // Set by creator when formatted
+    std::atomic<uint64_t> magic;
+
+    uint64_t capacity;
+
+    uint32_t mode;
+
+    // Released by consumer
+    alignas(64) std::atomic<uint64_t> head;
+
+    // Committed by producers
+    alignas(64) std::atomic<uint64_t> tail;
+
+    // Claimed by producers, only used by mpsc
+    alignas(64) std::atomic<uint64_t> reserved;
+
+    // Futex word and waiter count of consumer waiting for records
+    alignas(64) std::atomic<uint32_t> data_seq;
+
+    std::atomic<uint32_t> consumer_waiting;
+
+    // Futex word and waiter count of producers waiting for space
+    alignas(64) std::atomic<uint32_t> space_seq;
+
+    std::atomic<uint32_t> producers_waiting;
+};
+
+namespace
+{
+
+struct record_header
+{
+    // Payload length, padding_marker means the record is only for skipping
+    uint32_t len;
+
+    // Bytes from the header to the next record
+    uint32_t span;
+};
+
+constexpr uint32_t padding_marker = UINT32_MAX;
+
+// Futex on linux, polling on other platforms
+void wait_word(std::atomic<uint32_t> &word, uint32_t value, std::chrono::nanoseconds timeout)
+{
+#ifdef __linux__
+    futex_wait(word, value, timeout);
+#else
+    if (word.load(std::memory_order_acquire) == value)
+    {
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+            timeout.count() >= 0 ? timeout : std::chrono::microseconds(50),
+            std::chrono::microseconds(50)));
+    }
+#endif  // __linux__
+}
+
+void wake_word(std::atomic<uint32_t> &word, int count)
+{
+#ifdef __linux__
+    futex_wake(word, count);
+#else
+    (void)word;
+    (void)count;
+#endif  // __linux__
+}
+
+// Remaining time to deadline, negative timeout means forever
+std::chrono::nanoseconds remaining(std::chrono::nanoseconds timeout,
+    std::chrono::steady_clock::time_point deadline)
+{
+    if (timeout.count() < 0)
+    {
+        return timeout;
+    }
+    return std::max(std::chrono::nanoseconds(0), std::chrono::duration_cast<std::chrono::nanoseconds>(
+        deadline - std::chrono::steady_clock::now()));
+}
+
+}   // namespace
+
+shm_ring::shm_ring(shared_memory &shm, shm_ring_mode mode)
+: mode_(mode)
+{
+    if (shm.size() < required_size(64))
+    {
+        throw_logic_error("shared memory is too small for ring");
+    }
+    size_t avail = shm.size() - sizeof(control);
+    cap_ = 1;
+    while (cap_ * 2 <= avail)
+    {
+        cap_ *= 2;
+    }
+    mask_ = cap_ - 1;
+    data_ = static_cast<char *>(shm.ptr()) + sizeof(control);
+
+    if (shm.creator())
+    {
+        ctl_ = shm.construct<control>();
+        ctl_->capacity = cap_;
+        ctl_->mode = static_cast<uint32_t>(mode_);
+        ctl_->magic.store(control::ready_magic, std::memory_order_release);
+    }
+    else
+    {
+        ctl_ = static_cast<control *>(shm.ptr());
+        while (ctl_->magic.load(std::memory_order_acquire) != control::ready_magic)
+        {
+            std::this_thread::yield();
+        }
+    }
+    if (ctl_->capacity != cap_ || ctl_->mode != static_cast<uint32_t>(mode_))
+    {
+        throw_logic_error("shm ring is formatted differently");
+    }
+}
+
+size_t shm_ring::required_size(size_t capacity) noexcept
+{
+    return sizeof(control) + capacity;
+}
+
+size_t shm_ring::size() const noexcept
+{
+    return ctl_->tail.load(std::memory_order_acquire) - ctl_->head.load(std::memory_order_acquire);
+}
+
+bool shm_ring::fits(uint64_t pos, size_t need, uint64_t head, uint64_t &end) const noexcept
+{
+    size_t off = pos & mask_;
+    end = pos + need + (off + need > cap_ ? cap_ - off : 0);
+    return end - head <= cap_;
+}
+
+shm_ring::slot shm_ring::place(uint64_t pos, size_t len) noexcept
+{
+    size_t need = header_size + aligned(len);
+    slot s;
+    s.begin = pos;
+    size_t off = pos & mask_;
+    if (off + need > cap_)
+    {
+        record_header *pad = reinterpret_cast<record_header *>(data_ + off);
+        pad->len = padding_marker;
+        pad->span = cap_ - off;
+        pos += cap_ - off;
+        off = 0;
+    }
+    record_header *h = reinterpret_cast<record_header *>(data_ + off);
+    h->len = len;
+    h->span = need;
+    s.data = data_ + off + header_size;
+    s.size = len;
+    s.end = pos + need;
+    return s;
+}
+
+shm_ring::slot shm_ring::try_reserve(size_t len)
+{
+    if (len > max_record())
+    {
+        throw_logic_error("record is too large for shm ring");
+    }
+    size_t need = header_size + aligned(len);
+    uint64_t end;
+    if (mode_ == shm_ring_mode::spsc)
+    {
+        uint64_t pos = ctl_->tail.load(std::memory_order_relaxed);
+        if (!fits(pos, need, ctl_->head.load(std::memory_order_acquire), end))
+        {
+            return slot{ nullptr, 0, 0, 0 };
+        }
+        return place(pos, len);
+    }
+    uint64_t pos = ctl_->reserved.load(std::memory_order_relaxed);
+    do
+    {
+        if (!fits(pos, need, ctl_->head.load(std::memory_order_acquire), end))
+        {
+            return slot{ nullptr, 0, 0, 0 };
+        }
+    } while (!ctl_->reserved.compare_exchange_weak(pos, end, std::memory_order_relaxed));
+    return place(pos, len);
+}
+
+shm_ring::slot shm_ring::reserve(size_t len, std::chrono::nanoseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        slot s = try_reserve(len);
+        if (s.data)
+        {
+            return s;
+        }
+        ctl_->producers_waiting.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint32_t seq = ctl_->space_seq.load(std::memory_order_acquire);
+        s = try_reserve(len);
+        if (!s.data)
+        {
+            auto left = remaining(timeout, deadline);
+            if (left.count() != 0)
+            {
+                wait_word(ctl_->space_seq, seq, left);
+            }
+        }
+        ctl_->producers_waiting.fetch_sub(1);
+        if (s.data || remaining(timeout, deadline).count() == 0)
+        {
+            return s;
+        }
+    }
+}
+
+void shm_ring::commit(const slot &s, size_t len)
+{
+    if (len > s.size)
+    {
+        throw_logic_error("commit more than reserved");
+    }
+    reinterpret_cast<record_header *>(s.data - header_size)->len = len;
+    if (mode_ == shm_ring_mode::mpsc)
+    {
+        // Commit in the order of reservation
+        int spins = 0;
+        while (ctl_->tail.load(std::memory_order_acquire) != s.begin)
+        {
+            if (++spins > 64)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+    ctl_->tail.store(s.end, std::memory_order_release);
+    wake_consumer();
+}
+
+bool shm_ring::try_push(const void *data, size_t len)
+{
+    slot s = try_reserve(len);
+    if (!s.data)
+    {
+        return false;
+    }
+    memcpy(s.data, data, len);
+    commit(s);
+    return true;
+}
+
+shm_ring::slot shm_ring::try_peek()
+{
+    uint64_t head = ctl_->head.load(std::memory_order_relaxed);
+    uint64_t tail = ctl_->tail.load(std::memory_order_acquire);
+    while (head != tail)
+    {
+        record_header *h = reinterpret_cast<record_header *>(data_ + (head & mask_));
+        if (h->len != padding_marker)
+        {
+            return slot{ data_ + (head & mask_) + header_size, h->len, head, head + h->span };
+        }
+        head += h->span;
+        ctl_->head.store(head, std::memory_order_release);
+        wake_producers();
+    }
+    return slot{ nullptr, 0, 0, 0 };
+}
+
+shm_ring::slot shm_ring::peek(std::chrono::nanoseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        slot s = try_peek();
+        if (s.data)
+        {
+            return s;
+        }
+        ctl_->consumer_waiting.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint32_t seq = ctl_->data_seq.load(std::memory_order_acquire);
+        s = try_peek();
+        if (!s.data)
+        {
+            auto left = remaining(timeout, deadline);
+            if (left.count() != 0)
+            {
+                wait_word(ctl_->data_seq, seq, left);
+            }
+        }
+        ctl_->consumer_waiting.fetch_sub(1);
+        if (s.data || remaining(timeout, deadline).count() == 0)
+        {
+            return s;
+        }
+    }
+}
+
+void shm_ring::release(const slot &s)
+{
+    ctl_->head.store(s.end, std::memory_order_release);
+    wake_producers();
+}
+
+void shm_ring::wake_consumer() noexcept
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ctl_->consumer_waiting.load(std::memory_order_relaxed))
+    {
+        ctl_->data_seq.fetch_add(1, std::memory_order_release);
+        wake_word(ctl_->data_seq, 1);
+    }
+}
+
+void shm_ring::wake_producers() noexcept
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ctl_->producers_waiting.load(std::memory_order_relaxed))
+    {
+        ctl_->space_seq.fetch_add(1, std::memory_order_release);
+        wake_word(ctl_->space_seq, INT_MAX);
+    }
+}
+
+}   // namespace cppev
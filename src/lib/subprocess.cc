@@ -4,9 +4,13 @@
 #include <map>
 #include <set>
 #include <sys/wait.h>
+#include <spawn.h>
 #include <unistd.h>
 #include <signal.h>
 #include <thread>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif  // __linux__
 
 #ifdef __APPLE__
 extern char **environ;
@@ -18,26 +22,146 @@ namespace cppev
 namespace subprocess
 {
 
-std::tuple<int, std::string, std::string> exec_cmd(const std::string &cmd, const std::vector<std::string> &env)
+std::tuple<int, std::string, std::string> exec_cmd(const std::string &cmd, const std::vector<std::string> &env,
+    subp_launch launch)
 {
-    subp_open subp(cmd, env);
+    subp_open subp(cmd, env, launch);
     subp.wait();
     return std::make_tuple(subp.returncode(), subp.stdout(), subp.stderr());
 }
 
 }   // namespace subprocess
 
-subp_open::subp_open(const std::string &cmd, const std::vector<std::string> &env)
+namespace
+{
+
+// Launch subprocess with pipe ends as its stdin, stdout and stderr
+// @param closes : fds of parent closed in subprocess
+pid_t launch_process(const std::string &cmd, const std::vector<std::string> &env, subp_launch launch,
+    int zero, int one, int two, const std::vector<int> &closes)
+{
+    // Prepared before fork, since the child of multi-threaded process shall not allocate
+    std::vector<std::string> cmd_with_args = split(cmd, " ");
+    std::string cmd_with_path = cmd_with_args[0];
+    cmd_with_args[0] = split(cmd_with_args[0], "/").back();
+
+    std::vector<char *> argv(cmd_with_args.size() + 1, nullptr);
+    for (size_t i = 0; i < cmd_with_args.size(); ++i)
+    {
+        argv[i] = const_cast<char *>(cmd_with_args[i].c_str());
+    }
+
+    std::vector<char *> envp(env.size() + 1, nullptr);
+    for (size_t i = 0; i < env.size(); ++i)
+    {
+        envp[i] = const_cast<char *>(env[i].c_str());
+    }
+
+    if (launch == subp_launch::spawn)
+    {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, zero, STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, one, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, two, STDERR_FILENO);
+        for (int fd : { zero, one, two })
+        {
+            if (fd > STDERR_FILENO)
+            {
+                posix_spawn_file_actions_addclose(&actions, fd);
+            }
+        }
+        for (int fd : closes)
+        {
+            posix_spawn_file_actions_addclose(&actions, fd);
+        }
+        pid_t pid;
+        int ret;
+        if (cmd_with_path.find('/') == std::string::npos)
+        {
+            ret = posix_spawnp(&pid, cmd_with_path.c_str(), &actions, nullptr, argv.data(), envp.data());
+        }
+        else
+        {
+            ret = posix_spawn(&pid, cmd_with_path.c_str(), &actions, nullptr, argv.data(), envp.data());
+        }
+        posix_spawn_file_actions_destroy(&actions);
+        if (ret != 0)
+        {
+            throw_system_error(std::string("posix_spawn error for ").append(cmd_with_path), ret);
+        }
+        return pid;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+        _exit(-1);
+    }
+
+    if (pid == 0)
+    {
+        dup2(zero, STDIN_FILENO);
+        dup2(one, STDOUT_FILENO);
+        dup2(two, STDERR_FILENO);
+        for (int fd : closes)
+        {
+            close(fd);
+        }
+
+        environ = envp.data();
+
+        execvp(cmd_with_path.c_str(), argv.data());
+        _exit(127);
+    }
+
+    return pid;
+}
+
+// Write to stdin of subprocess, SIGPIPE raised by the exited subprocess is blocked and
+// consumed in the calling thread, so disposition of the process is left as it is
+void write_stdin(nstream &iopt)
+{
+    sigset_t pipe_set;
+    sigset_t old_set;
+    sigset_t pending;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE);
+
+    iopt.write_all();
+
+    if (iopt.eop() && !was_pending)
+    {
+        sigpending(&pending);
+        int sig;
+        if (sigismember(&pending, SIGPIPE))
+        {
+            sigwait(&pipe_set, &sig);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+}
+
+}   // namespace
+
+subp_open::subp_open(const std::string &cmd, const std::vector<std::string> &env, subp_launch launch)
 : cmd_(cmd), env_(env)
 {
     int fds[2];
     int zero, one, two;
+    // Pipe ends of subprocess
+    std::vector<int> child_fds;
 
     if (pipe(fds) < 0)
     {
         throw_system_error("pipe error");
     }
     zero = fds[0];
+    child_fds.push_back(zero);
     stdin_ = std::make_unique<nstream>(fds[1]);
 
     if (pipe(fds) < 0)
@@ -45,6 +169,7 @@ subp_open::subp_open(const std::string &cmd, const std::vector<std::string> &env
         throw_system_error("pipe error");
     }
     one = fds[1];
+    child_fds.push_back(one);
     stdout_ = std::make_unique<nstream>(fds[0]);
 
     if (pipe(fds) < 0)
@@ -52,45 +177,27 @@ subp_open::subp_open(const std::string &cmd, const std::vector<std::string> &env
         throw_system_error("pipe error");
     }
     two = fds[1];
+    child_fds.push_back(two);
     stderr_ = std::make_unique<nstream>(fds[0]);
 
-    pid_t pid = fork();
-
-    if (pid == -1)
+    try
     {
-        _exit(-1);
+        pid_ = launch_process(cmd_, env_, launch, zero, one, two,
+            { stdin_->fd(), stdout_->fd(), stderr_->fd() });
     }
-
-    if (pid == 0)
+    catch (const std::system_error &)
     {
-        dup2(zero, STDIN_FILENO);
-        dup2(one, STDOUT_FILENO);
-        dup2(two, STDERR_FILENO);
-
-        std::vector<std::string> cmd_with_args = split(cmd_, " ");
-        std::string cmd_with_path = cmd_with_args[0];
-        cmd_with_args[0] = split(cmd_with_args[0], "/").back();
-
-        char *argv[cmd_with_args.size()+1];
-        memset(argv, 0, sizeof(argv));
-        for (size_t i = 0; i < cmd_with_args.size(); ++i)
-        {
-            argv[i] = const_cast<char *>(cmd_with_args[i].c_str());
-        }
-
-        char *envp[env_.size()+1];
-        memset(envp, 0, sizeof(envp));
-        for (size_t i = 0; i < env_.size(); ++i)
+        for (int fd : child_fds)
         {
-            envp[i] = const_cast<char *>(env_[i].c_str());
+            close(fd);
         }
-        environ = envp;
-
-        execvp(cmd_with_path.c_str(), argv);
-        _exit(127);
+        throw;
+    }
+    // Not needed by this process once inherited
+    for (int fd : child_fds)
+    {
+        close(fd);
     }
-
-    pid_ = pid;
 }
 
 bool subp_open::poll()
@@ -116,7 +223,7 @@ void subp_open::communicate(const char *input, int len)
     if (input != nullptr && len != 0)
     {
         stdin_->wbuffer().produce(input, len);
-        stdin_->write_all();
+        write_stdin(*stdin_);
     }
 }
 
@@ -168,4 +275,280 @@ pid_t subp_open::pid() const noexcept
     return pid_;
 }
 
+#ifdef __linux__
+
+subp_async::subp_async(const std::string &cmd, const std::vector<std::string> &env, subp_launch launch, int step)
+: cmd_(cmd), env_(env), launch_(launch), step_(step), evlp_(nullptr), stdin_writing_(false),
+    stdin_closing_(false), exited_(false), detached_(false), pid_(0), returncode_(0)
+{
+    int fds[2];
+
+    if (pipe(fds) < 0)
+    {
+        throw_system_error("pipe error");
+    }
+    child_fds_.push_back(fds[0]);
+    stdin_ = std::make_shared<nstream>(fds[1]);
+
+    if (pipe(fds) < 0)
+    {
+        throw_system_error("pipe error");
+    }
+    child_fds_.push_back(fds[1]);
+    stdout_ = std::make_shared<nstream>(fds[0]);
+
+    if (pipe(fds) < 0)
+    {
+        throw_system_error("pipe error");
+    }
+    child_fds_.push_back(fds[1]);
+    stderr_ = std::make_shared<nstream>(fds[0]);
+}
+
+subp_async::~subp_async() noexcept
+{
+    for (int fd : child_fds_)
+    {
+        close(fd);
+    }
+    if (evlp_ == nullptr)
+    {
+        return;
+    }
+    try
+    {
+        if (stdin_writing_)
+        {
+            evlp_->fd_remove(stdin_);
+        }
+        for (auto &iop : { std::static_pointer_cast<nio>(stdout_), std::static_pointer_cast<nio>(stderr_),
+            pidfd_ })
+        {
+            if (iop && !iop->is_closed())
+            {
+                evlp_->fd_remove(iop);
+            }
+        }
+    }
+    catch (const std::system_error &)
+    {
+    }
+    if (!exited_ && !detached_ && pidfd_ && !pidfd_->is_closed())
+    {
+        syscall(SYS_pidfd_send_signal, pidfd_->fd(), SIGKILL, nullptr, 0);
+        while (waitpid(pid_, &returncode_, 0) < 0 && errno == EINTR)
+        {
+        }
+    }
+}
+
+void subp_async::run(event_loop &evlp)
+{
+    if (evlp_ != nullptr)
+    {
+        throw_logic_error("subprocess is already running");
+    }
+    pid_ = launch_process(cmd_, env_, launch_, child_fds_[0], child_fds_[1], child_fds_[2],
+        { stdin_->fd(), stdout_->fd(), stderr_->fd() });
+    // Closed so that eof is seen when subprocess exits
+    for (int fd : child_fds_)
+    {
+        close(fd);
+    }
+    child_fds_.clear();
+
+    int fd = syscall(SYS_pidfd_open, pid_, 0);
+    if (fd < 0)
+    {
+        int err = errno;
+        ::kill(pid_, SIGKILL);
+        waitpid(pid_, nullptr, 0);
+        throw_system_error("pidfd_open error", err);
+    }
+    pidfd_ = std::make_shared<nio>(fd);
+
+    evlp_ = &evlp;
+    evlp_->fd_register(stdout_, fd_event::fd_readable,
+        [this](const std::shared_ptr<nio> &)
+        {
+            on_output(stdout_, on_stdout_, false);
+        }
+    );
+    evlp_->fd_register(stderr_, fd_event::fd_readable,
+        [this](const std::shared_ptr<nio> &)
+        {
+            on_output(stderr_, on_stderr_, false);
+        }
+    );
+    evlp_->fd_register(pidfd_, fd_event::fd_readable,
+        [this](const std::shared_ptr<nio> &)
+        {
+            on_exit();
+        }
+    );
+    flush_stdin();
+}
+
+void subp_async::communicate(const char *input, int len)
+{
+    if (stdin_->is_closed() || stdin_closing_)
+    {
+        throw_logic_error("stdin of subprocess is closed");
+    }
+    stdin_->wbuffer().produce(input, len);
+    if (evlp_ != nullptr)
+    {
+        flush_stdin();
+    }
+}
+
+void subp_async::communicate(const std::string &input)
+{
+    communicate(input.c_str(), input.size());
+}
+
+void subp_async::close_stdin()
+{
+    stdin_closing_ = true;
+    if (evlp_ != nullptr)
+    {
+        flush_stdin();
+    }
+}
+
+void subp_async::flush_stdin()
+{
+    if (stdin_->is_closed())
+    {
+        return;
+    }
+    if (stdin_->wbuffer().size())
+    {
+        write_stdin(*stdin_);
+        if (stdin_->eop())
+        {
+            // Subprocess closed its stdin, data is discarded
+            stdin_->wbuffer().clear();
+        }
+    }
+    if (stdin_->wbuffer().size())
+    {
+        if (!stdin_writing_)
+        {
+            evlp_->fd_register(stdin_, fd_event::fd_writable,
+                [this](const std::shared_ptr<nio> &)
+                {
+                    on_input();
+                }
+            );
+            stdin_writing_ = true;
+        }
+        return;
+    }
+    if (stdin_writing_)
+    {
+        evlp_->fd_remove(stdin_);
+        stdin_writing_ = false;
+    }
+    if (stdin_closing_)
+    {
+        stdin_->close();
+    }
+}
+
+void subp_async::on_input()
+{
+    flush_stdin();
+}
+
+void subp_async::on_output(const std::shared_ptr<nstream> &iopt, const subp_output_handler &handler, bool drain)
+{
+    if (iopt->is_closed())
+    {
+        return;
+    }
+    int len;
+    do
+    {
+        len = iopt->read_chunk(step_);
+        if (len > 0)
+        {
+            if (handler)
+            {
+                handler(iopt->rbuffer().rawbuf(), iopt->rbuffer().size());
+            }
+            iopt->rbuffer().clear();
+        }
+    } while (drain && len == step_);
+    if (iopt->eof())
+    {
+        evlp_->fd_remove(iopt);
+        iopt->close();
+    }
+}
+
+void subp_async::on_exit()
+{
+    int ret = waitpid(pid_, &returncode_, WNOHANG);
+    if (ret == 0)
+    {
+        return;
+    }
+    if (ret < 0)
+    {
+        throw_system_error("waitpid error");
+    }
+    exited_ = true;
+    evlp_->fd_remove(pidfd_);
+    pidfd_->close();
+
+    // Output written before exit is passed first, pipes may be kept open by descendants
+    on_output(stdout_, on_stdout_, true);
+    on_output(stderr_, on_stderr_, true);
+    if (on_exit_)
+    {
+        on_exit_(returncode_);
+    }
+}
+
+void subp_async::send_signal(int sig) const
+{
+    if (pidfd_ == nullptr || pidfd_->is_closed())
+    {
+        throw_logic_error("subprocess is not running");
+    }
+    // Pidfd is always the same process, while pid may be reused after reaped
+    if (syscall(SYS_pidfd_send_signal, pidfd_->fd(), sig, nullptr, 0) < 0)
+    {
+        throw_system_error("pidfd_send_signal error");
+    }
+}
+
+void subp_async::terminate() const
+{
+    send_signal(SIGTERM);
+}
+
+void subp_async::kill() const
+{
+    send_signal(SIGKILL);
+}
+
+bool subp_async::exited() const noexcept
+{
+    return exited_;
+}
+
+int subp_async::returncode() const noexcept
+{
+    return returncode_;
+}
+
+pid_t subp_async::pid() const noexcept
+{
+    return pid_;
+}
+
+#endif  // __linux__
+
 }   // namespace cppev
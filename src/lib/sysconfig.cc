@@ -19,6 +19,9 @@ int buffer_outdate = 30;
 // batch size for IO
 int buffer_io_step = 1024;
 
+// per-thread ring size of logger in bytes, power of 2
+int log_ring_size = 1 << 18;
+
 }   // namespace sysconfig
 
 }   // namespace cppev
@@ -1,3 +1,6 @@
+#include <cstring>
+#include <mutex>
+#include <condition_variable>
 #include "cppev/tcp.h"
 
 namespace cppev
@@ -6,6 +9,21 @@ namespace cppev
 namespace reactor
 {
 
+namespace
+{
+
+// Precedes the carried data of migrated connection in channel, fd is attached to it
+struct migration_header
+{
+    int32_t sockfamily;
+
+    int32_t rbuffer_size;
+
+    int32_t wbuffer_size;
+};
+
+}   // namespace
+
 event_loop *tp_shared_data::random_get_evlp()
 {
     std::random_device rd;
@@ -60,6 +78,67 @@ void *external_data(const std::shared_ptr<nsocktcp> &iopt)
     return (reinterpret_cast<tp_shared_data *>(iopt->evlp().data()))->external_data();
 }
 
+bool migrate(const std::shared_ptr<nsocktcp> &iopt, const std::string &path)
+{
+    if (iopt->eof() || iopt->eop() || iopt->is_reset())
+    {
+        return false;
+    }
+    // Channels are reused by the thread, and reconnected once if the peer restarted
+    thread_local std::unordered_map<std::string, std::shared_ptr<nsocktcp>> channels;
+    for (int i = 0; i < 2; ++i)
+    {
+        std::shared_ptr<nsocktcp> &chan = channels[path];
+        if (chan == nullptr)
+        {
+            chan = nio_factory::get_nsocktcp(family::local);
+            chan->set_io_block();
+            if (!chan->connect_unix(path))
+            {
+                CPPEV_ERROR << "connect " << path << " failed for migration with errno "
+                    << errno << log::endl;
+                channels.erase(path);
+                return false;
+            }
+        }
+        migration_header h{ static_cast<int32_t>(iopt->sockfamily()), iopt->rbuffer().size(),
+            iopt->wbuffer().size() };
+        chan->wbuffer().produce(reinterpret_cast<const char *>(&h), sizeof(h));
+        chan->wbuffer().produce(iopt->rbuffer().rawbuf(), iopt->rbuffer().size());
+        chan->wbuffer().produce(iopt->wbuffer().rawbuf(), iopt->wbuffer().size());
+        int sent = chan->send_fd(iopt->fd());
+        if (sent > 0)
+        {
+            chan->write_all();
+        }
+        if (0 == chan->wbuffer().size())
+        {
+            CPPEV_INFO << "fd " << iopt->fd() << " migrated to " << path << log::endl;
+            // The connection stays open in the other process, so fd shall be deactivated
+            // before closed, it's already deactivated if called by on_write_complete
+            std::shared_ptr<nio> iop = std::static_pointer_cast<nio>(iopt);
+            try
+            {
+                iopt->evlp().fd_remove(iop, true, true);
+            }
+            catch (const std::system_error &)
+            {
+                iopt->evlp().fd_remove(iop, true, false);
+            }
+            iopt->close();
+            return true;
+        }
+        channels.erase(path);
+        if (sent > 0)
+        {
+            // Partial data is discarded by the peer
+            break;
+        }
+    }
+    CPPEV_ERROR << "fd " << iopt->fd() << " failed to migrate to " << path << log::endl;
+    return false;
+}
+
 const tcp_event_handler tp_shared_data::idle_handler = [](const std::shared_ptr<nsocktcp> &) -> void {};
 
 
@@ -119,6 +198,16 @@ void iohandler::on_acpt_writable(const std::shared_ptr<nio> &iop)
     iopt->evlp().fd_register(iop, fd_event::fd_writable, iohandler::on_writable, false);
     dp->on_accept(iopt);
     iopt->evlp().fd_register(iop, fd_event::fd_readable, iohandler::on_readable, true);
+    // Data carried by migrated connection
+    if (!iopt->is_closed() && iopt->wbuffer().size())
+    {
+        async_write(iopt);
+    }
+    if (!iopt->is_closed() && iopt->rbuffer().size())
+    {
+        dp->on_read_complete(iopt);
+        iopt->rbuffer().clear();
+    }
 }
 
 void iohandler::on_cont_writable(const std::shared_ptr<nio> &iop)
@@ -135,7 +224,7 @@ void iohandler::on_cont_writable(const std::shared_ptr<nio> &iop)
     if (!iopt->check_connect())
     {
         std::tuple<std::string, int, family> h = iopt->connpeer();
-        log::error << "connect " << std::get<0>(h) << " " << std::get<1>(h)
+        CPPEV_ERROR << "connect " << std::get<0>(h) << " " << std::get<1>(h)
             << " failed when checking writable" << log::endl;
         pseudo_this->failures_[h] += 1;
         return;
@@ -163,7 +252,7 @@ void acceptor::listen(int port, family f, const char *ip)
     sock_ = nio_factory::get_nsocktcp(f);
     sock_->bind(ip, port);
     sock_->listen();
-    log::info << "fd " << sock_->fd() << " listening in port " << port << log::endl;
+    CPPEV_INFO << "fd " << sock_->fd() << " listening in port " << port << log::endl;
 }
 
 void acceptor::listen_unix(const std::string &path, bool remove)
@@ -171,7 +260,19 @@ void acceptor::listen_unix(const std::string &path, bool remove)
     sock_ = nio_factory::get_nsocktcp(family::local);
     sock_->bind_unix(path, remove);
     sock_->listen();
-    log::info << "fd " << sock_->fd() << " listening in path " << path << log::endl;
+    CPPEV_INFO << "fd " << sock_->fd() << " listening in path " << path << log::endl;
+}
+
+void acceptor::listen(const std::shared_ptr<nsocktcp> &sock)
+{
+    sock_ = sock;
+    CPPEV_INFO << "fd " << sock_->fd() << " listening by shared socket" << log::endl;
+}
+
+void acceptor::listen_migration(const std::string &path, bool remove)
+{
+    listen_unix(path, remove);
+    migration_ = true;
 }
 
 void acceptor::on_acpt_readable(const std::shared_ptr<nio> &iop)
@@ -186,16 +287,85 @@ void acceptor::on_acpt_readable(const std::shared_ptr<nio> &iop)
 
     for (auto &conn : conns)
     {
-        log::info << "new fd " << conn->fd() << " accepted by listening socket " << iopt->fd() << log::endl;
+        CPPEV_INFO << "new fd " << conn->fd() << " accepted by listening socket " << iopt->fd() << log::endl;
+        dp->minloads_get_evlp()->fd_register(std::static_pointer_cast<nio>(conn),
+            fd_event::fd_writable, iohandler::on_acpt_writable, true);
+    }
+}
+
+void acceptor::on_migr_acpt_readable(const std::shared_ptr<nio> &iop)
+{
+    std::shared_ptr<nsocktcp> iopt = std::dynamic_pointer_cast<nsocktcp>(iop);
+    if (iopt == nullptr)
+    {
+        throw_logic_error("dynamic_pointer_cast error");
+    }
+    for (auto &chan : iopt->accept())
+    {
+        CPPEV_INFO << "new channel " << chan->fd() << " accepted by migration socket " << iopt->fd() << log::endl;
+        iopt->evlp().fd_register(std::static_pointer_cast<nio>(chan),
+            fd_event::fd_readable, acceptor::on_migr_readable, true);
+    }
+}
+
+void acceptor::on_migr_readable(const std::shared_ptr<nio> &iop)
+{
+    std::shared_ptr<nsocktcp> chan = std::dynamic_pointer_cast<nsocktcp>(iop);
+    if (chan == nullptr)
+    {
+        throw_logic_error("dynamic_pointer_cast error");
+    }
+    tp_shared_data *dp = reinterpret_cast<tp_shared_data *>(chan->evlp().data());
+    acceptor *pseudo_this = reinterpret_cast<acceptor *>(chan->evlp().back());
+
+    std::vector<int> fds;
+    chan->recv_fds(fds);
+    std::queue<int> &pending = pseudo_this->migr_fds_[chan->fd()];
+    for (int fd : fds)
+    {
+        pending.push(fd);
+    }
+
+    // Fd is received with the first byte of header, so it's already there for a complete one
+    buffer &rbuf = chan->rbuffer();
+    migration_header h;
+    while (rbuf.size() >= static_cast<int>(sizeof(h)) && pending.size())
+    {
+        memcpy(&h, rbuf.rawbuf(), sizeof(h));
+        if (rbuf.size() - static_cast<int>(sizeof(h)) < h.rbuffer_size + h.wbuffer_size)
+        {
+            break;
+        }
+        rbuf.consume(sizeof(h));
+        std::shared_ptr<nsocktcp> conn =
+            std::make_shared<nsocktcp>(pending.front(), static_cast<family>(h.sockfamily));
+        pending.pop();
+        conn->rbuffer().produce(rbuf.rawbuf(), h.rbuffer_size);
+        rbuf.consume(h.rbuffer_size);
+        conn->wbuffer().produce(rbuf.rawbuf(), h.wbuffer_size);
+        rbuf.consume(h.wbuffer_size);
+        CPPEV_INFO << "new fd " << conn->fd() << " migrated by channel " << chan->fd() << log::endl;
         dp->minloads_get_evlp()->fd_register(std::static_pointer_cast<nio>(conn),
             fd_event::fd_writable, iohandler::on_acpt_writable, true);
     }
+
+    if (chan->eof() || chan->is_reset())
+    {
+        // Connections with incomplete data are dropped
+        while (pending.size())
+        {
+            close(pending.front());
+            pending.pop();
+        }
+        pseudo_this->migr_fds_.erase(chan->fd());
+        chan->evlp().fd_remove(iop, true);
+    }
 }
 
 void acceptor::run_impl()
 {
-    evlp_.fd_register(std::static_pointer_cast<nio>(sock_),
-        fd_event::fd_readable, acceptor::on_acpt_readable, true);
+    evlp_.fd_register(std::static_pointer_cast<nio>(sock_), fd_event::fd_readable,
+        migration_ ? acceptor::on_migr_acpt_readable : acceptor::on_acpt_readable, true);
     evlp_.loop_forever();
 }
 
@@ -274,12 +444,12 @@ void connector::on_pipe_readable(const std::shared_ptr<nio> &iop)
             {
                 if (std::get<2>(iter->first) == family::local)
                 {
-                    log::error << "syscall connect " << std::get<0>(iter->first) <<
+                    CPPEV_ERROR << "syscall connect " << std::get<0>(iter->first) <<
                         " failed with errno " << errno << log::endl;
                 }
                 else
                 {
-                    log::error << "syscall connect " << std::get<0>(iter->first) << " "
+                    CPPEV_ERROR << "syscall connect " << std::get<0>(iter->first) << " "
                         << std::get<1>(iter->first) << " failed with errno " << errno << log::endl;
                 }
                 pseudo_this->failures_[iter->first] += 1;
@@ -323,6 +493,18 @@ void tcp_server::listen_unix(const std::string &path, bool remove)
     acpts_.back()->listen_unix(path, remove);
 }
 
+void tcp_server::listen(const std::shared_ptr<nsocktcp> &sock)
+{
+    acpts_.push_back(std::make_unique<acceptor>(&data_));
+    acpts_.back()->listen(sock);
+}
+
+void tcp_server::listen_migration(const std::string &path, bool remove)
+{
+    acpts_.push_back(std::make_unique<acceptor>(&data_));
+    acpts_.back()->listen_migration(path, remove);
+}
+
 void tcp_server::run()
 {
     ignore_signal(SIGPIPE);
@@ -333,7 +515,7 @@ void tcp_server::run()
     }
 }
 
-void tcp_server::shutdown()
+void tcp_server::stop_accept()
 {
     for (auto &acpt : acpts_)
     {
@@ -343,6 +525,35 @@ void tcp_server::shutdown()
     {
         acpt->join();
     }
+    acpts_.clear();
+
+    // Wait for io threads to init connections already accepted, lowest priority makes
+    // the marker run after them
+    std::mutex lock;
+    std::condition_variable cond;
+    int pending = tp_.size();
+    for (int i = 0; i < tp_.size(); ++i)
+    {
+        auto iopps = nio_factory::get_pipes();
+        iopps[1]->wbuffer().put_string("0");
+        iopps[1]->write_all();
+        tp_[i].evlp_.fd_register(std::dynamic_pointer_cast<nio>(iopps[0]), fd_event::fd_readable,
+            [&](const std::shared_ptr<nio> &iop)
+            {
+                iop->evlp().fd_remove(iop);
+                std::unique_lock<std::mutex> lk(lock);
+                --pending;
+                cond.notify_one();
+            },
+            true, priority::p6);
+    }
+    std::unique_lock<std::mutex> lk(lock);
+    cond.wait(lk, [&]() { return pending == 0; });
+}
+
+void tcp_server::shutdown()
+{
+    stop_accept();
 
     for (int i = 0; i < tp_.size(); ++i)
     {
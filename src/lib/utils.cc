@@ -5,11 +5,11 @@
 #include <system_error>
 #include <sched.h>
 
+#include <pthread.h>
+
 #ifdef __linux__
 #include <sys/syscall.h>
 #include <unistd.h>
-#elif defined(__APPLE__)
-#include <pthread.h>
 #endif
 
 namespace cppev
@@ -310,9 +310,18 @@ bool thread_check_signal_pending(int sig)
 
 
 
+namespace
+{
+
+thread_local tid_t thr_id = 0;
+
+}   // namespace
+
 tid_t gettid() noexcept
 {
-    thread_local tid_t thr_id = 0;
+    // Child process shall not see the cached id of its parent
+    static int atfork_ret = pthread_atfork(nullptr, nullptr, []() { thr_id = 0; });
+    (void)atfork_ret;
     if (thr_id == 0)
     {
 #ifdef __linux__
@@ -1,9 +1,20 @@
 #include <gtest/gtest.h>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <vector>
+#include <unordered_map>
 #include <random>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "cppev/sysconfig.h"
 #include "cppev/async_logger.h"
 #include "cppev/subprocess.h"
@@ -105,6 +116,510 @@ TEST_F(TestAsyncLogger, test_output)
     EXPECT_EQ(std::get<2>(ret), "");
 }
 
+TEST_F(TestAsyncLogger, test_per_thread_rings)
+{
+    int fd = open(file, O_TRUNC | O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        throw_system_error("open error");
+    }
+
+    int thr_count = 16;
+    int line_count = 20000;
+    auto start = std::chrono::steady_clock::now();
+    {
+        async_logger logger(fd, true);
+        std::vector<std::thread> thrs;
+        for (int i = 0; i < thr_count; ++i)
+        {
+            thrs.emplace_back([&, i]()
+            {
+                for (int j = 0; j < line_count; ++j)
+                {
+                    logger << "thread " << i << " line " << j << log::endl;
+                }
+            });
+        }
+        for (auto &thr : thrs)
+        {
+            thr.join();
+        }
+    }
+    double span = std::chrono::duration_cast<std::chrono::duration<double>>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << "per-thread rings : " << static_cast<int64_t>(thr_count * line_count / span)
+        << " lines/s" << std::endl;
+    close(fd);
+
+    // Lines of the same thread keep their order, headers are formatted by background thread
+    std::ifstream in(file);
+    std::vector<int> next(thr_count, 0);
+    std::string line;
+    int total = 0;
+    while (std::getline(in, line))
+    {
+        int thr = -1;
+        int seq = -1;
+        auto pos = line.find("thread ");
+        ASSERT_NE(pos, std::string::npos);
+        ASSERT_EQ(line.find("- [ERROR] ["), 0);
+        ASSERT_EQ(line.substr(pos - 2, 2), "] ");
+        ASSERT_EQ(sscanf(line.c_str() + pos, "thread %d line %d", &thr, &seq), 2);
+        ASSERT_EQ(seq, next[thr]);
+        ++next[thr];
+        ++total;
+    }
+    EXPECT_EQ(total, thr_count * line_count);
+    unlink(file);
+}
+
+TEST_F(TestAsyncLogger, test_log_after_fork)
+{
+    int fd = open(file, O_TRUNC | O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        throw_system_error("open error");
+    }
+    async_logger::set_fork_support(true);
+    {
+        async_logger logger(fd, true);
+        logger << "parent before fork" << log::endl;
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            throw_system_error("fork error");
+        }
+        else if (pid == 0)
+        {
+            logger << "child" << log::endl;
+            std::thread thr([&]()
+            {
+                logger << "child thread" << log::endl;
+            });
+            thr.join();
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            _exit(0);
+        }
+        int ret = -1;
+        waitpid(pid, &ret, 0);
+        EXPECT_EQ(ret, 0);
+        logger << "parent after fork" << log::endl;
+    }
+    async_logger::set_fork_support(false);
+    close(fd);
+
+    // Records before fork are only written by parent
+    std::ifstream in(file);
+    std::unordered_map<std::string, int> counts;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        counts[line.substr(line.find("] ", line.find("LWP")) + 2)]++;
+    }
+    EXPECT_EQ(counts.size(), 4);
+    EXPECT_EQ(counts["parent before fork"], 1);
+    EXPECT_EQ(counts["parent after fork"], 1);
+    EXPECT_EQ(counts["child"], 1);
+    EXPECT_EQ(counts["child thread"], 1);
+    unlink(file);
+}
+
+TEST_F(TestAsyncLogger, test_fork_without_fork_support)
+{
+    async_logger logger(STDOUT_FILENO);
+    std::mutex lock;
+    std::condition_variable cond;
+    bool started = false;
+    bool forked = false;
+
+    // Line under construction holds the logger lock
+    std::thread thr([&]()
+    {
+        logger << "line across fork";
+        std::unique_lock<std::mutex> lk(lock);
+        started = true;
+        cond.notify_one();
+        cond.wait(lk, [&]() { return forked; });
+        lk.unlock();
+        logger << log::endl;
+    });
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        cond.wait(lk, [&]() { return started; });
+    }
+
+    // Fork of subprocess doesn't wait for the line
+    subp_open subp("true", {}, subp_launch::fork);
+    subp.wait();
+    EXPECT_EQ(subp.returncode(), 0);
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        forked = true;
+    }
+    cond.notify_one();
+    thr.join();
+}
+
+class TestDeferredLog
+: public testing::TestWithParam<bool>
+{
+};
+
+TEST_P(TestDeferredLog, test_deferred_text)
+{
+    int fd = open(file, O_TRUNC | O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        throw_system_error("open error");
+    }
+    {
+        async_logger logger(fd, GetParam());
+        std::string name = "cppev";
+        for (int i = 0; i < 100; ++i)
+        {
+            CPPEV_LOG_DEFERRED(logger, "line {} of {} : {} {} {} {}", i, name, 1.5, true, 'x',
+                static_cast<unsigned>(7));
+        }
+        CPPEV_LOG_DEFERRED(logger, "no argument {}");
+        logger << "text line" << log::endl;
+        // Too large for the ring, passed after the records in ring
+        std::string large(sysconfig::log_ring_size, 'l');
+        CPPEV_LOG_DEFERRED(logger, "large {} end", large);
+    }
+    close(fd);
+
+    std::ifstream in(file);
+    std::string line;
+    for (int i = 0; i < 100; ++i)
+    {
+        ASSERT_TRUE(std::getline(in, line));
+        EXPECT_NE(line.find("] [LWP "), std::string::npos);
+        std::string expect = "line " + std::to_string(i) + " of cppev : 1.500000 true x 7";
+        EXPECT_EQ(line.substr(line.size() - expect.size()), expect);
+    }
+    ASSERT_TRUE(std::getline(in, line));
+    EXPECT_NE(line.find("no argument {}"), std::string::npos);
+    ASSERT_TRUE(std::getline(in, line));
+    EXPECT_NE(line.find("text line"), std::string::npos);
+    ASSERT_TRUE(std::getline(in, line));
+    EXPECT_NE(line.find("] [LWP "), std::string::npos);
+    EXPECT_NE(line.find("large " + std::string(sysconfig::log_ring_size, 'l') + " end"),
+        std::string::npos);
+    EXPECT_FALSE(std::getline(in, line));
+    unlink(file);
+}
+
+INSTANTIATE_TEST_SUITE_P(CppevTest, TestDeferredLog,
+    testing::Values(false, true)
+);
+
+TEST_F(TestAsyncLogger, test_deferred_binary)
+{
+    const char *bin_file = "./cppev_test_logger_output.bin";
+    int fd = open(bin_file, O_TRUNC | O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        throw_system_error("open error");
+    }
+
+    // Records fit in the rings, so the cost of caller is measured without back pressure
+    int thr_count = 4;
+    int line_count = 2000;
+    int64_t elapsed = 0;
+    {
+        async_logger logger(fd, true, true);
+        std::vector<std::thread> thrs;
+        std::atomic<int64_t> total(0);
+        for (int i = 0; i < thr_count; ++i)
+        {
+            thrs.emplace_back([&, i]()
+            {
+                auto start = std::chrono::steady_clock::now();
+                for (int j = 0; j < line_count; ++j)
+                {
+                    CPPEV_LOG_DEFERRED(logger, "thread {} line {} ptr {}", i, j, &logger);
+                }
+                total += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+            });
+        }
+        for (auto &thr : thrs)
+        {
+            thr.join();
+        }
+        logger << "text line" << log::endl;
+        elapsed = total;
+    }
+    std::cout << "deferred binary log : " << elapsed / (thr_count * line_count)
+        << " ns per call" << std::endl;
+    close(fd);
+
+    int in_fd = open(bin_file, O_RDONLY);
+    int out_fd = open(file, O_TRUNC | O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+    ASSERT_GE(in_fd, 0);
+    ASSERT_GE(out_fd, 0);
+    decode_binary_log(in_fd, out_fd);
+    close(in_fd);
+    close(out_fd);
+
+    std::ifstream in(file);
+    std::vector<int> next(thr_count, 0);
+    std::string line;
+    int total = 0;
+    bool text = false;
+    while (std::getline(in, line))
+    {
+        if (line.find("text line") != std::string::npos)
+        {
+            text = true;
+            continue;
+        }
+        int thr = -1;
+        int seq = -1;
+        auto pos = line.find("thread ");
+        ASSERT_NE(pos, std::string::npos);
+        ASSERT_EQ(sscanf(line.c_str() + pos, "thread %d line %d", &thr, &seq), 2);
+        ASSERT_EQ(seq, next[thr]);
+        EXPECT_NE(line.find(" ptr 0x"), std::string::npos);
+        ++next[thr];
+        ++total;
+    }
+    EXPECT_TRUE(text);
+    EXPECT_EQ(total, thr_count * line_count);
+
+    // Text file is not a binary log
+    in_fd = open(file, O_RDONLY);
+    EXPECT_THROW(decode_binary_log(in_fd, STDOUT_FILENO), std::runtime_error);
+    close(in_fd);
+    unlink(file);
+    unlink(bin_file);
+}
+
+// The file and files rotated from it
+std::vector<std::string> log_files(const std::string &path)
+{
+    std::vector<std::string> files;
+    auto pos = path.rfind('/');
+    std::string dir = path.substr(0, pos);
+    std::string prefix = path.substr(pos + 1);
+    DIR *d = opendir(dir.c_str());
+    while (dirent *ent = readdir(d))
+    {
+        std::string name = ent->d_name;
+        if (name == prefix || name.find(prefix + ".") == 0)
+        {
+            files.push_back(dir + "/" + name);
+        }
+    }
+    closedir(d);
+    return files;
+}
+
+std::vector<int64_t> log_file_sizes(const std::string &path)
+{
+    std::vector<int64_t> sizes;
+    for (const auto &file : log_files(path))
+    {
+        struct stat st;
+        stat(file.c_str(), &st);
+        sizes.push_back(st.st_size);
+    }
+    return sizes;
+}
+
+void remove_log_files(const std::string &path)
+{
+    for (const auto &file : log_files(path))
+    {
+        unlink(file.c_str());
+    }
+}
+
+TEST_F(TestAsyncLogger, test_file_sink_rotation)
+{
+    log_file_options options;
+    options.path = "./cppev_test_logger_sink.log";
+    options.rotate_size = 1000;
+    options.keep_files = 2;
+    options.sync = log_sync_policy::fdatasync;
+    options.buffer_count = 4;
+    options.buffer_size = 256;
+    remove_log_files(options.path);
+
+    std::string line(49, 'x');
+    line.push_back('\n');
+    {
+        log_file_sink sink(options);
+        for (int i = 0; i < 100; ++i)
+        {
+            EXPECT_TRUE(sink.append(line.c_str(), line.size()));
+        }
+        sink.flush();
+        log_sink_stats stats = sink.stats();
+        EXPECT_EQ(stats.written, 5000);
+        EXPECT_EQ(stats.dropped, 0);
+        EXPECT_GE(stats.rotations, 4);
+        EXPECT_GT(stats.syncs, 0);
+        EXPECT_GT(stats.writes, 0);
+    }
+
+    auto sizes = log_file_sizes(options.path);
+    EXPECT_EQ(sizes.size(), 3);
+    for (auto size : sizes)
+    {
+        EXPECT_LE(size, 1000);
+        EXPECT_EQ(size % line.size(), 0);
+    }
+    remove_log_files(options.path);
+}
+
+class TestFileSinkOverflow
+: public testing::TestWithParam<log_overflow_policy>
+{
+};
+
+TEST_P(TestFileSinkOverflow, test_file_sink_overflow)
+{
+    log_file_options options;
+    options.path = "./cppev_test_logger_sink.log";
+    options.buffer_count = 2;
+    options.buffer_size = 4096;
+    options.overflow = GetParam();
+    remove_log_files(options.path);
+
+    std::string line(99, 'x');
+    line.push_back('\n');
+    int count = 100000;
+    int accepted = 0;
+    log_sink_stats stats;
+    {
+        log_file_sink sink(options);
+        for (int i = 0; i < count; ++i)
+        {
+            accepted += sink.append(line.c_str(), line.size());
+        }
+        sink.flush();
+        stats = sink.stats();
+    }
+    EXPECT_EQ(stats.written, static_cast<int64_t>(accepted * line.size()));
+    EXPECT_EQ(stats.written + stats.dropped, static_cast<int64_t>(count * line.size()));
+    if (GetParam() == log_overflow_policy::block)
+    {
+        EXPECT_EQ(accepted, count);
+    }
+    auto sizes = log_file_sizes(options.path);
+    ASSERT_EQ(sizes.size(), 1);
+    EXPECT_EQ(sizes[0], stats.written);
+    remove_log_files(options.path);
+}
+
+INSTANTIATE_TEST_SUITE_P(CppevTest, TestFileSinkOverflow,
+    testing::Values(log_overflow_policy::block, log_overflow_policy::drop)
+);
+
+TEST_P(TestDeferredLog, test_file_logger)
+{
+    log_file_options options;
+    options.path = "./cppev_test_logger_sink.log";
+    options.rotate_size = 1 << 16;
+    options.buffer_size = 1 << 14;
+    remove_log_files(options.path);
+
+    int thr_count = 4;
+    int line_count = 5000;
+    {
+        async_logger logger(options, GetParam());
+        std::vector<std::thread> thrs;
+        for (int i = 0; i < thr_count; ++i)
+        {
+            thrs.emplace_back([&, i]()
+            {
+                for (int j = 0; j < line_count; ++j)
+                {
+                    logger << "thread " << i << " line " << j << log::endl;
+                }
+            });
+        }
+        for (auto &thr : thrs)
+        {
+            thr.join();
+        }
+        EXPECT_THROW(async_logger(options, true, true), std::logic_error);
+    }
+
+    // Lines are all written to the file and rotated ones
+    auto sizes = log_file_sizes(options.path);
+    EXPECT_GT(sizes.size(), 1);
+    int total = 0;
+    for (const auto &file : log_files(options.path))
+    {
+        std::ifstream in(file);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            EXPECT_NE(line.find("[INFO]"), std::string::npos);
+            EXPECT_NE(line.find(" line "), std::string::npos);
+            ++total;
+        }
+    }
+    EXPECT_EQ(total, thr_count * line_count);
+    remove_log_files(options.path);
+}
+
+TEST_F(TestAsyncLogger, test_log_level_and_sampling)
+{
+    int evaluated = 0;
+    auto arg = [&evaluated]() -> int
+    {
+        return ++evaluated;
+    };
+
+    log::set_level(3);
+    for (int i = 0; i < 100; ++i)
+    {
+        CPPEV_INFO << "disabled " << arg() << log::endl;
+        CPPEV_ERROR << "disabled " << arg() << log::endl;
+    }
+    EXPECT_EQ(evaluated, 0);
+
+    int count = 1 << 24;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        CPPEV_INFO << "disabled " << arg() << log::endl;
+    }
+    double span = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << "disabled log : " << span / count << " ns per call" << std::endl;
+    EXPECT_EQ(evaluated, 0);
+
+    // Macro shall not capture the else branch
+    log::set_level(2);
+    if (evaluated == 0)
+        CPPEV_INFO << "disabled " << arg() << log::endl;
+    else
+        ++evaluated;
+    EXPECT_EQ(evaluated, 0);
+    CPPEV_ERROR << "enabled " << arg() << log::endl;
+    EXPECT_EQ(evaluated, 1);
+
+    log::set_level(1);
+    evaluated = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        CPPEV_INFO_EVERY_N(10) << "sampled " << arg() << log::endl;
+    }
+    EXPECT_EQ(evaluated, 10);
+
+    evaluated = 0;
+    for (int i = 0; i < 1000; ++i)
+    {
+        CPPEV_INFO_PER_SECOND(5) << "rate limited " << arg() << log::endl;
+    }
+    EXPECT_GE(evaluated, 5);
+    EXPECT_LE(evaluated, 10);
+}
+
 }   // namespace cppev
 
 int main(int argc, char **argv)
@@ -1,6 +1,10 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <gtest/gtest.h>
 #include "cppev/ipc.h"
 #include "cppev/lock.h"
@@ -324,6 +328,125 @@ TEST_F(TestIpc, test_shm_one_time_fence_barrier_by_fork)
     }
 }
 
+// Number of pages of the mapping that are resident
+size_t resident_pages(void *ptr, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> vec((size + page - 1) / page);
+    if (mincore(ptr, size, vec.data()) == -1)
+    {
+        throw_system_error("mincore error");
+    }
+    size_t count = 0;
+    for (unsigned char v : vec)
+    {
+        count += v & 1;
+    }
+    return count;
+}
+
+TEST_F(TestIpc, test_shm_populate_lock)
+{
+    size_t size = 4 << 20;
+    size_t pages = size / sysconf(_SC_PAGESIZE);
+    shm_unlink(name_.c_str());
+
+    shm_options options;
+    options.page = shm_page::transparent_huge;
+    options.populate = true;
+    options.lock = true;
+    shared_memory shm(name_, size, options);
+    EXPECT_TRUE(shm.creator());
+    EXPECT_EQ(shm.size(), size);
+    EXPECT_EQ(shm.fd(), -1);
+    EXPECT_EQ(resident_pages(shm.ptr(), size), pages);
+    for (size_t i = 0; i < size; i += 4096)
+    {
+        ASSERT_EQ(static_cast<char *>(shm.ptr())[i], 0);
+    }
+
+    // Prefault of existing segment keeps the data
+    memset(shm.ptr(), 'c', size);
+    shm_options populate;
+    populate.populate = true;
+    shared_memory shm1(name_, size, populate);
+    EXPECT_FALSE(shm1.creator());
+    EXPECT_EQ(resident_pages(shm1.ptr(), size), pages);
+    EXPECT_EQ(static_cast<char *>(shm1.ptr())[size - 1], 'c');
+    shm.unlink();
+}
+
+TEST_F(TestIpc, test_shm_memfd_by_fork)
+{
+    size_t size = 1 << 20;
+    shm_options options;
+    options.memfd = true;
+    shared_memory shm("cppev_test_memfd", size, options);
+    EXPECT_TRUE(shm.creator());
+    ASSERT_GE(shm.fd(), 0);
+    shm.unlink();
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw_system_error("fork error");
+    }
+    else if (pid == 0)
+    {
+        // Map by fd as if it's received from other process
+        shared_memory shm1(dup(shm.fd()), size);
+        if (shm1.creator() || shm1.ptr() == shm.ptr())
+        {
+            _exit(1);
+        }
+        memcpy(shm1.ptr(), "cppev", 6);
+        _exit(0);
+    }
+    int ret = -1;
+    waitpid(pid, &ret, 0);
+    EXPECT_EQ(ret, 0);
+    EXPECT_STREQ(static_cast<char *>(shm.ptr()), "cppev");
+
+    shared_memory moved(std::move(shm));
+    EXPECT_EQ(shm.fd(), -1);
+    EXPECT_GE(moved.fd(), 0);
+}
+
+TEST_F(TestIpc, test_shm_huge_page_numa)
+{
+    shm_options options;
+    options.page = shm_page::huge_2mb;
+    EXPECT_THROW(shared_memory(name_, 2 << 20, options), std::logic_error);
+    options.memfd = true;
+    EXPECT_THROW(shared_memory("cppev_test_huge", 1 << 20, options), std::logic_error);
+
+    // Huge pages may be not reserved, and numa binding may be not permitted
+    options.populate = true;
+    try
+    {
+        shared_memory shm("cppev_test_huge", 2 << 20, options);
+        memset(shm.ptr(), 1, shm.size());
+    }
+    catch (const std::system_error &e)
+    {
+        std::cout << "huge page unavailable : " << e.what() << std::endl;
+    }
+
+    shm_options numa;
+    numa.memfd = true;
+    numa.numa_node = 0;
+    numa.populate = true;
+    try
+    {
+        shared_memory shm("cppev_test_numa", 1 << 20, numa);
+        memset(shm.ptr(), 1, shm.size());
+    }
+    catch (const std::system_error &e)
+    {
+        std::cout << "numa binding unavailable : " << e.what() << std::endl;
+    }
+}
+
 }   // namespace cppev
 
 int main(int argc, char **argv)
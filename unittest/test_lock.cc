@@ -1,5 +1,11 @@
 #include <mutex>
 #include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
 #include <gtest/gtest.h>
 #include "cppev/lock.h"
 #include "cppev/ipc.h"
@@ -286,6 +292,284 @@ TEST_F(TestLock, test_pshared_lock_shm_performance)
     shm.unlink();
 }
 
+template <typename Mutex>
+class TestScalableSpinlock
+: public testing::Test
+{
+};
+
+using scalable_spinlocks = testing::Types<ttas_spinlock, ticket_spinlock, mcs_spinlock>;
+
+TYPED_TEST_SUITE(TestScalableSpinlock, scalable_spinlocks);
+
+TYPED_TEST(TestScalableSpinlock, test_try_lock)
+{
+    TypeParam lock;
+    {
+        std::unique_lock<TypeParam> lk(lock);
+        EXPECT_FALSE(lock.try_lock());
+        std::thread thr([&]() { EXPECT_FALSE(lock.try_lock()); });
+        thr.join();
+    }
+    EXPECT_TRUE(lock.try_lock());
+    lock.unlock();
+
+    // Nested locks of the same thread
+    TypeParam lock1;
+    std::unique_lock<TypeParam> lk(lock);
+    std::unique_lock<TypeParam> lk1(lock1);
+    lk.unlock();
+    EXPECT_TRUE(lock.try_lock());
+    lock.unlock();
+}
+
+TYPED_TEST(TestScalableSpinlock, test_mutual_exclusion)
+{
+    TypeParam lock;
+    int64_t count = 0;
+    int add_num = 20000;
+    int thr_num = 8;
+
+    std::vector<std::thread> thrs;
+    for (int i = 0; i < thr_num; ++i)
+    {
+        thrs.emplace_back([&]()
+        {
+            for (int j = 0; j < add_num; ++j)
+            {
+                std::unique_lock<TypeParam> _(lock);
+                ++count;
+            }
+        });
+    }
+    for (auto &thr : thrs)
+    {
+        thr.join();
+    }
+    EXPECT_EQ(count, static_cast<int64_t>(add_num) * thr_num);
+}
+
+#ifdef __linux__
+
+TEST_F(TestLock, test_futex_lock_performance)
+{
+    futex_lock lock;
+    performance_test<futex_lock>(lock);
+}
+
+template <typename Mutex, typename... Args>
+void process_contention_test(const std::string &name, Args&&... args)
+{
+    struct shared_data
+    {
+        explicit shared_data(Args&&... args)
+        : lock(std::forward<Args>(args)...), count(0)
+        {
+        }
+
+        Mutex lock;
+        int64_t count;
+    };
+
+    std::string shm_name = "/cppev_test_lock_contention";
+    shm_unlink(shm_name.c_str());
+    shared_memory shm(shm_name, sizeof(shared_data));
+    shared_data *data = shm.construct<shared_data>(std::forward<Args>(args)...);
+
+    int proc_num = 4;
+    int add_num = 200000;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<pid_t> pids;
+    for (int i = 0; i < proc_num; ++i)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            throw_system_error("fork error");
+        }
+        else if (pid == 0)
+        {
+            for (int j = 0; j < add_num; ++j)
+            {
+                std::unique_lock<Mutex> _(data->lock);
+                ++data->count;
+            }
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for (pid_t pid : pids)
+    {
+        int ret = -1;
+        waitpid(pid, &ret, 0);
+        EXPECT_EQ(ret, 0);
+    }
+    double span = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << name << " with " << proc_num << " processes : " << span / (proc_num * add_num)
+        << " ns per lock" << std::endl;
+    EXPECT_EQ(data->count, proc_num * add_num);
+    data->~shared_data();
+    shm.unlink();
+}
+
+TEST_F(TestLock, test_process_contention_performance)
+{
+    process_contention_test<pshared_lock>("pshared_lock");
+    process_contention_test<futex_lock>("futex_lock", false);
+    process_contention_test<futex_lock>("futex_lock pi", true);
+}
+
+class TestFutexLock
+: public testing::TestWithParam<bool>
+{
+};
+
+TEST_P(TestFutexLock, test_futex_lock_owner_died)
+{
+    std::string shm_name = "/cppev_test_lock_owner_died";
+    shm_unlink(shm_name.c_str());
+    shared_memory shm(shm_name, sizeof(futex_lock));
+    futex_lock *lock = shm.construct<futex_lock>(GetParam());
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw_system_error("fork error");
+    }
+    else if (pid == 0)
+    {
+        lock->lock();
+        _exit(0);
+    }
+    int ret = -1;
+    waitpid(pid, &ret, 0);
+    EXPECT_EQ(ret, 0);
+
+    EXPECT_FALSE(lock->try_lock());
+    lock->lock();
+    EXPECT_TRUE(lock->owner_died());
+    lock->unlock();
+    lock->lock();
+    EXPECT_FALSE(lock->owner_died());
+    lock->unlock();
+    shm.unlink();
+}
+
+TEST_P(TestFutexLock, test_futex_lock_owner_alive)
+{
+    std::string shm_name = "/cppev_test_lock_owner_alive";
+    shm_unlink(shm_name.c_str());
+    shared_memory shm(shm_name, sizeof(futex_lock));
+    futex_lock *lock = shm.construct<futex_lock>(GetParam());
+
+    // Owner holds the lock much longer than the probe interval
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw_system_error("fork error");
+    }
+    else if (pid == 0)
+    {
+        lock->lock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        lock->unlock();
+        _exit(0);
+    }
+    while (lock->try_lock())
+    {
+        lock->unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    lock->lock();
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+    EXPECT_FALSE(lock->owner_died());
+    lock->unlock();
+    int ret = -1;
+    waitpid(pid, &ret, 0);
+    EXPECT_EQ(ret, 0);
+    shm.unlink();
+}
+
+TEST_P(TestFutexLock, test_futex_cond)
+{
+    futex_lock lock(GetParam());
+    futex_cond cond;
+    std::vector<int> queue;
+    int count = 10000;
+    int64_t sum = 0;
+
+    std::thread consumer([&]()
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            std::unique_lock<futex_lock> lk(lock);
+            cond.wait(lk, [&]() { return !queue.empty(); });
+            sum += queue.back();
+            queue.pop_back();
+        }
+    });
+    for (int i = 0; i < count; ++i)
+    {
+        std::unique_lock<futex_lock> lk(lock);
+        queue.push_back(i);
+        cond.notify_one();
+    }
+    consumer.join();
+    EXPECT_EQ(sum, static_cast<int64_t>(count) * (count - 1) / 2);
+
+    std::unique_lock<futex_lock> lk(lock);
+    EXPECT_FALSE(cond.wait_for(lk, std::chrono::milliseconds(10)));
+    EXPECT_TRUE(lk.owns_lock());
+}
+
+INSTANTIATE_TEST_SUITE_P(CppevTest, TestFutexLock,
+    testing::Values(false, true)
+);
+
+TEST_F(TestLock, test_futex_barrier)
+{
+    EXPECT_THROW(futex_barrier(0), std::logic_error);
+
+    int thr_num = 8;
+    int rounds = 1000;
+    futex_barrier barrier(thr_num);
+    std::atomic<int> count(0);
+    std::atomic<int> last(0);
+    std::atomic<bool> ok(true);
+
+    std::vector<std::thread> thrs;
+    for (int i = 0; i < thr_num; ++i)
+    {
+        thrs.emplace_back([&]()
+        {
+            for (int r = 1; r <= rounds; ++r)
+            {
+                count.fetch_add(1);
+                if (barrier.wait())
+                {
+                    last.fetch_add(1);
+                }
+                if (count.load() != r * thr_num)
+                {
+                    ok = false;
+                }
+                barrier.wait();
+            }
+        });
+    }
+    for (auto &thr : thrs)
+    {
+        thr.join();
+    }
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(last, rounds);
+}
+
+#endif  // __linux__
+
 }   // namespace cppev
 
 int main(int argc, char **argv)
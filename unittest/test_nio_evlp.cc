@@ -1,5 +1,7 @@
 #include <unordered_set>
 #include <fcntl.h>
+#include <chrono>
+#include <thread>
 #include <gtest/gtest.h>
 #include "cppev/nio.h"
 #include "cppev/event_loop.h"
@@ -119,6 +121,58 @@ TEST_F(TestNio, test_tcp_connect_with_evlp)
 
 
 
+#ifdef __linux__
+TEST_F(TestNio, test_evlp_timer)
+{
+    event_loop evlp;
+    std::vector<int> order;
+    int count_high = 0;
+    int count_low = 0;
+    int count_oneshot = 0;
+    int count_removed = 0;
+
+    evlp.timer_register(std::chrono::milliseconds(10),
+        [&](uint64_t) { ++count_low; order.push_back(2); }, true, priority::p3);
+    evlp.timer_register(std::chrono::milliseconds(10),
+        [&](uint64_t) { ++count_high; order.push_back(1); }, true, priority::p0);
+    int64_t id = evlp.timer_register(std::chrono::milliseconds(7),
+        [&](uint64_t) { ++count_removed; });
+    evlp.timer_register(std::chrono::milliseconds(25),
+        [&](uint64_t) { ++count_oneshot; }, false);
+
+    // Timers of the same interval share one fd
+    EXPECT_EQ(evlp.ev_loads(), 3);
+
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(105))
+    {
+        evlp.loop_once(5);
+    }
+    EXPECT_GE(count_high, 8);
+    EXPECT_LE(count_high, 11);
+    EXPECT_EQ(count_high, count_low);
+    for (size_t i = 0; i + 1 < order.size(); i += 2)
+    {
+        EXPECT_EQ(order[i], 1);
+        EXPECT_EQ(order[i + 1], 2);
+    }
+    EXPECT_EQ(count_oneshot, 1);
+    EXPECT_GE(count_removed, 10);
+    EXPECT_EQ(evlp.ev_loads(), 2);
+
+    EXPECT_TRUE(evlp.timer_remove(id));
+    EXPECT_FALSE(evlp.timer_remove(id));
+    EXPECT_EQ(evlp.ev_loads(), 1);
+
+    // Expirations missed while not looping are reported
+    uint64_t missed = 0;
+    evlp.timer_register(std::chrono::milliseconds(2), [&](uint64_t exp) { missed = exp; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    evlp.loop_once(0);
+    EXPECT_GE(missed, 10);
+}
+#endif  // __linux__
+
 class TestNioSocket
 : public testing::TestWithParam<std::tuple<family, bool, int, int>>
 {
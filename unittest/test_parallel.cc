@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include "cppev/parallel.h"
+#include <atomic>
+#include <vector>
+#include <random>
+#include <numeric>
+#include <algorithm>
+
+namespace cppev
+{
+
+class TestParallel
+: public testing::TestWithParam<int>
+{
+protected:
+    void SetUp() override
+    {
+        tp_ = std::make_unique<thread_pool_task_queue>(GetParam());
+        tp_->run();
+    }
+
+    void TearDown() override
+    {
+        tp_->stop();
+    }
+
+    std::unique_ptr<thread_pool_task_queue> tp_;
+};
+
+TEST_P(TestParallel, test_parallel_for)
+{
+    int count = 100000;
+    std::vector<int> visited(count, 0);
+    parallel_for(*tp_, 0, count, [&](int i) { visited[i]++; });
+    EXPECT_EQ(std::count(visited.begin(), visited.end(), 1), count);
+
+    std::atomic<int> sum(0);
+    parallel_for(*tp_, -50, 50, [&](int i) { sum.fetch_add(i + 50); }, 7);
+    EXPECT_EQ(sum, 99 * 100 / 2);
+
+    parallel_for(*tp_, 10, 10, [&](int) { sum.fetch_add(1); });
+    EXPECT_EQ(sum, 99 * 100 / 2);
+
+    EXPECT_THROW(
+        parallel_for(*tp_, 0, count, [](int i)
+        {
+            if (i == 777)
+            {
+                throw_runtime_error("test");
+            }
+        }),
+        std::runtime_error
+    );
+}
+
+TEST_P(TestParallel, test_parallel_for_nested)
+{
+    std::atomic<int> sum(0);
+    parallel_for(*tp_, 0, 32, [&](int)
+    {
+        parallel_for(*tp_, 0, 100, [&](int) { sum.fetch_add(1); });
+    }, 1);
+    EXPECT_EQ(sum, 32 * 100);
+}
+
+TEST_P(TestParallel, test_parallel_transform)
+{
+    std::vector<int> in(50000);
+    std::iota(in.begin(), in.end(), 0);
+    std::vector<int64_t> out(in.size());
+    auto end = parallel_transform(*tp_, in.begin(), in.end(), out.begin(),
+        [](int x) { return static_cast<int64_t>(x) * x; });
+    EXPECT_EQ(end, out.end());
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        ASSERT_EQ(out[i], static_cast<int64_t>(i) * i);
+    }
+}
+
+TEST_P(TestParallel, test_parallel_reduce)
+{
+    std::vector<int64_t> nums(100000);
+    std::iota(nums.begin(), nums.end(), 1);
+    int64_t expect = 100000LL * 100001 / 2;
+    EXPECT_EQ(parallel_reduce(*tp_, nums.begin(), nums.end(), int64_t(0)), expect);
+    EXPECT_EQ(parallel_reduce(*tp_, nums.begin(), nums.end(), int64_t(0), std::plus<>(), true),
+        expect);
+    EXPECT_EQ(parallel_reduce(*tp_, nums.begin(), nums.begin(), int64_t(3)), 3);
+
+    // Non-commutative op keeps the order when deterministic
+    std::vector<std::string> strs;
+    for (int i = 0; i < 1000; ++i)
+    {
+        strs.push_back(std::to_string(i % 10));
+    }
+    std::string joined = std::accumulate(strs.begin(), strs.end(), std::string("#"));
+    EXPECT_EQ(parallel_reduce(*tp_, strs.begin(), strs.end(), std::string("#"), std::plus<>(),
+        true, 3), joined);
+
+    // Floating point result is reproducible when deterministic
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> dist(-1e6, 1e6);
+    std::vector<double> reals(200000);
+    for (auto &r : reals)
+    {
+        r = dist(gen);
+    }
+    double first = parallel_reduce(*tp_, reals.begin(), reals.end(), 0.0, std::plus<>(), true);
+    for (int i = 0; i < 10; ++i)
+    {
+        EXPECT_EQ(parallel_reduce(*tp_, reals.begin(), reals.end(), 0.0, std::plus<>(), true),
+            first);
+    }
+}
+
+TEST_P(TestParallel, test_parallel_sort)
+{
+    std::mt19937 gen(17);
+    for (int n : { 0, 1, 100, 4097, 100000, 333333 })
+    {
+        std::vector<int> nums(n);
+        for (auto &x : nums)
+        {
+            x = gen() % 1000;
+        }
+        std::vector<int> expect = nums;
+        std::sort(expect.begin(), expect.end(), std::greater<>());
+        parallel_sort(*tp_, nums.begin(), nums.end(), std::greater<>());
+        EXPECT_EQ(nums, expect);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(CppevTest, TestParallel,
+    testing::Values(0, 1, 4, 16)
+);
+
+}   // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
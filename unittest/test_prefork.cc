@@ -0,0 +1,195 @@
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <unordered_set>
+#include <csignal>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include "cppev/nio.h"
+#include "cppev/utils.h"
+#include "cppev/prefork.h"
+
+namespace cppev
+{
+
+const int port = 8891;
+
+// @return pid of the worker which serves the request, -1 if failed
+pid_t request()
+{
+    auto sock = nio_factory::get_nsocktcp(family::ipv4);
+    sock->set_io_block();
+    if (!sock->connect("127.0.0.1", port))
+    {
+        return -1;
+    }
+    sock->set_io_nonblock();
+    sock->wbuffer().put_string("pid");
+    sock->write_all();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    std::string resp;
+    while (resp.find('\n') == std::string::npos && std::chrono::steady_clock::now() < deadline)
+    {
+        sock->read_all();
+        resp = sock->rbuffer().get_string(-1, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (resp.find('\n') == std::string::npos)
+    {
+        return -1;
+    }
+    return std::stoi(resp);
+}
+
+std::unordered_set<pid_t> worker_pids(const std::vector<reactor::worker_load> &loads)
+{
+    std::unordered_set<pid_t> pids;
+    for (auto &load : loads)
+    {
+        pids.insert(load.pid);
+    }
+    return pids;
+}
+
+TEST(TestPrefork, test_prefork_server)
+{
+    int proc_num = 2;
+    reactor::prefork_server server(proc_num, 1);
+    server.set_on_read_complete([](const std::shared_ptr<nsocktcp> &iopt)
+    {
+        iopt->rbuffer().clear();
+        iopt->wbuffer().put_string(std::to_string(getpid()) + "\n");
+        reactor::async_write(iopt);
+    });
+    server.listen(port, family::ipv4);
+    server.run();
+
+    auto loads = server.loads();
+    ASSERT_EQ(loads.size(), proc_num);
+    for (auto &load : loads)
+    {
+        EXPECT_GT(load.pid, 0);
+        EXPECT_NE(load.pid, getpid());
+        EXPECT_EQ(load.generation, 1);
+        EXPECT_TRUE(load.ready);
+    }
+
+    // Requests are served by workers
+    int requests = 20;
+    auto pids = worker_pids(loads);
+    for (int i = 0; i < requests; ++i)
+    {
+        EXPECT_EQ(pids.count(request()), 1);
+    }
+    int64_t accepted = 0;
+    for (auto &load : server.loads())
+    {
+        accepted += load.accepted;
+    }
+    EXPECT_EQ(accepted, requests);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    int64_t connections = -1;
+    while (connections != 0 && std::chrono::steady_clock::now() < deadline)
+    {
+        connections = 0;
+        for (auto &load : server.loads())
+        {
+            connections += load.connections;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(connections, 0);
+
+    // Worker killed is restarted by supervisor
+    pid_t killed = loads[0].pid;
+    send_signal(killed, SIGKILL);
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while ((server.loads()[0].pid == killed || !server.loads()[0].ready) &&
+        std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    loads = server.loads();
+    EXPECT_NE(loads[0].pid, killed);
+    EXPECT_EQ(loads[0].generation, 2);
+    EXPECT_TRUE(loads[0].ready);
+    EXPECT_EQ(worker_pids(loads).count(request()), 1);
+
+    // Rolling restart doesn't refuse requests
+    std::atomic<bool> stop(false);
+    std::atomic<int> failures(0);
+    std::thread client([&]()
+    {
+        while (!stop)
+        {
+            if (request() == -1)
+            {
+                ++failures;
+            }
+        }
+    });
+    auto before = server.loads();
+    server.restart();
+    stop = true;
+    client.join();
+    EXPECT_EQ(failures, 0);
+    auto after = server.loads();
+    for (int i = 0; i < proc_num; ++i)
+    {
+        EXPECT_NE(after[i].pid, before[i].pid);
+        EXPECT_EQ(after[i].generation, before[i].generation + 1);
+        EXPECT_TRUE(after[i].ready);
+        EXPECT_FALSE(check_process(before[i].pid));
+    }
+
+    server.shutdown();
+    for (int i = 0; i < proc_num; ++i)
+    {
+        EXPECT_FALSE(check_process(after[i].pid));
+        EXPECT_EQ(server.loads()[i].pid, 0);
+    }
+}
+
+TEST(TestPrefork, test_restart_backoff)
+{
+    reactor::prefork_server server(1, 1);
+    server.listen_unix("./cppev_test_prefork.sock", true);
+    server.run();
+
+    // Worker dying soon after started is restarted later and later
+    std::vector<double> delays;
+    for (int i = 0; i < 3; ++i)
+    {
+        pid_t killed = server.loads()[0].pid;
+        ASSERT_GT(killed, 0);
+        send_signal(killed, SIGKILL);
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::seconds(5);
+        while ((server.loads()[0].pid == killed || !server.loads()[0].ready) &&
+            std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_TRUE(server.loads()[0].ready);
+        delays.push_back(std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+    EXPECT_GE(delays[1], 200);
+    EXPECT_GE(delays[2], 400);
+    EXPECT_GT(delays[2], delays[0]);
+
+    // Shutdown is not blocked by supervisor
+    auto start = std::chrono::steady_clock::now();
+    server.shutdown();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+    unlink("./cppev_test_prefork.sock");
+}
+
+}   // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -2,6 +2,8 @@
 #include <ratio>
 #include <unordered_map>
 #include <chrono>
+#include <mutex>
+#include <atomic>
 #include <gtest/gtest.h>
 #include "cppev/scheduler.h"
 
@@ -141,6 +143,208 @@ TEST_F(TestTimedScheduler, test_timed_scheduler_several_timed_task)
     }
 }
 
+TEST_F(TestTimedScheduler, test_timed_scheduler_coprime_frequency)
+{
+    int count1 = 0;
+    int count2 = 0;
+    total_time_ms = 1000;
+    double freq1 = 7;
+    double freq2 = 13;
+    double freq3 = 1000;
+
+    {
+        timed_scheduler executor({
+            { freq1, priority::p0, [&](const std::chrono::nanoseconds &) { ++count1; } },
+            { freq2, priority::p1, [&](const std::chrono::nanoseconds &) { ++count2; } },
+            { freq3, priority::p2, task },
+        }, {}, {}, false);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(total_time_ms));
+    }
+
+    CHECK_UNALIGNED_TRIGGER_COUNT(count1, freq1, total_time_ms, 0.2);
+
+    CHECK_UNALIGNED_TRIGGER_COUNT(count2, freq2, total_time_ms, 0.2);
+
+    CHECK_UNALIGNED_TRIGGER_COUNT(count, freq3, total_time_ms, err_percent);
+}
+
+TEST_F(TestTimedScheduler, test_timed_scheduler_add_remove_task)
+{
+    std::mutex lock;
+    std::vector<int64_t> stamps1;
+    std::vector<int64_t> stamps2;
+    auto record = [&](std::vector<int64_t> &stamps)
+    {
+        return [&](const std::chrono::nanoseconds &stamp)
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            stamps.push_back(stamp.count());
+        };
+    };
+
+    {
+        timed_scheduler<std::chrono::steady_clock> executor({}, {}, {}, false);
+        int64_t id1 = executor.add_task(100, priority::p0, record(stamps1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(105));
+        int64_t id2 = executor.add_task(100, priority::p1, record(stamps2));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_TRUE(executor.remove_task(id1));
+        EXPECT_FALSE(executor.remove_task(id1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_TRUE(executor.remove_task(id2));
+        EXPECT_THROW(executor.add_task(0, priority::p0, task), std::logic_error);
+    }
+
+    std::unique_lock<std::mutex> lk(lock);
+    EXPECT_GE(stamps1.size(), 18);
+    EXPECT_LE(stamps1.size(), 22);
+    EXPECT_GE(stamps2.size(), 18);
+    EXPECT_LE(stamps2.size(), 22);
+
+    // Tasks of the same frequency share the same phase
+    for (auto stamp : stamps2)
+    {
+        EXPECT_EQ((stamp - stamps1.front()) % 10'000'000, 0);
+    }
+}
+
+class TestTimedSchedulerOverrun
+: public testing::TestWithParam<overrun_policy>
+{
+};
+
+TEST_P(TestTimedSchedulerOverrun, test_timed_scheduler_overrun_policy)
+{
+    std::mutex lock;
+    std::vector<int64_t> stamps;
+    auto handler = [&](const std::chrono::nanoseconds &stamp)
+    {
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            stamps.push_back(stamp.count());
+        }
+        if (stamps.size() == 1)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(35));
+        }
+    };
+
+    const int64_t interval = 10'000'000;
+    timed_task_stats stats;
+    {
+        timed_scheduler<std::chrono::steady_clock> executor({}, {}, {}, false);
+        int64_t id = executor.add_task(100, priority::p0, handler, GetParam());
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        stats = executor.task_stats(id);
+        EXPECT_THROW(executor.task_stats(id + 1), std::logic_error);
+    }
+
+    std::unique_lock<std::mutex> lk(lock);
+    ASSERT_GE(stamps.size(), 5);
+    EXPECT_GE(stats.triggered + 1, static_cast<int64_t>(stamps.size()));
+    EXPECT_LE(stats.triggered, static_cast<int64_t>(stamps.size()));
+    EXPECT_GE(stats.overruns, 1);
+    EXPECT_GE(stats.run_time_max, 35'000'000);
+    EXPECT_GE(stats.run_time_total, stats.run_time_max);
+    int64_t histogram_total = 0;
+    for (auto count : stats.lateness)
+    {
+        histogram_total += count;
+    }
+    EXPECT_EQ(histogram_total, stats.triggered);
+
+    switch (GetParam())
+    {
+    case overrun_policy::catch_up :
+        // Missed ticks are triggered, so the stamps stay on the original grid
+        EXPECT_EQ(stamps[1] - stamps[0], interval);
+        EXPECT_EQ(stamps[3] - stamps[0], 3 * interval);
+        EXPECT_EQ(stats.skipped, 0);
+        break;
+    case overrun_policy::skip :
+        EXPECT_GE(stats.skipped, 3);
+        EXPECT_LE(stats.skipped, 5);
+        EXPECT_EQ(stamps[1] - stamps[0], (stats.skipped + 1) * interval);
+        break;
+    case overrun_policy::shift_phase :
+        EXPECT_GE(stamps[1] - stamps[0], 35'000'000 + interval);
+        EXPECT_NE((stamps[1] - stamps[0]) % interval, 0);
+        EXPECT_EQ(stamps[2] - stamps[1], interval);
+        EXPECT_EQ(stats.skipped, 0);
+        break;
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(CppevTest, TestTimedSchedulerOverrun,
+    testing::Values(
+        overrun_policy::catch_up,
+        overrun_policy::skip,
+        overrun_policy::shift_phase
+    )
+);
+
+TEST_F(TestTimedScheduler, test_timed_scheduler_dispatch_to_pool)
+{
+    std::atomic<int> running(0);
+    std::atomic<int> max_running(0);
+    std::atomic<int> slow_count(0);
+    auto slow_task = [&](const std::chrono::nanoseconds &)
+    {
+        int curr = running.fetch_add(1) + 1;
+        int prev = max_running.load();
+        while (prev < curr && !max_running.compare_exchange_weak(prev, curr))
+        {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        slow_count.fetch_add(1);
+        running.fetch_sub(1);
+    };
+
+    std::atomic<int> fast_count(0);
+    total_time_ms = 500;
+    thread_pool_task_queue tp(2);
+    tp.run();
+    timed_task_stats stats;
+    {
+        timed_scheduler<std::chrono::steady_clock> executor({}, {}, {}, false);
+        executor.add_task(freq, priority::p0,
+            [&](const std::chrono::nanoseconds &) { fast_count.fetch_add(1); });
+        int64_t id = executor.add_task(100, priority::p6, slow_task, overrun_policy::catch_up, &tp);
+        std::this_thread::sleep_for(std::chrono::milliseconds(total_time_ms));
+        stats = executor.task_stats(id);
+    }
+    tp.stop();
+
+    CHECK_UNALIGNED_TRIGGER_COUNT(fast_count.load(), freq, total_time_ms, err_percent);
+    EXPECT_EQ(max_running, 1);
+    EXPECT_GE(slow_count, total_time_ms / 40);
+    EXPECT_LE(slow_count, total_time_ms / 30 + 1);
+    EXPECT_GT(stats.skipped, 0);
+    EXPECT_EQ(stats.overruns, stats.skipped);
+    EXPECT_GE(stats.run_time_max, 30'000'000);
+}
+
+TEST_F(TestTimedScheduler, test_timed_scheduler_dispatch_to_stopped_pool)
+{
+    std::atomic<int> count(0);
+    thread_pool_task_queue tp(1);
+    tp.run();
+    {
+        timed_scheduler<std::chrono::steady_clock> executor({}, {}, {}, false);
+        executor.add_task(100, priority::p0,
+            [&](const std::chrono::nanoseconds &) { count.fetch_add(1); },
+            overrun_policy::catch_up, &tp);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        tp.stop();
+        int stopped = count.load();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        // Rejected by the stopped pool, and the scheduler is still destructible
+        EXPECT_EQ(count.load(), stopped);
+    }
+    EXPECT_GT(count, 0);
+}
+
 }   // namespace cppev
 
 int main(int argc, char **argv)
@@ -0,0 +1,282 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "cppev/ipc.h"
+#include "cppev/lock.h"
+#include "cppev/seqlock.h"
+
+namespace cppev
+{
+
+struct triple
+{
+    int64_t a;
+
+    int64_t b;
+
+    int64_t c;
+};
+
+// Entries are all equal to version in a consistent table
+struct route_table
+{
+    int64_t version;
+
+    int64_t entries[512];
+};
+
+class TestSeqlock
+: public testing::Test
+{
+protected:
+    TestSeqlock()
+    : name_("/cppev_test_seqlock")
+    {
+    }
+
+    void SetUp() override
+    {
+        shm_unlink(name_.c_str());
+    }
+
+    void TearDown() override
+    {
+        shm_unlink(name_.c_str());
+    }
+
+    std::string name_;
+};
+
+TEST_F(TestSeqlock, test_seqlock)
+{
+    seqlock lock;
+    EXPECT_EQ(lock.sequence(), 0);
+    {
+        std::unique_lock<seqlock> lk(lock);
+        EXPECT_EQ(lock.sequence(), 1);
+        EXPECT_FALSE(lock.try_lock());
+    }
+    EXPECT_EQ(lock.sequence(), 2);
+    uint32_t seq = lock.read_begin();
+    EXPECT_FALSE(lock.read_retry(seq));
+    lock.lock();
+    lock.unlock();
+    EXPECT_TRUE(lock.read_retry(seq));
+}
+
+TEST_F(TestSeqlock, test_seq_value)
+{
+    seq_value<triple> value(triple{ 0, 0, 0 });
+    std::atomic<bool> stop(false);
+    int64_t writes = 100000;
+
+    std::vector<std::thread> readers;
+    std::atomic<int64_t> reads(0);
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]()
+        {
+            int64_t last = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                triple t = value.load();
+                ASSERT_EQ(t.b, t.a * 2);
+                ASSERT_EQ(t.c, t.a * 3);
+                ASSERT_GE(t.a, last);
+                last = t.a;
+                reads.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    // Readers may be not scheduled yet on few cores
+    while (reads.load() == 0)
+    {
+        std::this_thread::yield();
+    }
+    for (int64_t i = 1; i <= writes; ++i)
+    {
+        if (i % 2)
+        {
+            value.store(triple{ i, i * 2, i * 3 });
+        }
+        else
+        {
+            value.update([](triple &t) { ++t.a; t.b = t.a * 2; t.c = t.a * 3; });
+        }
+    }
+    stop = true;
+    for (auto &thr : readers)
+    {
+        thr.join();
+    }
+    EXPECT_EQ(value.load().a, writes);
+    EXPECT_EQ(value.sequence(), writes * 2);
+    EXPECT_GT(reads, 0);
+}
+
+TEST_F(TestSeqlock, test_snapshot_by_fork)
+{
+    shared_memory shm(name_, sizeof(snapshot<route_table>));
+    snapshot<route_table> *snap = shm.construct<snapshot<route_table>>(route_table{});
+    int publishes = 2000;
+    int procs = 3;
+
+    std::vector<pid_t> pids;
+    for (int p = 0; p < procs; ++p)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            throw_system_error("fork error");
+        }
+        else if (pid == 0)
+        {
+            shared_memory shm1(name_, sizeof(snapshot<route_table>));
+            const snapshot<route_table> *snap1 = static_cast<snapshot<route_table> *>(shm1.ptr());
+            int64_t last = 0;
+            while (last < publishes)
+            {
+                int64_t version = -1;
+                bool consistent = true;
+                snap1->read([&](const route_table &t)
+                {
+                    version = t.version;
+                    consistent = true;
+                    for (int64_t e : t.entries)
+                    {
+                        consistent = consistent && e == version;
+                    }
+                });
+                if (!consistent || version < last)
+                {
+                    _exit(1);
+                }
+                last = version;
+            }
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for (int i = 1; i <= publishes; ++i)
+    {
+        snap->publish([i](route_table &t)
+        {
+            t.version = i;
+            for (int64_t &e : t.entries)
+            {
+                e = i;
+            }
+        });
+    }
+    for (pid_t pid : pids)
+    {
+        int ret = -1;
+        waitpid(pid, &ret, 0);
+        EXPECT_EQ(ret, 0);
+    }
+    EXPECT_EQ(snap->version(), publishes);
+    EXPECT_EQ(snap->load().entries[511], publishes);
+}
+
+TEST_F(TestSeqlock, test_snapshot_concurrent_publish)
+{
+    snapshot<route_table> snap(route_table{});
+    int publishes = 20000;
+    int writers = 2;
+
+    // Each publish builds on the data of the previous one, whichever thread wrote it
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; ++w)
+    {
+        threads.emplace_back([&]()
+        {
+            for (int i = 0; i < publishes; ++i)
+            {
+                snap.publish([](route_table &t)
+                {
+                    ++t.version;
+                    for (int64_t &e : t.entries)
+                    {
+                        ++e;
+                    }
+                });
+            }
+        });
+    }
+    for (auto &thr : threads)
+    {
+        thr.join();
+    }
+    route_table table = snap.load();
+    EXPECT_EQ(snap.version(), publishes * writers);
+    EXPECT_EQ(table.version, publishes * writers);
+    for (int64_t e : table.entries)
+    {
+        ASSERT_EQ(e, publishes * writers);
+    }
+}
+
+TEST_F(TestSeqlock, test_read_performance)
+{
+    int thr_num = 4;
+    auto span = std::chrono::milliseconds(200);
+
+    auto run_readers = [&](const std::function<void()> &read_once) -> double
+    {
+        std::atomic<bool> stop(false);
+        std::atomic<int64_t> reads(0);
+        std::vector<std::thread> thrs;
+        for (int i = 0; i < thr_num; ++i)
+        {
+            thrs.emplace_back([&]()
+            {
+                int64_t n = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    read_once();
+                    ++n;
+                }
+                reads.fetch_add(n);
+            });
+        }
+        std::this_thread::sleep_for(span);
+        stop = true;
+        for (auto &thr : thrs)
+        {
+            thr.join();
+        }
+        return reads.load() / std::chrono::duration_cast<std::chrono::duration<double>>(span).count();
+    };
+
+    seq_value<triple> value(triple{ 1, 2, 3 });
+    double seq_rate = run_readers([&]()
+    {
+        triple t = value.load();
+        ASSERT_EQ(t.b, 2);
+    });
+
+    pshared_rwlock rwlock;
+    triple data{ 1, 2, 3 };
+    double rw_rate = run_readers([&]()
+    {
+        rdlockguard lg(rwlock);
+        ASSERT_EQ(data.b, 2);
+    });
+
+    std::cout << "reads of " << thr_num << " threads, seq_value : " << static_cast<int64_t>(seq_rate)
+        << " /s, pshared_rwlock : " << static_cast<int64_t>(rw_rate) << " /s" << std::endl;
+}
+
+}   // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
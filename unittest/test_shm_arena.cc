@@ -0,0 +1,282 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "cppev/ipc.h"
+#include "cppev/shm_arena.h"
+
+namespace cppev
+{
+
+class TestShmArena
+: public testing::Test
+{
+protected:
+    TestShmArena()
+    : name_("/cppev_test_shm_arena")
+    {
+    }
+
+    void SetUp() override
+    {
+        shm_unlink(name_.c_str());
+    }
+
+    void TearDown() override
+    {
+        shm_unlink(name_.c_str());
+    }
+
+    std::string name_;
+};
+
+TEST_F(TestShmArena, test_allocate)
+{
+    shared_memory shm(name_, 1 << 20);
+    shm_arena *arena = shm_arena::attach(shm);
+    EXPECT_EQ(arena->capacity(), static_cast<size_t>(1 << 20));
+    EXPECT_EQ(arena->allocated(), 0);
+
+    EXPECT_EQ(shm_arena::block_size(1), 16);
+    EXPECT_EQ(shm_arena::block_size(64), 64);
+    EXPECT_EQ(shm_arena::block_size(65), 80);
+    EXPECT_EQ(shm_arena::block_size(128), 128);
+    EXPECT_EQ(shm_arena::block_size(129), 160);
+    for (size_t size = 1; size < 100000; size = size * 3 / 2 + 1)
+    {
+        size_t bsize = shm_arena::block_size(size);
+        EXPECT_GE(bsize, size);
+        EXPECT_LE(bsize, size + size / 4 + 16);
+    }
+
+    // Freed block is reused by the same size class
+    void *p1 = arena->allocate(100);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(p1) % 16, 0);
+    EXPECT_EQ(arena->allocated(), shm_arena::block_size(100));
+    arena->deallocate(p1, 100);
+    EXPECT_EQ(arena->allocated(), 0);
+    void *p2 = arena->allocate(110);
+    EXPECT_EQ(p1, p2);
+    arena->deallocate(p2, 110);
+
+    size_t reserved = arena->reserved();
+    std::vector<void *> ptrs;
+    for (int i = 0; i < 1000; ++i)
+    {
+        ptrs.push_back(arena->allocate(i % 300 + 1));
+        memset(ptrs.back(), i & 0xff, i % 300 + 1);
+    }
+    for (int i = 0; i < 1000; ++i)
+    {
+        EXPECT_EQ(static_cast<unsigned char *>(ptrs[i])[i % 300], static_cast<unsigned char>(i & 0xff));
+        arena->deallocate(ptrs[i], i % 300 + 1);
+    }
+    EXPECT_EQ(arena->allocated(), 0);
+    size_t reserved_after = arena->reserved();
+    for (int i = 0; i < 1000; ++i)
+    {
+        ptrs[i] = arena->allocate(i % 300 + 1);
+    }
+    EXPECT_EQ(arena->reserved(), reserved_after);
+    EXPECT_GT(reserved_after, reserved);
+
+    EXPECT_THROW(arena->allocate(1 << 20), std::runtime_error);
+}
+
+TEST_F(TestShmArena, test_concurrent_allocate)
+{
+    shared_memory shm(name_, 16 << 20);
+    shm_arena *arena = shm_arena::attach(shm);
+
+    int thr_num = 8;
+    int rounds = 20000;
+    std::vector<std::thread> thrs;
+    for (int t = 0; t < thr_num; ++t)
+    {
+        thrs.emplace_back([=]()
+        {
+            std::vector<std::pair<unsigned char *, size_t>> blocks;
+            for (int i = 0; i < rounds; ++i)
+            {
+                if (blocks.size() < 64 && (i % 3 != 2 || blocks.empty()))
+                {
+                    size_t size = (i * 7 + t * 13) % 200 + 1;
+                    unsigned char *p = static_cast<unsigned char *>(arena->allocate(size));
+                    memset(p, t, size);
+                    blocks.emplace_back(p, size);
+                }
+                else
+                {
+                    auto blk = blocks.back();
+                    blocks.pop_back();
+                    for (size_t j = 0; j < blk.second; ++j)
+                    {
+                        ASSERT_EQ(blk.first[j], t);
+                    }
+                    arena->deallocate(blk.first, blk.second);
+                }
+            }
+            for (auto &blk : blocks)
+            {
+                arena->deallocate(blk.first, blk.second);
+            }
+        });
+    }
+    for (auto &thr : thrs)
+    {
+        thr.join();
+    }
+    EXPECT_EQ(arena->allocated(), 0);
+}
+
+TEST_F(TestShmArena, test_containers)
+{
+    shared_memory shm(name_, 4 << 20);
+    shm_arena *arena = shm_arena::attach(shm);
+
+    shm_string *str = arena->construct<shm_string>("cppev");
+    EXPECT_EQ(*str, "cppev");
+    str->append(" is a c++ event driven library");
+    str->push_back('!');
+    EXPECT_EQ(str->str(), "cppev is a c++ event driven library!");
+    EXPECT_EQ(strlen(str->c_str()), str->size());
+    str->assign(std::string_view(*str).substr(6));
+    EXPECT_EQ(*str, "is a c++ event driven library!");
+    *str = "";
+    EXPECT_TRUE(str->empty());
+    EXPECT_STREQ(str->c_str(), "");
+    arena->destroy(str);
+
+    shm_vector<int> *vec = arena->construct<shm_vector<int>>();
+    for (int i = 0; i < 1000; ++i)
+    {
+        vec->push_back(i);
+    }
+    vec->push_back((*vec)[999]);
+    EXPECT_EQ(vec->size(), 1001);
+    EXPECT_EQ(vec->back(), 999);
+    EXPECT_THROW(vec->at(1001), std::logic_error);
+    vec->resize(10);
+    int sum = 0;
+    for (int v : *vec)
+    {
+        sum += v;
+    }
+    EXPECT_EQ(sum, 45);
+    arena->destroy(vec);
+
+    // Elements get the arena
+    shm_vector<shm_string> *strs = arena->construct<shm_vector<shm_string>>();
+    for (int i = 0; i < 100; ++i)
+    {
+        strs->emplace_back(std::to_string(i));
+    }
+    {
+        shm_vector<shm_string> copied(*strs);
+        EXPECT_EQ(copied.size(), 100);
+        EXPECT_EQ(copied[42], "42");
+    }
+    arena->destroy(strs);
+
+    shm_hash_map<shm_string, shm_vector<int>> *map =
+        arena->construct<shm_hash_map<shm_string, shm_vector<int>>>();
+    for (int i = 0; i < 1000; ++i)
+    {
+        auto ret = map->emplace(std::to_string(i));
+        EXPECT_TRUE(ret.second);
+        ret.first->push_back(i);
+        ret.first->push_back(i * 2);
+    }
+    EXPECT_FALSE(map->emplace(std::string("10")).second);
+    EXPECT_EQ(map->size(), 1000);
+    EXPECT_GE(map->bucket_count(), 1000);
+    EXPECT_EQ((*map->find(std::string("500")))[1], 1000);
+    EXPECT_EQ(map->find("1000"), nullptr);
+    EXPECT_TRUE(map->erase("500"));
+    EXPECT_FALSE(map->erase("500"));
+    EXPECT_FALSE(map->contains("500"));
+    (*map)["500"].push_back(7);
+    EXPECT_EQ((*map)["500"].size(), 1);
+    int count = 0;
+    map->for_each([&](const shm_string &, shm_vector<int> &v) { count += v.size(); });
+    EXPECT_EQ(count, 1999);
+    arena->destroy(map);
+    EXPECT_EQ(arena->allocated(), 0);
+}
+
+TEST_F(TestShmArena, test_share_by_fork)
+{
+    using table = shm_hash_map<shm_string, shm_vector<int64_t>>;
+    int entries = 10000;
+
+    shared_memory shm(name_, 16 << 20);
+    shm_arena *arena = shm_arena::attach(shm);
+    table *tbl = arena->construct<table>();
+    tbl->reserve(entries);
+    for (int i = 0; i < entries; ++i)
+    {
+        shm_vector<int64_t> &v = *tbl->emplace("key" + std::to_string(i)).first;
+        for (int j = 0; j <= i % 10; ++j)
+        {
+            v.push_back(static_cast<int64_t>(i) * j);
+        }
+    }
+    arena->set_root(tbl);
+
+    for (int p = 0; p < 4; ++p)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            throw_system_error("fork error");
+        }
+        else if (pid == 0)
+        {
+            // Mapped again, so the address differs from the parent's
+            shared_memory shm1(name_, 16 << 20);
+            shm_arena *arena1 = shm_arena::attach(shm1);
+            if (arena1 == arena)
+            {
+                _exit(1);
+            }
+            const table *t = arena1->root<table>();
+            for (int i = 0; i < entries; ++i)
+            {
+                const shm_vector<int64_t> *v = t->find("key" + std::to_string(i));
+                if (v == nullptr || v->size() != static_cast<size_t>(i % 10 + 1) ||
+                    (*v)[v->size() - 1] != static_cast<int64_t>(i) * (i % 10))
+                {
+                    _exit(2);
+                }
+            }
+            // Writes are seen by parent
+            shm_string *s = arena1->construct<shm_string>("from child " + std::to_string(p));
+            arena1->root<table>()->emplace("child" + std::to_string(p))
+                .first->push_back(reinterpret_cast<char *>(s) - static_cast<char *>(shm1.ptr()));
+            _exit(0);
+        }
+        int ret = -1;
+        waitpid(pid, &ret, 0);
+        EXPECT_EQ(ret, 0);
+    }
+
+    for (int p = 0; p < 4; ++p)
+    {
+        const shm_vector<int64_t> *v = tbl->find("child" + std::to_string(p));
+        ASSERT_NE(v, nullptr);
+        shm_string *s = reinterpret_cast<shm_string *>(static_cast<char *>(shm.ptr()) + (*v)[0]);
+        EXPECT_EQ(*s, "from child " + std::to_string(p));
+    }
+}
+
+}   // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,219 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "cppev/ipc.h"
+#include "cppev/shm_cache.h"
+
+namespace cppev
+{
+
+class TestShmCache
+: public testing::Test
+{
+protected:
+    TestShmCache()
+    : name_("/cppev_test_shm_cache")
+    {
+    }
+
+    void SetUp() override
+    {
+        shm_unlink(name_.c_str());
+    }
+
+    void TearDown() override
+    {
+        shm_unlink(name_.c_str());
+    }
+
+    std::string name_;
+};
+
+TEST_F(TestShmCache, test_get_put_erase)
+{
+    shared_memory shm(name_, 1 << 20);
+    shm_cache *cache = shm_cache::attach(shm, 100);
+    EXPECT_EQ(cache->capacity(), 104);
+    int64_t allocated = cache->stats().allocated;
+
+    std::string value;
+    EXPECT_FALSE(cache->get("cppev", value));
+    EXPECT_TRUE(cache->put("cppev", "event driven"));
+    EXPECT_TRUE(cache->get("cppev", value));
+    EXPECT_EQ(value, "event driven");
+    EXPECT_TRUE(cache->put("cppev", "c++ library"));
+    EXPECT_TRUE(cache->get("cppev", value));
+    EXPECT_EQ(value, "c++ library");
+    EXPECT_EQ(cache->stats().size, 1);
+
+    EXPECT_TRUE(cache->put("", ""));
+    EXPECT_TRUE(cache->get("", value));
+    EXPECT_EQ(value, "");
+
+    EXPECT_TRUE(cache->erase("cppev"));
+    EXPECT_FALSE(cache->erase("cppev"));
+    EXPECT_FALSE(cache->get("cppev", value));
+    EXPECT_TRUE(cache->erase(""));
+    EXPECT_EQ(cache->stats().size, 0);
+    EXPECT_EQ(cache->stats().allocated, allocated);
+
+    // Too large for the arena
+    EXPECT_FALSE(cache->put("large", std::string(2 << 20, 'x')));
+}
+
+TEST_F(TestShmCache, test_eviction)
+{
+    shared_memory shm(name_, 1 << 20);
+    shm_cache *cache = shm_cache::attach(shm, 64);
+
+    // Referenced entries survive the bucket eviction
+    std::string value;
+    for (int i = 0; i < 1000; ++i)
+    {
+        ASSERT_TRUE(cache->put("key" + std::to_string(i), std::to_string(i)));
+        EXPECT_TRUE(cache->get("key0", value));
+        EXPECT_EQ(value, "0");
+    }
+    EXPECT_LE(cache->stats().size, 64);
+    EXPECT_GT(cache->stats().evictions, 0);
+
+    // Arena eviction, each value takes about one tenth of arena
+    std::string large(100 << 10, 'v');
+    for (int i = 0; i < 100; ++i)
+    {
+        ASSERT_TRUE(cache->put("large" + std::to_string(i), large));
+        EXPECT_TRUE(cache->get("large" + std::to_string(i), value));
+        EXPECT_EQ(value, large);
+    }
+    EXPECT_LE(cache->stats().allocated, 1 << 20);
+}
+
+TEST_F(TestShmCache, test_eviction_mixed_sizes)
+{
+    shared_memory shm(name_, 1 << 20);
+    shm_cache *cache = shm_cache::attach(shm, 4096);
+
+    // Fill the arena with small entries
+    std::string small(4000, 's');
+    int count = 0;
+    while (cache->stats().evictions == 0)
+    {
+        ASSERT_TRUE(cache->put("small" + std::to_string(count++), small));
+    }
+    int64_t size = cache->stats().size;
+    int64_t evictions = cache->stats().evictions;
+    EXPECT_GT(size, 200);
+
+    // No entry of the class to be evicted, small entries are kept
+    std::string value;
+    EXPECT_FALSE(cache->put("large", std::string(64 << 10, 'l')));
+    EXPECT_EQ(cache->stats().size, size);
+    EXPECT_EQ(cache->stats().evictions, evictions);
+    EXPECT_TRUE(cache->get("small" + std::to_string(count - 1), value));
+    EXPECT_EQ(value, small);
+
+    // Entries of the same class are evicted one by one
+    for (int i = 0; i < 10; ++i)
+    {
+        ASSERT_TRUE(cache->put("other" + std::to_string(i), std::string(3990, 'o')));
+        EXPECT_TRUE(cache->get("other" + std::to_string(i), value));
+        EXPECT_EQ(cache->stats().size, size);
+    }
+    EXPECT_EQ(cache->stats().evictions, evictions + 10);
+
+    // Freed blocks of another class are not reused
+    std::string medium(5000, 'm');
+    for (int i = 0; i < 10; ++i)
+    {
+        EXPECT_TRUE(cache->erase("other" + std::to_string(i)));
+    }
+    EXPECT_FALSE(cache->put("medium", medium));
+    EXPECT_EQ(cache->stats().size, size - 10);
+    EXPECT_TRUE(cache->put("small", small));
+    EXPECT_EQ(cache->stats().size, size - 9);
+}
+
+TEST_F(TestShmCache, test_share_by_fork)
+{
+    int procs = 4;
+    int keys = 2000;
+    int rounds = 20000;
+    auto value_of = [](int k) { return std::string(k % 100 + 1, 'a' + k % 26) + std::to_string(k); };
+
+    shared_memory shm(name_, 8 << 20);
+    shm_cache *cache = shm_cache::attach(shm, keys);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<pid_t> pids;
+    for (int p = 0; p < procs; ++p)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            throw_system_error("fork error");
+        }
+        else if (pid == 0)
+        {
+            shared_memory shm1(name_, 8 << 20);
+            shm_cache *cache1 = shm_cache::attach(shm1, keys);
+            std::string value;
+            for (int i = 0; i < rounds; ++i)
+            {
+                int k = (i * 7919 + p * 104729) % keys;
+                if (cache1->get("key" + std::to_string(k), value))
+                {
+                    if (value != value_of(k))
+                    {
+                        _exit(1);
+                    }
+                }
+                else if (!cache1->put("key" + std::to_string(k), value_of(k)))
+                {
+                    _exit(2);
+                }
+                if (i % 100 == 0)
+                {
+                    cache1->erase("key" + std::to_string((k + 1) % keys));
+                }
+            }
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for (pid_t pid : pids)
+    {
+        int ret = -1;
+        waitpid(pid, &ret, 0);
+        EXPECT_EQ(ret, 0);
+    }
+    double span = std::chrono::duration_cast<std::chrono::duration<double>>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << "shm cache with " << procs << " processes : "
+        << static_cast<int64_t>(procs * rounds / span) << " ops/s" << std::endl;
+
+    std::string value;
+    int hits = 0;
+    for (int k = 0; k < keys; ++k)
+    {
+        if (cache->get("key" + std::to_string(k), value))
+        {
+            EXPECT_EQ(value, value_of(k));
+            ++hits;
+        }
+    }
+    EXPECT_GT(hits, 0);
+    EXPECT_EQ(hits, cache->stats().size);
+}
+
+}   // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
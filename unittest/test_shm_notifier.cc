@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "cppev/ipc.h"
+#include "cppev/nio.h"
+#include "cppev/event_loop.h"
+#include "cppev/shm_ring.h"
+#include "cppev/shm_notifier.h"
+
+namespace cppev
+{
+
+#ifdef __linux__
+
+class TestShmNotifier
+: public testing::Test
+{
+protected:
+    TestShmNotifier()
+    : name_("/cppev_test_shm_notifier"), ring_name_("/cppev_test_shm_notifier_ring")
+    {
+    }
+
+    void SetUp() override
+    {
+        shm_unlink(name_.c_str());
+        shm_unlink(ring_name_.c_str());
+    }
+
+    void TearDown() override
+    {
+        shm_unlink(name_.c_str());
+        shm_unlink(ring_name_.c_str());
+    }
+
+    std::string name_;
+
+    std::string ring_name_;
+};
+
+TEST_F(TestShmNotifier, test_coalesce)
+{
+    shared_memory shm(name_, shm_notifier::required_size());
+    shm_notifier notifier(shm);
+    event_loop evlp;
+    int callbacks = 0;
+    evlp.fd_register(notifier.ev(), fd_event::fd_readable,
+        [&](const std::shared_ptr<nio> &)
+        {
+            ++callbacks;
+            EXPECT_TRUE(notifier.rearm());
+        }
+    );
+
+    // Burst of notifies wakes consumer once
+    for (int i = 0; i < 10000; ++i)
+    {
+        notifier.notify();
+    }
+    EXPECT_EQ(notifier.wakeups(), 1);
+    evlp.loop_once(100);
+    EXPECT_EQ(callbacks, 1);
+    evlp.loop_once(0);
+    EXPECT_EQ(callbacks, 1);
+
+    // Notify after rearm wakes again
+    notifier.notify();
+    notifier.notify();
+    EXPECT_EQ(notifier.wakeups(), 2);
+    evlp.loop_once(100);
+    EXPECT_EQ(callbacks, 2);
+
+    EXPECT_FALSE(notifier.rearm());
+    evlp.fd_remove(notifier.ev());
+}
+
+TEST_F(TestShmNotifier, test_ring_feed_by_fork)
+{
+    int count = 100000;
+    shared_memory shm(name_, shm_notifier::required_size());
+    shared_memory ring_shm(ring_name_, shm_ring::required_size(1 << 16));
+    shm_notifier notifier(shm);
+    shm_ring ring(ring_shm, shm_ring_mode::spsc);
+    auto pipes = nio_factory::get_pipes();
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw_system_error("fork error");
+    }
+    else if (pid == 0)
+    {
+        // Eventfd is inherited, shared memory is opened by name
+        shared_memory child_shm(name_, shm_notifier::required_size());
+        shared_memory child_ring_shm(ring_name_, shm_ring::required_size(1 << 16));
+        shm_notifier child_notifier(child_shm, dup(notifier.fd()));
+        shm_ring child_ring(child_ring_shm, shm_ring_mode::spsc);
+        for (int i = 0; i < count; ++i)
+        {
+            shm_ring::slot s = child_ring.reserve(sizeof(int));
+            memcpy(s.data, &i, sizeof(int));
+            child_ring.commit(s);
+            child_notifier.notify();
+        }
+        pipes[1]->wbuffer().put_string("done");
+        pipes[1]->write_all();
+        _exit(0);
+    }
+
+    // One event loop serves both the shm feed and the pipe
+    event_loop evlp;
+    int next = 0;
+    bool done = false;
+    bool ordered = true;
+    int callbacks = 0;
+    evlp.fd_register(notifier.ev(), fd_event::fd_readable,
+        [&](const std::shared_ptr<nio> &)
+        {
+            ++callbacks;
+            notifier.rearm();
+            for (shm_ring::slot s = ring.try_peek(); s.data != nullptr; s = ring.try_peek())
+            {
+                int i;
+                memcpy(&i, s.data, sizeof(int));
+                ordered = ordered && i == next;
+                ++next;
+                ring.release(s);
+            }
+        }
+    );
+    evlp.fd_register(std::dynamic_pointer_cast<nio>(pipes[0]), fd_event::fd_readable,
+        [&](const std::shared_ptr<nio> &iop)
+        {
+            auto iopt = std::dynamic_pointer_cast<nstream>(iop);
+            iopt->read_all();
+            done = iopt->rbuffer().get_string(-1, false) == "done";
+        }
+    );
+    while (next < count || !done)
+    {
+        evlp.loop_once(10000);
+    }
+    EXPECT_TRUE(ordered);
+    EXPECT_EQ(next, count);
+    EXPECT_LE(static_cast<uint64_t>(callbacks), notifier.wakeups());
+    EXPECT_LE(notifier.wakeups(), static_cast<uint64_t>(count));
+    std::cout << "shm notifier : " << count << " notifies, " << notifier.wakeups()
+        << " wakeups" << std::endl;
+
+    int ret = -1;
+    waitpid(pid, &ret, 0);
+    EXPECT_EQ(ret, 0);
+}
+
+#endif  // __linux__
+
+}   // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "cppev/ipc.h"
+#include "cppev/shm_ring.h"
+
+namespace cppev
+{
+
+class TestShmRing
+: public testing::TestWithParam<shm_ring_mode>
+{
+protected:
+    TestShmRing()
+    : name_("/cppev_test_shm_ring")
+    {
+    }
+
+    void SetUp() override
+    {
+        shm_unlink(name_.c_str());
+    }
+
+    void TearDown() override
+    {
+        shm_unlink(name_.c_str());
+    }
+
+    std::string name_;
+};
+
+TEST_P(TestShmRing, test_reserve_commit)
+{
+    shared_memory shm(name_, shm_ring::required_size(1024));
+    shm_ring ring(shm, GetParam());
+    EXPECT_EQ(ring.capacity(), 1024);
+    EXPECT_THROW(ring.try_reserve(ring.max_record() + 1), std::logic_error);
+    EXPECT_EQ(ring.try_peek().data, nullptr);
+
+    // Records wrap around the end many times
+    for (int round = 0; round < 100; ++round)
+    {
+        std::vector<size_t> lens;
+        while (true)
+        {
+            size_t len = (round * 7 + lens.size() * 13) % 200 + 1;
+            shm_ring::slot s = ring.try_reserve(len);
+            if (!s.data)
+            {
+                break;
+            }
+            memset(s.data, static_cast<int>(len), len);
+            ring.commit(s);
+            lens.push_back(len);
+        }
+        ASSERT_FALSE(lens.empty());
+        for (size_t len : lens)
+        {
+            shm_ring::slot s = ring.try_peek();
+            ASSERT_NE(s.data, nullptr);
+            ASSERT_EQ(s.size, len);
+            for (size_t i = 0; i < len; ++i)
+            {
+                ASSERT_EQ(static_cast<unsigned char>(s.data[i]), static_cast<unsigned char>(len));
+            }
+            ring.release(s);
+        }
+        EXPECT_EQ(ring.size(), 0);
+    }
+
+    // Commit less than reserved
+    shm_ring::slot s = ring.try_reserve(100);
+    memcpy(s.data, "cppev", 5);
+    ring.commit(s, 5);
+    s = ring.peek(std::chrono::milliseconds(10));
+    ASSERT_NE(s.data, nullptr);
+    EXPECT_EQ(std::string(s.data, s.size), "cppev");
+    ring.release(s);
+    EXPECT_EQ(ring.peek(std::chrono::milliseconds(10)).data, nullptr);
+}
+
+TEST_P(TestShmRing, test_ring_by_fork)
+{
+    int producers = GetParam() == shm_ring_mode::spsc ? 1 : 4;
+    int count = 200000;
+    size_t max_len = 1024;
+
+    std::vector<pid_t> pids;
+    for (int p = 0; p < producers; ++p)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            throw_system_error("fork error");
+        }
+        else if (pid == 0)
+        {
+            shared_memory shm(name_, shm_ring::required_size(1 << 20));
+            shm_ring ring(shm, GetParam());
+            for (int i = 0; i < count; ++i)
+            {
+                size_t len = sizeof(int) * 2 + i % (max_len - sizeof(int) * 2);
+                shm_ring::slot s = ring.reserve(len);
+                memcpy(s.data, &p, sizeof(int));
+                memcpy(s.data + sizeof(int), &i, sizeof(int));
+                memset(s.data + sizeof(int) * 2, i & 0xff, len - sizeof(int) * 2);
+                ring.commit(s);
+            }
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+
+    shared_memory shm(name_, shm_ring::required_size(1 << 20));
+    shm_ring ring(shm, GetParam());
+    std::vector<int> next(producers, 0);
+    int64_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t n = 0; n < static_cast<int64_t>(producers) * count; ++n)
+    {
+        shm_ring::slot s = ring.peek(std::chrono::seconds(10));
+        ASSERT_NE(s.data, nullptr);
+        int p;
+        int i;
+        memcpy(&p, s.data, sizeof(int));
+        memcpy(&i, s.data + sizeof(int), sizeof(int));
+        ASSERT_GE(p, 0);
+        ASSERT_LT(p, producers);
+        ASSERT_EQ(i, next[p]);
+        ASSERT_EQ(s.size, sizeof(int) * 2 + i % (max_len - sizeof(int) * 2));
+        if (s.size > sizeof(int) * 2)
+        {
+            ASSERT_EQ(static_cast<unsigned char>(s.data[s.size - 1]), static_cast<unsigned char>(i & 0xff));
+        }
+        ++next[p];
+        bytes += s.size;
+        ring.release(s);
+    }
+    double span = std::chrono::duration_cast<std::chrono::duration<double>>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << "shm ring with " << producers << " producers : "
+        << static_cast<int64_t>(bytes / span / (1 << 20)) << " MB/s" << std::endl;
+
+    for (pid_t pid : pids)
+    {
+        int ret = -1;
+        waitpid(pid, &ret, 0);
+        EXPECT_EQ(ret, 0);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(CppevTest, TestShmRing,
+    testing::Values(shm_ring_mode::spsc, shm_ring_mode::mpsc)
+);
+
+}   // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
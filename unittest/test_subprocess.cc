@@ -1,4 +1,8 @@
 #include <thread>
+#include <algorithm>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include <gtest/gtest.h>
 #include "cppev/subprocess.h"
 
@@ -25,6 +29,25 @@ TEST(TestSubprocessExecCmd, test_exec_cmd)
     EXPECT_STREQ(std::get<2>(rets).c_str(), "");
 }
 
+TEST(TestSubprocessExecCmd, test_exec_cmd_spawn)
+{
+    std::tuple<int, std::string, std::string> rets;
+
+    rets = subprocess::exec_cmd("printenv test", { "test=TEST" }, subp_launch::spawn);
+    EXPECT_EQ(std::get<0>(rets), 0);
+    EXPECT_STREQ(std::get<1>(rets).c_str(), "TEST\n");
+    EXPECT_STREQ(std::get<2>(rets).c_str(), "");
+
+    rets = subprocess::exec_cmd("/bin/cat /cppev/test/not/exist", {}, subp_launch::spawn);
+    EXPECT_NE(std::get<0>(rets), 0);
+    EXPECT_STREQ(std::get<1>(rets).c_str(), "");
+    EXPECT_STRNE(std::get<2>(rets).c_str(), "");
+
+    // Exec failure is reported by the launch
+    EXPECT_THROW(subprocess::exec_cmd("not_exist_cmd /cppev/test/not/exist", {}, subp_launch::spawn),
+        std::system_error);
+}
+
 #ifdef CPPEV_TEST_ENABLE_SUBPROCESS_PYTHON
 TEST(TestSubprocessExecCmd, test_exec_cmd_python)
 {
@@ -43,7 +66,7 @@ TEST(TestSubprocessExecCmd, test_exec_cmd_python)
 #endif
 
 class TestSubprocess
-: public testing::TestWithParam<std::tuple<std::string, int>>
+: public testing::TestWithParam<std::tuple<std::string, int, subp_launch>>
 {
 protected:
     void SetUp() override
@@ -59,7 +82,7 @@ TEST_P(TestSubprocess, test_subp_popen)
 {
     auto param = GetParam();
 
-    subp_open subp("cat", {});
+    subp_open subp("cat", {}, std::get<2>(param));
     subp.communicate(std::get<0>(param));
 
     subp_open subp1(std::move(subp));
@@ -82,10 +105,220 @@ TEST_P(TestSubprocess, test_subp_popen)
 INSTANTIATE_TEST_SUITE_P(CppevTest, TestSubprocess,
     testing::Combine(
         testing::Values("cppev", "event driven"),    // input
-        testing::Values(SIGTERM, SIGKILL, SIGABRT)   // signal
+        testing::Values(SIGTERM, SIGKILL, SIGABRT),  // signal
+        testing::Values(subp_launch::fork, subp_launch::spawn)   // launch
     )
 );
 
+TEST(TestSubprocessStdin, test_write_to_exited_subprocess)
+{
+    subp_open subp("true", {});
+    subp.wait();
+    // Neither killed by SIGPIPE nor ignoring it process-wide
+    subp.communicate(std::string(1 << 16, 'x'));
+    struct sigaction act;
+    sigaction(SIGPIPE, nullptr, &act);
+    EXPECT_EQ(act.sa_handler, SIG_DFL);
+    sigset_t pending;
+    sigpending(&pending);
+    EXPECT_FALSE(sigismember(&pending, SIGPIPE));
+}
+
+#ifdef __linux__
+
+int count_fds()
+{
+    int count = 0;
+    DIR *dir = opendir("/proc/self/fd");
+    while (readdir(dir) != nullptr)
+    {
+        ++count;
+    }
+    closedir(dir);
+    return count;
+}
+
+TEST(TestSubprocessFds, test_move_without_fd_leak)
+{
+    int fds = count_fds();
+    {
+        subp_open subp("true", {});
+        subp_open subp1("true", {}, subp_launch::spawn);
+        // Only the pipe ends of this process are kept
+        EXPECT_EQ(count_fds(), fds + 6);
+        subp.wait();
+        subp1.wait();
+        subp = std::move(subp1);
+        EXPECT_EQ(count_fds(), fds + 3);
+        EXPECT_EQ(subp.returncode(), 0);
+    }
+    EXPECT_EQ(count_fds(), fds);
+}
+
+TEST(TestSubprocessAsync, test_stream_output)
+{
+    int step = 4096;
+    event_loop evlp;
+    subp_async subp("seq 1 100000", {}, subp_launch::spawn, step);
+    std::string out;
+    int max_chunk = 0;
+    bool exited = false;
+    subp.set_on_stdout([&](const char *data, int len)
+    {
+        EXPECT_FALSE(exited);
+        out.append(data, len);
+        max_chunk = std::max(max_chunk, len);
+    });
+    subp.set_on_exit([&](int returncode)
+    {
+        EXPECT_EQ(returncode, 0);
+        exited = true;
+    });
+    subp.run(evlp);
+    while (!exited)
+    {
+        evlp.loop_once(5000);
+    }
+    EXPECT_TRUE(subp.exited());
+    EXPECT_LE(max_chunk, step);
+
+    std::string expected;
+    for (int i = 1; i <= 100000; ++i)
+    {
+        expected.append(std::to_string(i)).append("\n");
+    }
+    EXPECT_EQ(out, expected);
+    EXPECT_THROW(subp.kill(), std::logic_error);
+}
+
+TEST(TestSubprocessAsync, test_stdin_and_stderr)
+{
+    event_loop evlp;
+    subp_async cat("cat", {});
+    subp_async err("/bin/cat /cppev/test/not/exist", {});
+    std::string cat_out;
+    std::string err_out;
+    int exits = 0;
+    cat.set_on_stdout([&](const char *data, int len)
+    {
+        cat_out.append(data, len);
+    });
+    err.set_on_stderr([&](const char *data, int len)
+    {
+        err_out.append(data, len);
+    });
+    cat.set_on_exit([&](int) { ++exits; });
+    err.set_on_exit([&](int) { ++exits; });
+
+    // Data larger than pipe buffer is flushed when writable
+    std::string input(1 << 20, 'c');
+    cat.communicate(input);
+    cat.run(evlp);
+    err.run(evlp);
+    cat.close_stdin();
+    EXPECT_THROW(cat.communicate("cppev"), std::logic_error);
+    while (exits < 2)
+    {
+        evlp.loop_once(5000);
+    }
+    EXPECT_EQ(cat.returncode(), 0);
+    EXPECT_EQ(cat_out, input);
+    EXPECT_NE(err.returncode(), 0);
+    EXPECT_NE(err_out, "");
+}
+
+TEST(TestSubprocessAsync, test_write_to_exited_subprocess)
+{
+    event_loop evlp;
+    subp_async subp("true", {});
+    bool exited = false;
+    subp.set_on_exit([&](int) { exited = true; });
+    subp.run(evlp);
+    while (!exited)
+    {
+        evlp.loop_once(5000);
+    }
+    // Data is discarded without SIGPIPE raised or ignored process-wide
+    subp.communicate(std::string(1 << 16, 'x'));
+    struct sigaction act;
+    sigaction(SIGPIPE, nullptr, &act);
+    EXPECT_EQ(act.sa_handler, SIG_DFL);
+    sigset_t pending;
+    sigpending(&pending);
+    EXPECT_FALSE(sigismember(&pending, SIGPIPE));
+}
+
+TEST(TestSubprocessAsync, test_signal_and_many_subprocesses)
+{
+    event_loop evlp;
+    int num = 50;
+    std::vector<std::unique_ptr<subp_async>> subps;
+    std::vector<std::string> outs(num);
+    int exits = 0;
+    for (int i = 0; i < num; ++i)
+    {
+        subps.push_back(std::make_unique<subp_async>("echo " + std::to_string(i), std::vector<std::string>()));
+        subps.back()->set_on_stdout([&outs, i](const char *data, int len)
+        {
+            outs[i].append(data, len);
+        });
+        subps.back()->set_on_exit([&](int) { ++exits; });
+        subps.back()->run(evlp);
+    }
+
+    subp_async sleeper("sleep 10", {}, subp_launch::fork);
+    int status = -1;
+    sleeper.set_on_exit([&](int returncode) { status = returncode; });
+    sleeper.run(evlp);
+    sleeper.kill();
+
+    auto start = std::chrono::steady_clock::now();
+    while (exits < num || status == -1)
+    {
+        evlp.loop_once(5000);
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+    for (int i = 0; i < num; ++i)
+    {
+        EXPECT_EQ(outs[i], std::to_string(i) + "\n");
+        EXPECT_EQ(subps[i]->returncode(), 0);
+    }
+    EXPECT_TRUE(WIFSIGNALED(status));
+    EXPECT_EQ(WTERMSIG(status), SIGKILL);
+
+    subp_async not_exist("not_exist_cmd", {});
+    EXPECT_THROW(not_exist.run(evlp), std::system_error);
+}
+
+TEST(TestSubprocessAsync, test_destruct_and_detach)
+{
+    event_loop evlp;
+    pid_t killed;
+    {
+        subp_async subp("sleep 10", {});
+        subp.run(evlp);
+        killed = subp.pid();
+        EXPECT_TRUE(check_process(killed));
+    }
+    // Killed and reaped
+    EXPECT_FALSE(check_process(killed));
+
+    pid_t detached;
+    {
+        subp_async subp("sleep 10", {});
+        subp.run(evlp);
+        detached = subp.pid();
+        subp.detach();
+    }
+    EXPECT_TRUE(check_process(detached));
+    ::kill(detached, SIGKILL);
+    int ret = -1;
+    EXPECT_EQ(waitpid(detached, &ret, 0), detached);
+    EXPECT_TRUE(WIFSIGNALED(ret));
+}
+
+#endif  // __linux__
+
 }   // namespace cppev
 
 int main(int argc, char **argv)
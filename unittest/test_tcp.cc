@@ -0,0 +1,151 @@
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <gtest/gtest.h>
+#include "cppev/nio.h"
+#include "cppev/tcp.h"
+
+namespace cppev
+{
+
+const char *migration_path = "./cppev_test_migration";
+
+const int port = 8890;
+
+TEST(TestTcp, test_send_recv_fd)
+{
+    const char *path = "./cppev_test_fd_passing";
+    auto listensock = nio_factory::get_nsocktcp(family::local);
+    listensock->bind_unix(path, true);
+    listensock->listen();
+    auto sender = nio_factory::get_nsocktcp(family::local);
+    ASSERT_TRUE(sender->connect_unix(path));
+    auto conns = listensock->accept();
+    ASSERT_EQ(conns.size(), 1);
+    auto receiver = conns[0];
+
+    auto pipes = nio_factory::get_pipes();
+    sender->wbuffer().put_string("fd0");
+    EXPECT_EQ(sender->send_fd(pipes[1]->fd()), 3);
+    sender->wbuffer().put_string("data");
+    sender->write_all();
+    sender->wbuffer().put_string("fd1");
+    EXPECT_EQ(sender->send_fd(pipes[0]->fd()), 3);
+
+    std::vector<int> fds;
+    EXPECT_EQ(receiver->recv_fds(fds), 10);
+    EXPECT_EQ(receiver->rbuffer().get_string(), "fd0datafd1");
+    ASSERT_EQ(fds.size(), 2);
+
+    // Received fds refer to the same pipe
+    nstream wr(fds[0]);
+    nstream rd(fds[1]);
+    wr.wbuffer().put_string("cppev");
+    wr.write_all();
+    pipes[0]->read_all();
+    EXPECT_EQ(pipes[0]->rbuffer().get_string(), "cppev");
+    pipes[1]->wbuffer().put_string("cppev");
+    pipes[1]->write_all();
+    rd.read_all();
+    EXPECT_EQ(rd.rbuffer().get_string(), "cppev");
+
+    sender->wbuffer().put_string("end");
+    sender->write_all();
+    sender->close();
+    fds.clear();
+    receiver->recv_fds(fds);
+    EXPECT_TRUE(fds.empty());
+    EXPECT_TRUE(receiver->eof());
+    EXPECT_EQ(receiver->rbuffer().get_string(), "end");
+
+    EXPECT_THROW(sender->send_fd(pipes[0]->fd()), std::logic_error);
+    unlink(path);
+}
+
+TEST(TestTcp, test_migrate_connection)
+{
+    int clients = 8;
+    std::atomic<int> migrated(0);
+    std::atomic<int> accepted(0);
+
+    // Server reads the request, writes part of the response, then migrates the connection
+    reactor::tcp_server src(2);
+    src.set_on_read_complete([&](const std::shared_ptr<nsocktcp> &iopt)
+    {
+        iopt->wbuffer().put_string("src:");
+        if (reactor::migrate(iopt, migration_path))
+        {
+            ++migrated;
+        }
+    });
+    src.listen(port, family::ipv4);
+
+    // Server receives the connection with the carried request and response
+    reactor::tcp_server dst(2);
+    dst.set_on_accept([&](const std::shared_ptr<nsocktcp> &)
+    {
+        ++accepted;
+    });
+    dst.set_on_read_complete([&](const std::shared_ptr<nsocktcp> &iopt)
+    {
+        iopt->wbuffer().put_string("dst:" + iopt->rbuffer().get_string());
+        reactor::async_write(iopt);
+    });
+    dst.listen_migration(migration_path, true);
+
+    dst.run();
+    src.run();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::vector<std::shared_ptr<nsocktcp>> socks;
+    for (int i = 0; i < clients; ++i)
+    {
+        auto sock = nio_factory::get_nsocktcp(family::ipv4);
+        sock->set_io_block();
+        ASSERT_TRUE(sock->connect("127.0.0.1", port));
+        sock->set_io_nonblock();
+        sock->wbuffer().put_string("request" + std::to_string(i));
+        sock->write_all();
+        socks.push_back(sock);
+    }
+    for (int i = 0; i < clients; ++i)
+    {
+        std::string expected = "src:dst:request" + std::to_string(i);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (socks[i]->rbuffer().size() < static_cast<int>(expected.size()) &&
+            std::chrono::steady_clock::now() < deadline)
+        {
+            socks[i]->read_all();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_EQ(socks[i]->rbuffer().get_string(), expected);
+
+        // Connection is served by the destination afterwards
+        socks[i]->wbuffer().put_string("again");
+        socks[i]->write_all();
+        expected = "dst:again";
+        deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (socks[i]->rbuffer().size() < static_cast<int>(expected.size()) &&
+            std::chrono::steady_clock::now() < deadline)
+        {
+            socks[i]->read_all();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_EQ(socks[i]->rbuffer().get_string(), expected);
+    }
+    EXPECT_EQ(migrated, clients);
+    EXPECT_EQ(accepted, clients);
+
+    src.shutdown();
+    dst.shutdown();
+    unlink(migration_path);
+}
+
+}   // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
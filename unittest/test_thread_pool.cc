@@ -2,6 +2,11 @@
 #include "cppev/runnable.h"
 #include "cppev/thread_pool.h"
 #include <chrono>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <array>
+#include <future>
 
 namespace cppev
 {
@@ -99,6 +104,334 @@ TEST(TestThreadPool, test_thread_pool_task_queue)
     ASSERT_EQ(sum, count);
 }
 
+TEST(TestThreadPool, test_mpmc_ring)
+{
+    task_queue::mpmc_ring<int> ring(5);
+    EXPECT_EQ(ring.capacity(), 8);
+    for (int i = 0; i < 8; ++i)
+    {
+        EXPECT_TRUE(ring.try_push(std::move(i)));
+    }
+    int value = -1;
+    EXPECT_FALSE(ring.try_push(std::move(value)));
+    EXPECT_EQ(ring.size(), 8);
+    for (int i = 0; i < 8; ++i)
+    {
+        EXPECT_TRUE(ring.try_pop(value));
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_FALSE(ring.try_pop(value));
+}
+
+class TestBoundedTaskQueue
+: public testing::TestWithParam<overflow_policy>
+{
+};
+
+TEST_P(TestBoundedTaskQueue, test_bounded_task_queue)
+{
+    int count = 10000;
+    std::atomic<int> sum(0);
+
+    auto f = [&]()
+    {
+        sum.fetch_add(1);
+    };
+
+    thread_pool_task_queue tp(8, 16, GetParam());
+    tp.run();
+    std::vector<std::thread> producers;
+    std::atomic<int> accepted(0);
+    for (int i = 0; i < 4; ++i)
+    {
+        producers.emplace_back([&]()
+        {
+            for (int j = 0; j < count / 4; ++j)
+            {
+                accepted.fetch_add(static_cast<int>(tp.add_task(f)));
+            }
+        });
+    }
+    for (auto &thr : producers)
+    {
+        thr.join();
+    }
+    tp.stop();
+
+    task_queue_stats stats = tp.stats();
+    EXPECT_EQ(tp.capacity(), 16);
+    EXPECT_EQ(stats.depth, 0);
+    EXPECT_GE(stats.enqueue_latency_max, 0);
+    EXPECT_LE(stats.enqueue_latency_max, stats.enqueue_latency_total);
+    switch (GetParam())
+    {
+    case overflow_policy::block :
+        EXPECT_EQ(sum, count);
+        EXPECT_EQ(accepted, count);
+        EXPECT_EQ(stats.enqueued, count);
+        break;
+    case overflow_policy::try_fail :
+        EXPECT_EQ(sum, accepted);
+        EXPECT_EQ(stats.rejected, count - accepted);
+        break;
+    case overflow_policy::caller_runs :
+        EXPECT_EQ(sum, count);
+        EXPECT_EQ(accepted, count);
+        EXPECT_EQ(stats.enqueued + stats.caller_ran, count);
+        break;
+    case overflow_policy::drop_oldest :
+        EXPECT_EQ(accepted, count);
+        EXPECT_EQ(sum + stats.dropped, count);
+        break;
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(CppevTest, TestBoundedTaskQueue,
+    testing::Values(
+        overflow_policy::block,
+        overflow_policy::try_fail,
+        overflow_policy::caller_runs,
+        overflow_policy::drop_oldest
+    )
+);
+
+TEST(TestThreadPool, test_bounded_task_queue_try_fail_when_full)
+{
+    std::mutex lock;
+    std::condition_variable cond;
+    bool release = false;
+
+    thread_pool_task_queue tp(1, 2, overflow_policy::try_fail);
+    tp.run();
+    auto blocker = [&]()
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        cond.wait(lk, [&]() { return release; });
+    };
+    EXPECT_TRUE(tp.add_task(blocker));
+    while (tp.stats().depth != 0)
+    {
+        std::this_thread::yield();
+    }
+    EXPECT_TRUE(tp.add_task(blocker));
+    EXPECT_TRUE(tp.add_task(blocker));
+    EXPECT_FALSE(tp.add_task(blocker));
+    EXPECT_EQ(tp.stats().depth, 2);
+    EXPECT_EQ(tp.stats().rejected, 1);
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        release = true;
+        cond.notify_all();
+    }
+    tp.stop();
+}
+
+TEST(TestThreadPool, test_unbounded_task_queue_rejects_after_stop)
+{
+    thread_pool_task_queue tp(2);
+    tp.run();
+    tp.stop();
+
+    // Rejected task is destroyed, so its future becomes ready
+    auto fut = tp.submit([]() { return 1; });
+    ASSERT_EQ(fut.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+    EXPECT_THROW(fut.get(), std::future_error);
+    EXPECT_FALSE(tp.add_task([]() {}));
+    EXPECT_EQ(tp.add_task(std::vector<thread_pool_task_handler>(3, []() {})), 0);
+    EXPECT_EQ(tp.stats().rejected, 5);
+    EXPECT_EQ(tp.stats().depth, 0);
+}
+
+TEST(TestThreadPool, test_task_inline_storage)
+{
+    int value = 0;
+    auto small = [&value]() { ++value; };
+    std::array<char, 128> payload{};
+    auto large = [&value, payload]() { value += payload.size(); };
+
+    EXPECT_TRUE(thread_pool_task::stored_inline<decltype(small)>());
+    EXPECT_FALSE(thread_pool_task::stored_inline<decltype(large)>());
+
+    thread_pool_task t1(small);
+    thread_pool_task t2(large);
+    thread_pool_task t3(std::move(t1));
+    EXPECT_FALSE(static_cast<bool>(t1));
+    t3();
+    t2();
+    t1 = std::move(t2);
+    t1();
+    EXPECT_EQ(value, 1 + 128 * 2);
+
+    auto ptr = std::make_unique<int>(6);
+    thread_pool_task t4([p = std::move(ptr), &value]() { value = *p; });
+    t4();
+    EXPECT_EQ(value, 6);
+}
+
+class TestTaskQueueSubmit
+: public testing::TestWithParam<int>
+{
+};
+
+TEST_P(TestTaskQueueSubmit, test_submit_future)
+{
+    thread_pool_task_queue tp(4, GetParam());
+    tp.run();
+
+    std::vector<std::future<int>> futs;
+    for (int i = 0; i < 100; ++i)
+    {
+        futs.push_back(tp.submit([](int x, int y) { return x * y; }, i, 2));
+    }
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(futs[i].get(), i * 2);
+    }
+
+    auto ptr = std::make_unique<std::string>("cppev");
+    auto fut = tp.submit([](std::unique_ptr<std::string> p) { return *p; }, std::move(ptr));
+    EXPECT_EQ(fut.get(), "cppev");
+
+    auto err = tp.submit([]() { throw_runtime_error("test"); });
+    EXPECT_THROW(err.get(), std::runtime_error);
+
+    tp.stop();
+}
+
+TEST_P(TestTaskQueueSubmit, test_task_group)
+{
+    thread_pool_task_queue tp(4, GetParam());
+    tp.run();
+
+    std::atomic<int> sum(0);
+    {
+        task_group group(tp);
+        for (int i = 0; i < 1000; ++i)
+        {
+            group.run([&sum]() { sum.fetch_add(1); });
+        }
+        group.wait();
+        EXPECT_EQ(sum, 1000);
+
+        group.run([]() { throw_runtime_error("test"); });
+        EXPECT_THROW(group.wait(), std::runtime_error);
+    }
+
+    // Every worker waits for nested group, which needs helping to avoid deadlock
+    sum = 0;
+    task_group outer(tp);
+    for (int i = 0; i < 16; ++i)
+    {
+        outer.run([&]()
+        {
+            task_group inner(tp);
+            for (int j = 0; j < 16; ++j)
+            {
+                inner.run([&sum]() { sum.fetch_add(1); });
+            }
+            inner.wait();
+        });
+    }
+    outer.wait();
+    EXPECT_EQ(sum, 16 * 16);
+
+    tp.stop();
+}
+
+INSTANTIATE_TEST_SUITE_P(CppevTest, TestTaskQueueSubmit,
+    testing::Values(0, 64)
+);
+
+class TestElasticThreadPool
+: public testing::TestWithParam<int>
+{
+};
+
+TEST_P(TestElasticThreadPool, test_elastic_thread_pool)
+{
+    thread_pool_task_queue tp(1, 4, std::chrono::milliseconds(2), std::chrono::milliseconds(50),
+        GetParam());
+    tp.run();
+    EXPECT_EQ(tp.size(), 1);
+
+    std::atomic<int> sum(0);
+    for (int i = 0; i < 40; ++i)
+    {
+        tp.add_task([&sum]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            sum.fetch_add(1);
+        });
+    }
+    while (sum < 40)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    thread_pool_stats stats = tp.pool_stats();
+    EXPECT_GT(stats.peak_size, 1);
+    EXPECT_LE(stats.peak_size, 4);
+    EXPECT_EQ(stats.spawned, stats.peak_size - 1);
+
+    // Extra workers retire after keepalive, core worker keeps serving
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (tp.size() != 1 && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(tp.size(), 1);
+    stats = tp.pool_stats();
+    EXPECT_EQ(stats.retired, stats.spawned);
+    ASSERT_GE(stats.history.size(), 3);
+    EXPECT_EQ(stats.history.front().size, 1);
+    EXPECT_EQ(stats.history.back().size, 1);
+    for (size_t i = 1; i < stats.history.size(); ++i)
+    {
+        EXPECT_LE(stats.history[i - 1].stamp, stats.history[i].stamp);
+    }
+
+    for (int i = 0; i < 10; ++i)
+    {
+        tp.add_task([&sum]() { sum.fetch_add(1); });
+    }
+    tp.stop();
+    EXPECT_EQ(sum, 50);
+}
+
+INSTANTIATE_TEST_SUITE_P(CppevTest, TestElasticThreadPool,
+    testing::Values(0, 64)
+);
+
+TEST(TestThreadPool, test_elastic_thread_pool_by_cancel)
+{
+    // Extra workers would outlive the pool for keepalive if they're not cancelled
+    auto start = std::chrono::steady_clock::now();
+    auto tp = std::make_unique<thread_pool_task_queue>(1, 4, std::chrono::milliseconds(2),
+        std::chrono::seconds(10));
+    tp->run();
+    for (int i = 0; i < 40; ++i)
+    {
+        tp->add_task([]() { std::this_thread::sleep_for(std::chrono::milliseconds(5)); });
+    }
+    while (tp->pool_stats().spawned == 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    tp->cancel();
+    tp->join();
+    tp.reset();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+TEST(TestThreadPool, test_elastic_thread_pool_invalid_param)
+{
+    EXPECT_THROW(thread_pool_task_queue(0, 4, std::chrono::milliseconds(1),
+        std::chrono::milliseconds(1)), std::logic_error);
+    EXPECT_THROW(thread_pool_task_queue(4, 2, std::chrono::milliseconds(1),
+        std::chrono::milliseconds(1)), std::logic_error);
+    EXPECT_THROW(thread_pool_task_queue(1, 2, std::chrono::milliseconds(0),
+        std::chrono::milliseconds(1)), std::logic_error);
+}
+
 }   // namespace cppev
 
 int main(int argc, char **argv)